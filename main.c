@@ -38,7 +38,7 @@ int main(int argc, char **argv)
         u32 ith_key = get_json_object_key(root, i, &parsed_json);
         u32 ith_val = get_json_value(root, i, &parsed_json);
         
-        printf("Root[%u]: Key = "); print_json_key(ith_key, &parsed_json);
+        printf("Root[%u]: Key = ", i); print_json_key(ith_key, &parsed_json);
         printf(", Value = ");       print_json_value(ith_val, &parsed_json);
         printf("\n");
     }
@@ -49,7 +49,7 @@ int main(int argc, char **argv)
         u32 ith_key = get_json_object_key(root, i, &parsed_json);
         u32 ith_val = get_json_value(root, i, &parsed_json);
 
-        printf("Root[%u]: Key = "); print_json_key(ith_key, &parsed_json);
+        printf("Root[%u]: Key = ", i); print_json_key(ith_key, &parsed_json);
         printf(", Value = ");
         if(is_json_value_number(ith_val, &parsed_json))
         {
@@ -5,14 +5,79 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+
+#include "parse_tables.h"
+
+// SIMD backend for the structural scanner. Define JSON_NO_SIMD to force the scalar fallback.
+#if !defined(JSON_NO_SIMD) && defined(__AVX2__)
+    #define JSON_SIMD_AVX2
+    #include <immintrin.h>
+#elif !defined(JSON_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+    #define JSON_SIMD_SSE
+    #include <emmintrin.h>
+    #if defined(__SSSE3__)
+        #define JSON_SIMD_SSSE3
+        #include <tmmintrin.h>
+    #endif
+#endif
+#if !defined(JSON_NO_SIMD) && defined(__PCLMUL__)
+    #include <wmmintrin.h>
+#endif
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+// Threads for batch parsing. Define JSON_NO_THREADS to parse batches on the calling thread only.
+#if !defined(JSON_NO_THREADS) && defined(_WIN32)
+    #define JSON_THREADS_WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#elif !defined(JSON_NO_THREADS)
+    #define JSON_THREADS_PTHREAD
+    #include <pthread.h>
+    #include <unistd.h>
+#endif
+
+// Mapping files for parse_json_file. Define JSON_NO_MMAP to read them into memory with stdio instead.
+// In strict ISO C modes glibc hides madvise, so build with _DEFAULT_SOURCE for the sequential access hint.
+#if !defined(JSON_NO_MMAP) && defined(_WIN32)
+    #define JSON_MMAP_WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#elif !defined(JSON_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+    #define JSON_MMAP_POSIX
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+// Writing output straight to file descriptors. Define JSON_NO_FD_OUTPUT to write only to buffers and write functions.
+#if !defined(JSON_NO_FD_OUTPUT) && defined(_WIN32)
+    #define JSON_FD_WIN32
+    #include <io.h>
+#elif !defined(JSON_NO_FD_OUTPUT) && (defined(__unix__) || defined(__APPLE__))
+    #define JSON_FD_POSIX
+    #include <errno.h>
+    #include <unistd.h>
+#endif
 
 // NOTE: I think I'm done with this. JSON sucks.
 
 // JSON PARSING:
 //  - Editing
 //  - Validation
-//      - Escape characters, backslashes, no control chars in strings
-//      - Numbers in valid formats
 //      - Have tildes in error arrow cover the offending token
 //      - No duplicate keys
 //  - Tidy
@@ -32,9 +97,8 @@
 //          - May make it easier to adapt this parsing code to another codebase which doesn't want it to printf
 //  - Testing
 //  - Performance
-//  - Remove recursion in favour of linear functions with stack for control flow?
 //  - Asserts?
-//  - Strings are assumed UTF-8 - Anyone sending emoji over json is insane
+//  - Strings are assumed UTF-8 unless JSON_PARSE_CHECK_UTF8 is set - Anyone sending emoji over json is insane
 
 // Some util stuff - Typedefs and easy functions
 
@@ -47,6 +111,20 @@ typedef int64_t  s64;
 typedef float    f32;
 typedef double   f64;
 
+// Offsets into src and its size, and indices into a parse's arenas. They're 32 bits unless
+// JSON_64BIT_OFFSETS is defined, which parses src of 4 GB and over for twice the memory per
+// structural position, token and DOM index.
+#ifdef JSON_64BIT_OFFSETS
+typedef u64 json_size;
+#define JSON_SIZE_MAX 0xFFFFFFFFFFFFFFFFull
+#else
+typedef u32 json_size;
+#define JSON_SIZE_MAX 0xFFFFFFFFu
+#endif
+
+// Biggest src a parse takes, so the positions and tokens past its last byte can be counted
+#define JSON_MAX_SRC_SIZE (JSON_SIZE_MAX - 2)
+
 u8 is_letter(unsigned char c)
 {
     c &= 0b11011111;
@@ -78,6 +156,45 @@ u8 is_symbol_with_meaning(unsigned char c)
            c == '"' || c == '.';
 }
 
+// Index of lowest set bit, x must be non-zero
+u32 json_ctz64(u64 x)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return index;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+u32 json_popcount64(u64 x)
+{
+#if defined(_MSC_VER)
+    return (u32)__popcnt64(x);
+#else
+    return __builtin_popcountll(x);
+#endif
+}
+
+// Bit i of the result is the xor of bits 0..i of x
+u64 json_prefix_xor(u64 x)
+{
+#if !defined(JSON_NO_SIMD) && defined(__PCLMUL__)
+    __m128i all_ones = _mm_set1_epi8((char)0xFF);
+    __m128i result   = _mm_clmulepi64_si128(_mm_set_epi64x(0, (s64)x), all_ones, 0);
+    return (u64)_mm_cvtsi128_si64(result);
+#else
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+#endif
+}
+
 // ============================== Parsing ===================================
 
 typedef void* (*alloc_func)(u64);
@@ -95,6 +212,61 @@ void set_allocation_functions(alloc_func given_alloc, realloc_func given_realloc
     dealloc      = given_dealloc;
 }
 
+// Every allocation the parser makes goes through one of these. user_data is handed back to
+// each function so a parser can carry its own arena or per-thread heap, a NULL allocator
+// falls back to the process-wide functions given to set_allocation_functions.
+// Allocators shared by a parse which uses worker threads must be safe to call from them.
+typedef struct
+{
+    void  *user_data;
+    void *(*alloc)(void *user_data, u64 size);
+    void *(*resize)(void *user_data, void *ptr, u64 size);
+    void  (*dealloc)(void *user_data, void *ptr);
+} json_allocator;
+
+void *json_default_alloc(void *user_data, u64 size)
+{
+    (void)user_data;
+    return alloc(size);
+}
+
+void *json_default_resize(void *user_data, void *ptr, u64 size)
+{
+    (void)user_data;
+    return resize_alloc(ptr, size);
+}
+
+void json_default_dealloc(void *user_data, void *ptr)
+{
+    (void)user_data;
+    dealloc(ptr);
+}
+
+json_allocator json_default_allocator = {NULL, &json_default_alloc, &json_default_resize, &json_default_dealloc};
+
+json_allocator *get_json_allocator(json_allocator *allocator)
+{
+    return (allocator && allocator->alloc) ? allocator : &json_default_allocator; // Zeroed ones too
+}
+
+void *json_alloc(json_allocator *allocator, u64 size)
+{
+    allocator = get_json_allocator(allocator);
+    return allocator->alloc(allocator->user_data, size);
+}
+
+void *json_resize(json_allocator *allocator, void *ptr, u64 size)
+{
+    allocator = get_json_allocator(allocator);
+    return allocator->resize(allocator->user_data, ptr, size);
+}
+
+void json_dealloc(json_allocator *allocator, void *ptr)
+{
+    allocator = get_json_allocator(allocator);
+    allocator->dealloc(allocator->user_data, ptr);
+}
+
 typedef enum
 {
     JSON_NONE,
@@ -105,6 +277,8 @@ typedef enum
     JSON_STRING,
     JSON_OBJECT,
     JSON_ARRAY,
+    JSON_INT64,
+    JSON_UINT64,
 } json_type;
 
 const char *json_type_names[] =
@@ -117,8 +291,23 @@ const char *json_type_names[] =
     "STRING",
     "OBJECT",
     "ARRAY",
+    "INT64",
+    "UINT64",
 };
 
+// Integers which fit in 64 bits are kept as JSON_INT64 (or JSON_UINT64 above INT64_MAX), never
+// going through floating point. Everything else is a JSON_NUMBER f64.
+typedef struct
+{
+    json_type type;
+    union
+    {
+        f64 number;
+        s64 int64;
+        u64 uint64;
+    };
+} json_number;
+
 typedef struct
 {
     u32   hash;
@@ -178,26 +367,32 @@ typedef enum
     TOKEN_END,
 } json_token_type;
 
+// Tokens are packed into 8 bytes (16 with JSON_64BIT_OFFSETS), everything else about them is read
+// from the source when it's needed. Tokens longer than JSON_TOKEN_MAX_LENGTH are measured again by get_json_token_length.
+#define JSON_TOKEN_MAX_LENGTH 0xFFFFFF
+
 typedef struct
 {
-    json_token_type type;
-    const char     *loc;
-    u32             length;
-    u32             loc_by_chars;
-    u32             loc_from_end_by_chars;
-    union
-    {
-        f64 numeric_value;
-        u8  boolean_value;
-    };
+    json_size loc;         // Offset from the start of src
+    u32       type   : 8;  // json_token_type
+    u32       length : 24;
 } json_token;
 
+json_token make_json_token(json_token_type type, json_size loc, u32 length)
+{
+    json_token token;
+    token.loc    = loc;
+    token.type   = type;
+    token.length = (length < JSON_TOKEN_MAX_LENGTH) ? length : JSON_TOKEN_MAX_LENGTH;
+    return token;
+}
+
 typedef struct
 {
-    u32         num_tokens;
-    u32         token_index;
+    json_size   num_tokens;
+    json_size   token_index;
     json_token *tokens;
-    u32         src_size;
+    json_size   src_size;
     const char *src;
 } json_tokenised;
 
@@ -207,65 +402,224 @@ typedef enum
     JSON_STATUS_TOKENISED,
     JSON_STATUS_VALID,
     JSON_STATUS_INVALID,
+    JSON_STATUS_INVALID_UTF8,
     JSON_STATUS_COUNTED,
     JSON_STATUS_PARSED,
+    JSON_STATUS_ABORTED,
+    JSON_STATUS_NEED_MORE, // Push parser wants the next chunk
+    JSON_STATUS_OUT_OF_MEMORY, // Parser's fixed buffer is smaller than get_json_parser_buffer_size
+    JSON_STATUS_UNREADABLE,    // A file couldn't be read, is too big for json_size or isn't a snapshot this build loads
 } json_parse_status;
 
-typedef u32 json_val_ptr;
-typedef u32 json_str_ptr;
-typedef u32 json_ooa_ptr;
+u32 get_json_hash_bucket_bits(u32 num_keys)
+{
+    u32 bits = 1;
+    while((1u << bits) < num_keys) bits += 1;
+    return bits;
+}
+
+u32 get_json_hash_bucket(u32 hash, u32 bucket_bits)
+{
+    // Fibonacci hashing spreads djb2's low bits over the top ones
+    return (hash * 0x9E3779B1u) >> (32 - bucket_bits);
+}
+
+typedef json_size json_val_ptr;
+typedef json_size json_str_ptr;
+typedef json_size json_ooa_ptr;
+typedef json_size json_hash_ptr;
 
 typedef struct
 {
     // References and inferences for ooa
     json_type    type;
-    u32          size;
-    json_val_ptr vals_index;
-    json_str_ptr keys_index;
+    json_size    size;
+    json_val_ptr  vals_index;
+    json_str_ptr  keys_index;
+    json_hash_ptr hash_index; // Object's key hash table in hash_arena, 0 if its keys are scanned
+    json_ooa_ptr  shape;      // First object with the same keys, whose keys and hash table it shares
 } json_ooa;
 
 typedef struct
 {
-    u32 size;
-    u32 cap;
+    json_size size;
+    json_size cap;
     json_ooa *ooas;
 } json_ooa_list;
 
 typedef struct
 {
-    u32   cap;
-    u32   allocd;
-    u32   allocs;
-    void *buffer;
+    json_size cap;
+    json_size allocd;
+    json_size allocs;
+    void     *buffer;
 } json_mem_arena;
 
-u32 alloc_arena_mem(json_mem_arena *arena, u32 alloc_size, u32 num_allocs)
+json_size alloc_arena_mem(json_mem_arena *arena, u32 alloc_size, json_size num_allocs)
 {
-    u32 total_alloc_size = alloc_size * num_allocs;
-    u32 alloc_loc = arena->allocs;
+    json_size total_alloc_size = alloc_size * num_allocs;
+    json_size alloc_loc = arena->allocs;
     arena->allocd += total_alloc_size;
     arena->allocs += num_allocs;
     return alloc_loc;
 }
 
+// For arenas addressed by index only, since the buffer moves when it grows
+json_size alloc_growable_arena_mem(json_mem_arena *arena, u32 alloc_size, json_size num_allocs, json_allocator *allocator)
+{
+    json_size total_alloc_size = alloc_size * num_allocs;
+    if(arena->allocd + total_alloc_size > arena->cap)
+    {
+        json_size cap = (arena->cap > 0) ? arena->cap : 128 * alloc_size;
+        while(cap < arena->allocd + total_alloc_size) cap *= 2;
+        arena->buffer = json_resize(allocator, arena->buffer, cap);
+        arena->cap    = cap;
+    }
+    return alloc_arena_mem(arena, alloc_size, num_allocs);
+}
+
+void free_arena_mem(json_mem_arena *arena, u32 alloc_size, json_size num_allocs)
+{
+    arena->allocd -= alloc_size * num_allocs;
+    arena->allocs -= num_allocs;
+}
+
 #define get_arena_nth_alloc(arena, n, type) &((type*)arena->buffer)[n]
 
-#define alloc_json_values(arena, num_values)   (json_val_ptr)alloc_arena_mem(arena, sizeof(json_value), num_values)
+#define alloc_json_values(arena, num_values)   (json_val_ptr)alloc_arena_mem(arena, sizeof(json_stored_value), num_values)
 #define alloc_json_strings(arena, num_strings) (json_str_ptr)alloc_arena_mem(arena, sizeof(json_string), num_strings)
 #define alloc_json_chars(arena, num_chars)     (char*)(arena->buffer + alloc_arena_mem(arena, 1, num_chars))
 
+typedef enum
+{
+    JSON_PARSE_DEFAULT        = 0,
+    JSON_PARSE_SINGLE_PASS    = 1 << 0, // Validate and populate in one walk over the structural index
+    JSON_PARSE_ZERO_COPY      = 1 << 1, // Strings without escapes point into src, which has to outlive the json_parsed
+    JSON_PARSE_CHECK_UTF8     = 1 << 2, // src has to be valid UTF-8, checked while it's indexed
+    JSON_PARSE_NO_KEY_HASH    = 1 << 3, // Don't build hash tables for large objects, all key lookups scan
+    JSON_PARSE_PARALLEL       = 1 << 4, // Index (and tokenise, without SINGLE_PASS) large src on every core
+    JSON_PARSE_NO_KEY_SHARING = 1 << 5, // Every key and object's keys are stored, even repeats
+} json_parse_flags;
+
+// Where an ooa's tokens and chars are, so it can be populated on its own
+typedef struct
+{
+    json_size first_token;  // Obrace or obrack
+    json_size last_token;   // Cbrace or cbrack
+    json_size end_ooa;      // First ooa after the ones nested in it
+    json_size chars_before; // Chars counted before it
+    json_size chars_after;  // Chars counted up to its close
+} json_ooa_span;
+
+#ifndef JSON_MAX_DEPTH
+#define JSON_MAX_DEPTH 1024 // Deepest objects and arrays nest unless a parser says otherwise
+#endif
+
+// Passes over the tokens walk nested objects and arrays with a stack of these rather than
+// recursing, so how deep src nests can't run a thread out of stack. It's max_depth long, and
+// src nested deeper is invalid.
+typedef struct
+{
+    json_type    type;
+    json_ooa_ptr ooa;
+    json_size    num_values; // Counted or populated so far
+    json_size    keys_base;  // Where its keys start in the key stack while it's populated
+} json_open_level;
+
+// Repeated keys and objects' key sequences are kept once a parse. Keys are interned, a repeat gets
+// the first's chars rather than copying its own. Objects with the same keys in the same order share
+// a shape, the first's keys (and its hash table) which the rest point to rather than storing their
+// own. Both are found in open addressed tables of a power of two slots. They start small and double
+// as they fill, up to twice the keys or objects a parse could have, capped by the maximums, and
+// stop taking more once they're half full, so parses with huge numbers of distinct keys store the
+// rest as they are. Parses of fewer keys than JSON_KEY_SHARING_THRESHOLD don't share them, there's
+// little to save and setting the tables up costs more than it does.
+#ifndef JSON_MAX_INTERNED_KEYS
+#define JSON_MAX_INTERNED_KEYS 65536
+#endif
+#ifndef JSON_MAX_SHAPES
+#define JSON_MAX_SHAPES 65536
+#endif
+#ifndef JSON_KEY_SHARING_THRESHOLD
+#define JSON_KEY_SHARING_THRESHOLD 64
+#endif
+#ifndef JSON_KEY_TABLE_BITS
+#define JSON_KEY_TABLE_BITS 6 // Slots tables start with
+#endif
+
+typedef struct
+{
+    u32          hash; // Of its keys
+    json_ooa_ptr ooa;  // First object with the keys, 0 if the slot's empty
+} json_shape;
+
+// What parses share: the allocator, and buffers which are kept between parses and only grown, so
+// once they're big enough parsing allocates nothing (but the handful a parallel parse's threads
+// take). A parse's result lives in them until the parser's next parse, reset or dealloc, unless
+// it's detached. A parser is used by one parse at a time, threads parsing at once want one each.
+typedef struct
+{
+    json_allocator   allocator;
+    u32              flags;
+    u32              num_threads;        // With JSON_PARSE_PARALLEL, 0 uses one per core
+    u32              max_depth;          // 0 for JSON_MAX_DEPTH
+    char            *fixed_buffer;       // Buffers are carved from this instead, see init_json_parser_with_buffer
+    u64              fixed_size;
+    json_size        positions_cap;
+    json_size       *positions;          // Structural index
+    json_size        token_cap;
+    json_token      *tokens;
+    u32              levels_cap;
+    json_open_level *levels;
+    json_ooa_list    ooa_list;
+    json_mem_arena   ooa_spans;
+    json_mem_arena   open_ooas;          // Single pass' stacks
+    json_mem_arena   value_stack;
+    json_mem_arena   key_stack;          // Objects' keys until they close
+    u32              interned_cap;
+    json_string     *interned;
+    u32              shapes_cap;
+    json_shape      *shapes;
+    u64              parsed_cap;
+    char            *parsed_buffer;      // Result's keys, values and chars
+    json_mem_arena   hash_arena;
+} json_parser;
+
 typedef struct
 {
     json_parse_status status;
+    json_size         error_offset; // Offset into src of the invalid token or UTF-8 sequence
+    u32               flags;
+    u32               num_threads;  // For indexing and tokenising, 1 (or 0) to use just the calling thread
+    json_parser      *parser;       // Whose buffers it parses into
+    json_allocator   *allocator;
+    u32               max_depth;
+    json_open_level  *levels;       // max_depth of them
+    u32               interned_bits;
+    u32               interned_max_bits;
+    json_string      *interned;     // NULL when keys aren't shared, empty slots have NULL chars
+    u32               num_interned;
+    u32               shape_bits;
+    u32               shape_max_bits;
+    json_shape       *shapes;
+    u32               num_shapes;
     json_tokenised    token_src;
-    u32               num_chars_counted;
-    u32               num_ooas_parsed;
+    json_size         num_chars_counted;
+    json_size         num_ooas_parsed;
     json_ooa_list     ooa_list;
+    json_mem_arena    ooa_spans;    // json_ooa_span per ooa, only counted when populating in parallel
     json_mem_arena    keys_arena;
     json_mem_arena    values_arena;
     json_mem_arena    chars_arena;
 } json_parse_state;
 
+// Parser buffers are refilled by each parse, so they don't keep what was in them when they grow
+void *grow_json_parser_mem(json_parser *parser, void *mem, u64 size)
+{
+    if(mem) json_dealloc(&parser->allocator, mem);
+    return json_alloc(&parser->allocator, size);
+}
+
 typedef struct
 {
     json_type type;
@@ -273,12 +627,163 @@ typedef struct
     {
         void        *base;
         f64          number;
+        s64          int64;
+        u64          uint64;
         u8           boolean;
         json_string  string;
         json_ooa_ptr ooa;
     };
 } json_value;
 
+// Values are read and written as json_values, but kept in values_arena as json_stored_values. They're
+// the same unless JSON_COMPACT_VALUES is defined, which NaN-boxes them into 8 bytes rather than 24.
+// A stored value is then an f64, unless its top 13 bits are set (a NaN, which numbers never parse
+// to), in which case the 3 bits under them are a tag and the 48 below its payload. Strings and
+// integers too big for the payload are boxed in chars_arena and the payload is where. Counting
+// makes room for the boxes, and JSON_BOXED_*_CHARS are 0 without JSON_COMPACT_VALUES.
+#ifdef JSON_COMPACT_VALUES
+
+typedef u64 json_stored_value;
+
+#define JSON_BOXED           0xFFF8000000000000ull
+#define JSON_BOX_PAYLOAD     0x0000FFFFFFFFFFFFull
+#define JSON_BOX_UNSIGNED    0x0000800000000000ull // Boxed integer's payload bit for a JSON_UINT64
+#define JSON_BOX_INT_LIMIT   (1ll << 47)           // Integers in [-limit, limit) are kept in the payload
+
+#define JSON_BOXED_STRING_CHARS   sizeof(json_string)
+#define JSON_BOXED_INTEGER_CHARS  sizeof(u64)
+#define JSON_INLINE_NUMBER_LENGTH 14 // Integers with this many chars or fewer are under JSON_BOX_INT_LIMIT
+
+typedef enum
+{
+    JSON_BOX_BIG_INT, // Boxed in chars_arena
+    JSON_BOX_DOESNT_EXIST,
+    JSON_BOX_NULL,
+    JSON_BOX_BOOL,
+    JSON_BOX_STRING,
+    JSON_BOX_OBJECT,
+    JSON_BOX_ARRAY,
+    JSON_BOX_INT,     // Sign extended from the payload
+} json_box_tag;
+
+json_stored_value box_json_value(json_box_tag tag, u64 payload)
+{
+    return JSON_BOXED | ((u64)tag << 48) | (payload & JSON_BOX_PAYLOAD);
+}
+
+void store_json_value(json_stored_value *dst, json_value *value, json_mem_arena *chars_arena)
+{
+    switch(value->type)
+    {
+        case JSON_NUMBER: *dst = value->uint64;                         break;
+        case JSON_NULL:   *dst = box_json_value(JSON_BOX_NULL, 0);      break;
+        case JSON_BOOL:   *dst = box_json_value(JSON_BOX_BOOL, value->boolean);  break;
+        case JSON_OBJECT: *dst = box_json_value(JSON_BOX_OBJECT, value->ooa);    break;
+        case JSON_ARRAY:  *dst = box_json_value(JSON_BOX_ARRAY, value->ooa);     break;
+        case JSON_STRING:
+        {
+            json_size offset = alloc_arena_mem(chars_arena, 1, sizeof(json_string));
+            memcpy((char*)chars_arena->buffer + offset, &value->string, sizeof(json_string));
+            *dst = box_json_value(JSON_BOX_STRING, offset);
+            break;
+        }
+        case JSON_INT64:
+        {
+            if(value->int64 >= -JSON_BOX_INT_LIMIT && value->int64 < JSON_BOX_INT_LIMIT)
+            {
+                *dst = box_json_value(JSON_BOX_INT, (u64)value->int64);
+                break;
+            }
+        } // Fall through
+        case JSON_UINT64:
+        {
+            json_size offset = alloc_arena_mem(chars_arena, 1, sizeof(u64));
+            memcpy((char*)chars_arena->buffer + offset, &value->uint64, sizeof(u64));
+            *dst = box_json_value(JSON_BOX_BIG_INT, offset | ((value->type == JSON_UINT64) ? JSON_BOX_UNSIGNED : 0));
+            break;
+        }
+        default:
+        {
+            *dst = box_json_value(JSON_BOX_DOESNT_EXIST, value->ooa);
+            break;
+        }
+    }
+}
+
+json_value load_boxed_json_value(u64 bits, const char *chars)
+{
+    json_value value   = {0};
+    u64        payload = bits & JSON_BOX_PAYLOAD;
+    switch((json_box_tag)((bits >> 48) & 7))
+    {
+        case JSON_BOX_DOESNT_EXIST: value.type = JSON_DOESNT_EXIST; value.ooa = (json_ooa_ptr)payload; break;
+        case JSON_BOX_NULL:         value.type = JSON_NULL;                                            break;
+        case JSON_BOX_BOOL:         value.type = JSON_BOOL;   value.boolean = (u8)payload;             break;
+        case JSON_BOX_OBJECT:       value.type = JSON_OBJECT; value.ooa = (json_ooa_ptr)payload;       break;
+        case JSON_BOX_ARRAY:        value.type = JSON_ARRAY;  value.ooa = (json_ooa_ptr)payload;       break;
+        case JSON_BOX_STRING:
+        {
+            value.type = JSON_STRING;
+            memcpy(&value.string, chars + payload, sizeof(json_string));
+            break;
+        }
+        case JSON_BOX_INT:
+        {
+            value.type  = JSON_INT64;
+            value.int64 = (s64)((payload ^ JSON_BOX_INT_LIMIT) - JSON_BOX_INT_LIMIT);
+            break;
+        }
+        case JSON_BOX_BIG_INT:
+        {
+            value.type = (payload & JSON_BOX_UNSIGNED) ? JSON_UINT64 : JSON_INT64;
+            memcpy(&value.uint64, chars + (payload & ~JSON_BOX_UNSIGNED), sizeof(u64));
+            break;
+        }
+    }
+    return value;
+}
+
+// chars is chars_arena's buffer. Numbers are split off first so they're quick to read.
+json_value load_json_value(json_stored_value *src, const char *chars)
+{
+    if((*src & JSON_BOXED) == JSON_BOXED) return load_boxed_json_value(*src, chars);
+
+    json_value value;
+    value.type   = JSON_NUMBER;
+    value.uint64 = *src;
+    return value;
+}
+
+#else
+
+typedef json_value json_stored_value;
+
+#define JSON_BOXED_STRING_CHARS   0
+#define JSON_BOXED_INTEGER_CHARS  0
+#define JSON_INLINE_NUMBER_LENGTH JSON_TOKEN_MAX_LENGTH
+
+void store_json_value(json_stored_value *dst, json_value *value, json_mem_arena *chars_arena)
+{
+    (void)chars_arena;
+    *dst = *value;
+}
+
+json_value load_json_value(json_stored_value *src, const char *chars)
+{
+    (void)chars;
+    return *src;
+}
+
+#endif
+
+// Most chars_arena could need for boxes, over what strings' chars need, given src's structural
+// index. String values start and end at indexed quotes, integers too big for a payload are longer
+// than JSON_INLINE_NUMBER_LENGTH.
+u64 get_json_boxed_chars_bound(json_size num_positions, json_size src_size)
+{
+    return ((u64)num_positions/2 + 1) * JSON_BOXED_STRING_CHARS + ((u64)src_size/(JSON_INLINE_NUMBER_LENGTH + 1) + 1) * JSON_BOXED_INTEGER_CHARS;
+}
+
 void print_json_value_type_string(json_value *val)
 {
     printf("%s", json_type_names[val->type]);
@@ -291,22 +796,24 @@ void print_json_value_contents(json_value *val)
         case JSON_NONE:         printf("???");                  break;
         case JSON_DOESNT_EXIST: printf("DOESN'T EXIST");        break;
         case JSON_NUMBER:       printf("%f", val->number);      break;
+        case JSON_INT64:        printf("%lld", (long long)val->int64);           break;
+        case JSON_UINT64:       printf("%llu", (unsigned long long)val->uint64); break;
         case JSON_BOOL:         printf("%u", val->boolean);     break;
         case JSON_NULL:         printf("null");                 break;
         case JSON_STRING:       print_json_string(val->string); break;
         case JSON_OBJECT:
-        case JSON_ARRAY:        printf("Index %u", val->ooa);   break;
+        case JSON_ARRAY:        printf("Index %llu", (unsigned long long)val->ooa); break;
     }
 }
 
-json_ooa *push_ooa_to_list(json_ooa_list *ooa_list, json_type type)
+json_ooa *push_ooa_to_list(json_ooa_list *ooa_list, json_type type, json_allocator *allocator)
 {
-    u32 cap  = ooa_list->cap;
-    u32 size = ooa_list->size;
+    json_size cap  = ooa_list->cap;
+    json_size size = ooa_list->size;
     if(size == cap)
     {
-        cap = 2 * cap;
-        ooa_list->ooas = (json_ooa*)realloc(ooa_list->ooas, cap * sizeof(json_ooa));
+        cap = (cap > 0) ? 2 * cap : 64;
+        ooa_list->ooas = (json_ooa*)json_resize(allocator, ooa_list->ooas, cap * sizeof(json_ooa));
         ooa_list->cap  = cap;
     }
     json_ooa *ooa    = &ooa_list->ooas[size];
@@ -314,1005 +821,6616 @@ json_ooa *push_ooa_to_list(json_ooa_list *ooa_list, json_type type)
     ooa->size        = 0;
     ooa->vals_index  = 0;
     ooa->keys_index  = 0;
+    ooa->hash_index  = 0;
+    ooa->shape       = 0;
     ooa_list->size  += 1;
     return ooa;
 }
 
-// ============================== Tokenising ===================================
+// ============================== Threads ===================================
 
-void print_token_type(json_token_type t)
+typedef void (*json_thread_func)(void*);
+
+typedef struct
 {
-    switch(t)
-    {
-        case TOKEN_STRING: printf("TOKEN_STRING"); break;
-        case TOKEN_WORD:   printf("TOKEN_WORD");   break;
-        case TOKEN_NUMBER: printf("TOKEN_NUMBER"); break;
-        case TOKEN_BOOL:   printf("TOKEN_BOOL");   break;
-        case TOKEN_NULL:   printf("TOKEN_NULL");   break;
-        case TOKEN_STOP:   printf("TOKEN_STOP");   break;
-        case TOKEN_COMMA:  printf("TOKEN_COMMA");  break;
-        case TOKEN_COLON:  printf("TOKEN_COLON");  break;
-        case TOKEN_OBRACK: printf("TOKEN_OBRACK"); break;
-        case TOKEN_CBRACK: printf("TOKEN_CBRACK"); break;
-        case TOKEN_OBRACE: printf("TOKEN_OBRACE"); break;
-        case TOKEN_CBRACE: printf("TOKEN_CBRACE"); break;
-        case TOKEN_END:    printf("TOKEN_END");    break;
-        default:           printf("TOKEN_UNKNOWN");break;
-    }
+    json_thread_func func;
+    void            *arg;
+#if defined(JSON_THREADS_WIN32)
+    HANDLE           handle;
+#elif defined(JSON_THREADS_PTHREAD)
+    pthread_t        handle;
+#endif
+} json_thread;
+
+#if defined(JSON_THREADS_WIN32)
+DWORD WINAPI run_json_thread(LPVOID thread)
+{
+    ((json_thread*)thread)->func(((json_thread*)thread)->arg);
+    return 0;
 }
+#elif defined(JSON_THREADS_PTHREAD)
+void *run_json_thread(void *thread)
+{
+    ((json_thread*)thread)->func(((json_thread*)thread)->arg);
+    return NULL;
+}
+#endif
 
-json_string copy_to_json_string_no_quotes(json_token *token, char *string_buffer)
+// Returns 0 if the thread couldn't be started (or there are no threads), the caller has to run func itself
+u8 start_json_thread(json_thread *thread, json_thread_func func, void *arg)
 {
-    json_string string = {.size = token->length-2, .chars = string_buffer};
-    for(u32 i = 1; i < token->length-1; i += 1)
-    {
-        string.chars[i-1] = token->loc[i];
-    }
-    compute_json_string_hash(&string);
-    return string;
+    thread->func = func;
+    thread->arg  = arg;
+#if defined(JSON_THREADS_WIN32)
+    thread->handle = CreateThread(NULL, 0, run_json_thread, thread, 0, NULL);
+    return thread->handle != NULL;
+#elif defined(JSON_THREADS_PTHREAD)
+    return pthread_create(&thread->handle, NULL, run_json_thread, thread) == 0;
+#else
+    return 0;
+#endif
 }
 
-json_string token_to_json_string_no_copy(json_token *token)
+void join_json_thread(json_thread *thread)
 {
-    json_string string = {.size = token->length, .chars = token->loc};
-    compute_json_string_hash(&string);
-    return string;
+#if defined(JSON_THREADS_WIN32)
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#elif defined(JSON_THREADS_PTHREAD)
+    pthread_join(thread->handle, NULL);
+#endif
 }
 
-void print_json_token_info(json_token *t)
+u32 get_json_num_cores()
 {
-    printf("Token: Type("); print_token_type(t->type); printf(") ");
-    printf("Loc(%p), Len(%u)\n", t->loc, t->length);
+#if defined(JSON_THREADS_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#elif defined(JSON_THREADS_PTHREAD)
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return (num_cores > 0) ? (u32)num_cores : 1;
+#else
+    return 1;
+#endif
 }
 
-void print_json_token(json_token *t)
+// Returns the value before adding
+u32 json_atomic_add(volatile u32 *value, u32 add)
 {
-    switch(t->type)
+#if defined(_MSC_VER)
+    return (u32)_InterlockedExchangeAdd((volatile long*)value, (long)add);
+#else
+    return __atomic_fetch_add(value, add, __ATOMIC_RELAXED);
+#endif
+}
+
+u32 json_atomic_load(volatile u32 *value)
+{
+#if defined(_MSC_VER)
+    return (u32)_InterlockedOr((volatile long*)value, 0);
+#else
+    return __atomic_load_n(value, __ATOMIC_RELAXED);
+#endif
+}
+
+u64 json_atomic_load_64(volatile u64 *value)
+{
+#if defined(_MSC_VER)
+    return (u64)_InterlockedOr64((volatile __int64*)value, 0);
+#else
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+// Returns 1 if value was expected and is now desired
+u8 json_atomic_swap_if_64(volatile u64 *value, u64 expected, u64 desired)
+{
+#if defined(_MSC_VER)
+    return (u64)_InterlockedCompareExchange64((volatile __int64*)value, (__int64)desired, (__int64)expected) == expected;
+#else
+    return __atomic_compare_exchange_n(value, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+// Runs func once per arg on its own thread, the calling thread taking the first, and waits for them
+// all. args is num_args of arg_size bytes, or one arg shared by them all if arg_size is 0.
+void run_json_threads(json_thread_func func, void *args, u32 arg_size, u32 num_args, json_allocator *allocator)
+{
+    json_thread *threads = (num_args > 1) ? (json_thread*)json_alloc(allocator, (num_args - 1) * sizeof(json_thread)) : NULL;
+    u32 num_started = 0;
+    for(u32 i = 1; i < num_args; i += 1)
     {
-        case TOKEN_STRING:
-        case TOKEN_WORD:
-        {
-            printf("%.*s", t->length, t->loc);
-            break;
-        }
-        case TOKEN_NUMBER:
-        {
-            printf("%f", t->numeric_value);
-            break;
-        }
-        case TOKEN_BOOL:
-        {
-            if(t->boolean_value) printf("true");
-            else                 printf("false");
-            break;
-        }
-        case TOKEN_NULL:
-        {
-            printf("null");
-            break;
-        }
-        case TOKEN_END:
-        {
-            printf("<END>");
-            break;
-        }
-        case TOKEN_COMMA:
-        case TOKEN_COLON:
-        case TOKEN_OBRACK:
-        case TOKEN_CBRACK:
-        case TOKEN_OBRACE:
-        case TOKEN_CBRACE:
-        {
-            printf("%c", t->type);
-            break;
-        }
-        default:
-        {
-            printf("<???>");
-            break;
-        }
+        void *arg = (char*)args + i * arg_size;
+        if(start_json_thread(&threads[num_started], func, arg)) num_started += 1;
+        else                                                   func(arg);
     }
+    func(args);
+    for(u32 i = 0; i < num_started; i += 1) join_json_thread(&threads[i]);
+    if(threads) json_dealloc(allocator, threads);
 }
 
-json_token read_json_token(const char *src, const char *src_start, const char *src_end)
+// Work stealing over a range of items. Each thread owns a slice of it and takes runs of items from
+// the front, and once its own is empty, steals runs from the back of the others'. A slice's next
+// and end are swapped together so the owner and thieves never take the same items.
+
+typedef struct
 {
-    for(; is_whitespace(*src); src += 1);
-    json_token token = {.loc = src, .loc_by_chars = src - src_start, .loc_from_end_by_chars = src_end - src};
+    volatile u64 range; // Next item in the high half, end in the low half
+} json_work_slice;
 
-    if(src >= src_end)
+// Shares items first up to end between the slices
+void init_json_work_slices(json_work_slice *slices, u32 num_slices, u32 first, u32 end)
+{
+    u64 num_items = end - first;
+    for(u32 i = 0; i < num_slices; i += 1)
     {
-        token.type   = TOKEN_END;
-        token.loc    = src_end;
-        token.length = 0;
+        u64 slice_first = first + num_items * i / num_slices;
+        u64 slice_end   = first + num_items * (i+1) / num_slices;
+        slices[i].range = (slice_first << 32) | slice_end;
     }
-    else switch(*src)
+}
+
+u8 take_json_work(json_work_slice *slice, u32 run_size, u8 steal, u32 *first, u32 *end)
+{
+    for(;;)
     {
-        case ',':
-        case ':':
-        case '[':
-        case ']':
-        case '{':
-        case '}':
-        case '.':
+        u64 range = json_atomic_load_64(&slice->range);
+        u32 next  = (u32)(range >> 32);
+        u32 last  = (u32)range;
+        if(next >= last) return 0;
+
+        u32 take = (last - next < run_size) ? last - next : run_size;
+        if(steal)
         {
-            token.type   = *src;
-            token.length = 1;
-            break;
+            *first = last - take;
+            *end   = last;
+            if(json_atomic_swap_if_64(&slice->range, range, ((u64)next << 32) | *first)) return 1;
         }
-        case '"':
+        else
         {
-            // String token includes the surrounding quote marks
-            token.type = TOKEN_STRING;
-            const char *c = src + 1;
-            for(; c < src_end && *c != '"'; c += 1);
-            token.length = (c - src) + 1;
-            break;
+            *first = next;
+            *end   = next + take;
+            if(json_atomic_swap_if_64(&slice->range, range, ((u64)*end << 32) | last)) return 1;
         }
-        case 'n':
+    }
+}
+
+// Returns 0 once every slice is empty
+u8 next_json_work(json_work_slice *slices, u32 num_slices, u32 own_slice, u32 run_size, u32 *first, u32 *end)
+{
+    if(take_json_work(&slices[own_slice], run_size, 0, first, end)) return 1;
+    for(u32 i = 1; i < num_slices; i += 1)
+    {
+        if(take_json_work(&slices[(own_slice + i) % num_slices], run_size, 1, first, end)) return 1;
+    }
+    return 0;
+}
+
+// ============================== Files ===================================
+
+// Files are mapped rather than read where they can be, so pages are read in by the OS as they're
+// first touched and never copied. Either way at least JSON_FILE_PADDING zero bytes follow the
+// file's last byte, so vector loads running past the end stay in readable memory. Where the file's
+// last page hasn't that much room past its end a zeroed reservation is mapped and the file mapped
+// over its front, and if that can't be done (or the file can't be mapped) it's read into memory
+// from the allocator.
+
+#ifndef JSON_FILE_PADDING
+#define JSON_FILE_PADDING 64
+#endif
+
+typedef enum
+{
+    JSON_FILE_SEQUENTIAL    = 1 << 0, // Read front to back, as parsing does, so the OS reads ahead
+    JSON_FILE_COPY_ON_WRITE = 1 << 1, // Writable, with pages written to copied rather than written back
+} json_file_flags;
+
+typedef struct
+{
+    const char *src;       // NULL if the file couldn't be opened or read
+    u64         size;
+    void       *base;      // What's unmapped or freed
+    u64         base_size; // Bytes mapped from base
+    u8          is_mapped;
+} json_file;
+
+// Zero padded buffer of size bytes for a file which is read rather than mapped
+json_file alloc_json_file_buffer(u64 size, json_allocator *allocator)
+{
+    json_file file = {0};
+    file.base      = json_alloc(allocator, size + JSON_FILE_PADDING);
+    file.base_size = size + JSON_FILE_PADDING;
+    file.size      = size;
+    if(file.base) memset((char*)file.base + size, 0, JSON_FILE_PADDING);
+    return file;
+}
+
+#if defined(JSON_MMAP_POSIX)
+void *map_json_file_padded(int fd, u64 size, int protection, void *address, u64 *mapped_size)
+{
+    u64 page_size = (u64)sysconf(_SC_PAGESIZE);
+    u64 tail_room = (page_size - size % page_size) % page_size; // Zeroed by the OS past the file's end
+    if(size > 0 && tail_room >= JSON_FILE_PADDING)
+    {
+        void *base = mmap(address, size, protection, MAP_PRIVATE, fd, 0);
+        *mapped_size = size;
+        return (base == MAP_FAILED) ? NULL : base;
+    }
+    if(size == 0) return NULL;
+
+#if defined(MAP_ANONYMOUS)
+    void *base = mmap(address, size + JSON_FILE_PADDING, protection, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#else
+    // MAP_ANONYMOUS is hidden in strict ISO C modes, private maps of /dev/zero are the same
+    int   zero_fd = open("/dev/zero", O_RDONLY);
+    void *base    = (zero_fd < 0) ? MAP_FAILED : mmap(address, size + JSON_FILE_PADDING, protection, MAP_PRIVATE, zero_fd, 0);
+    if(zero_fd >= 0) close(zero_fd);
+#endif
+    if(base == MAP_FAILED) return NULL;
+    if(mmap(base, size, protection, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(base, size + JSON_FILE_PADDING);
+        return NULL;
+    }
+    *mapped_size = size + JSON_FILE_PADDING;
+    return base;
+}
+#endif
+
+// Maps the file at address if it's free, which is only a hint, anywhere otherwise
+json_file map_json_file_at(const char *path, void *address, u32 file_flags, json_allocator *allocator)
+{
+    json_file file = {0};
+#if defined(JSON_MMAP_POSIX)
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return file;
+
+    struct stat info;
+    if(fstat(fd, &info) == 0)
+    {
+        u64   size        = (u64)info.st_size;
+        u64   mapped_size = 0;
+        int   protection  = (file_flags & JSON_FILE_COPY_ON_WRITE) ? PROT_READ | PROT_WRITE : PROT_READ;
+        void *base        = map_json_file_padded(fd, size, protection, address, &mapped_size);
+        if(base)
         {
-            if(src[1] == 'u' && src[2] == 'l' && src[3] == 'l')
-            {
-                token.type = TOKEN_NULL;
-                token.length = 4;
-            }
-            break;
+#if defined(MADV_SEQUENTIAL)
+            if(file_flags & JSON_FILE_SEQUENTIAL) madvise(base, size, MADV_SEQUENTIAL);
+#endif
+            file = (json_file){.src = (const char*)base, .size = size, .base = base, .base_size = mapped_size, .is_mapped = 1};
         }
-        case 't':
+        else
         {
-            if(src[1] == 'r' && src[2] == 'u' && src[3] == 'e')
+            file = alloc_json_file_buffer(size, allocator);
+            u64 num_read = 0;
+            while(file.base && num_read < size)
             {
-                token.type          = TOKEN_BOOL;
-                token.length        = 4;
-                token.boolean_value = 1;
+                ssize_t n = read(fd, (char*)file.base + num_read, (size - num_read < 0x40000000) ? size - num_read : 0x40000000);
+                if(n <= 0) break;
+                num_read += (u64)n;
             }
-            break;
+            if(file.base && num_read == size) file.src = (const char*)file.base;
         }
-        case 'f':
+    }
+    close(fd);
+#elif defined(JSON_MMAP_WIN32)
+    DWORD  scan   = (file_flags & JSON_FILE_SEQUENTIAL) ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL;
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, scan, NULL);
+    if(handle == INVALID_HANDLE_VALUE) return file;
+
+    LARGE_INTEGER info;
+    if(GetFileSizeEx(handle, &info))
+    {
+        // Views are whole pages and zeroed past the file's end, there's no reserving a padded one
+        u64 size = (u64)info.QuadPart;
+        SYSTEM_INFO system;
+        GetSystemInfo(&system);
+        u64 tail_room = (system.dwPageSize - size % system.dwPageSize) % system.dwPageSize;
+        if(size > 0 && tail_room >= JSON_FILE_PADDING)
         {
-            if(src[1] == 'a' && src[2] == 'l' && src[3] == 's' && src[4] == 'e')
-            {
-                token.type          = TOKEN_BOOL;
-                token.length        = 5;
-                token.boolean_value = 0;
-            }
-            break;
+            u8     copy_on_write = (file_flags & JSON_FILE_COPY_ON_WRITE) != 0;
+            HANDLE mapping = CreateFileMappingA(handle, NULL, copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+            DWORD  access  = copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ;
+            void  *base    = mapping ? MapViewOfFileEx(mapping, access, 0, 0, 0, address) : NULL;
+            if(mapping && !base && address) base = MapViewOfFile(mapping, access, 0, 0, 0);
+            if(mapping) CloseHandle(mapping);
+            if(base) file = (json_file){.src = (const char*)base, .size = size, .base = base, .base_size = size, .is_mapped = 1};
         }
-        case '-':
-        default:
+        if(!file.is_mapped)
         {
-            // Numbers always start with minus or digit
-            if(is_digit(*src) || *src == '-')
-            {
-                token.type = TOKEN_NUMBER;
-                const char *c = src + 1;
-                for(; c < src_end && is_number_char(*c); c += 1);
-                token.length = c - src;
-                token.numeric_value = atof(src);
-            }
-            else if(!is_symbol_with_meaning(*src))
+            file = alloc_json_file_buffer(size, allocator);
+            u64 num_read = 0;
+            while(file.base && num_read < size)
             {
-                token.type = TOKEN_WORD;
-                const char *c = src + 1;
-                for(; c < src_end && !is_symbol_with_meaning(*c); c += 1);
-                token.length = c - src;
+                DWORD n = 0;
+                if(!ReadFile(handle, (char*)file.base + num_read, (DWORD)((size - num_read < 0x40000000) ? size - num_read : 0x40000000), &n, NULL) || n == 0) break;
+                num_read += n;
             }
+            if(file.base && num_read == size) file.src = (const char*)file.base;
         }
     }
+    CloseHandle(handle);
+#else
+    FILE *stream = fopen(path, "rb");
+    if(!stream) return file;
+
+    // Read in pieces, since ftell can't tell sizes over 2 GB everywhere
+    u64 cap  = 1 << 16;
+    file     = alloc_json_file_buffer(cap, allocator);
+    u64 size = 0;
+    while(file.base)
+    {
+        size += fread((char*)file.base + size, 1, cap - size, stream);
+        if(size < cap) break;
+        cap *= 2;
+        void *base = json_resize(allocator, file.base, cap + JSON_FILE_PADDING);
+        if(!base) json_dealloc(allocator, file.base);
+        file.base = base;
+    }
+    if(file.base && !ferror(stream))
+    {
+        memset((char*)file.base + size, 0, JSON_FILE_PADDING);
+        file.src       = (const char*)file.base;
+        file.size      = size;
+        file.base_size = cap + JSON_FILE_PADDING;
+    }
+    fclose(stream);
+#endif
+    if(!file.src && file.base)
+    {
+        json_dealloc(allocator, file.base);
+        file = (json_file){0};
+    }
+    return file;
+}
 
-    return token;
+json_file map_json_file(const char *path, u32 file_flags, json_allocator *allocator)
+{
+    return map_json_file_at(path, NULL, file_flags, allocator);
 }
 
-json_tokenised tokenise_json(const char *src, u32 src_size)
+void unmap_json_file(json_file *file, json_allocator *allocator)
 {
-    //Initially the returned token array is alloc'd at 128 tokens
-    u32 token_cap      = 128;
-    u32 num_tokens     = 0;
-    json_token *tokens = (json_token*)alloc(token_cap * sizeof(json_token));
-    
-    json_token *last_read = NULL;
-    const char *src_current = src;
-    const char *src_end     = src + src_size;
-    do
+    if(file->is_mapped)
+    {
+#if defined(JSON_MMAP_POSIX)
+        munmap(file->base, file->base_size);
+#elif defined(JSON_MMAP_WIN32)
+        UnmapViewOfFile(file->base);
+#endif
+    }
+    else if(file->base) json_dealloc(allocator, file->base);
+    *file = (json_file){0};
+}
+
+// ============================== Structural index ===================================
+
+// Stage one of tokenising. The source is classified 64 bytes at a time into bitmasks, from which
+// the start of every token is found without looking at bytes one by one. Strings are tracked
+// with a prefix xor over the quote mask, so nothing inside a string is ever indexed.
+// Indexed positions are: ,:[]{} outside of strings, every quote mark (opening and closing) and
+// the first character of every run of other non-whitespace characters (numbers, null, words...).
+
+#define JSON_BLOCK_SIZE 64
+
+typedef struct
+{
+    u64 quote;
+    u64 backslash;
+    u64 op;
+    u64 whitespace;
+} json_block_masks;
+
+#if defined(JSON_SIMD_AVX2)
+
+u64 json_avx2_mask(__m256i m0, __m256i m1)
+{
+    u64 lo = (u32)_mm256_movemask_epi8(m0);
+    u64 hi = (u32)_mm256_movemask_epi8(m1);
+    return lo | (hi << 32);
+}
+
+json_block_masks classify_json_block(const char *block)
+{
+    __m256i v0 = _mm256_loadu_si256((const __m256i*)block);
+    __m256i v1 = _mm256_loadu_si256((const __m256i*)(block + 32));
+
+    // Setting 0x20 maps [ and ] onto { and }, and leaves , and : unchanged
+    __m256i case_bit = _mm256_set1_epi8(0x20);
+    __m256i f0 = _mm256_or_si256(v0, case_bit);
+    __m256i f1 = _mm256_or_si256(v1, case_bit);
+
+    __m256i quote  = _mm256_set1_epi8('"'),  backslash = _mm256_set1_epi8('\\');
+    __m256i obrace = _mm256_set1_epi8('{'), cbrace = _mm256_set1_epi8('}');
+    __m256i comma  = _mm256_set1_epi8(','), colon  = _mm256_set1_epi8(':');
+    __m256i space  = _mm256_set1_epi8(' '), tab    = _mm256_set1_epi8('\t');
+    __m256i lf     = _mm256_set1_epi8('\n'), cr    = _mm256_set1_epi8('\r');
+
+    __m256i op0 = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(f0, obrace), _mm256_cmpeq_epi8(f0, cbrace)),
+                                  _mm256_or_si256(_mm256_cmpeq_epi8(v0, comma),  _mm256_cmpeq_epi8(v0, colon)));
+    __m256i op1 = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(f1, obrace), _mm256_cmpeq_epi8(f1, cbrace)),
+                                  _mm256_or_si256(_mm256_cmpeq_epi8(v1, comma),  _mm256_cmpeq_epi8(v1, colon)));
+    __m256i ws0 = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v0, space), _mm256_cmpeq_epi8(v0, tab)),
+                                  _mm256_or_si256(_mm256_cmpeq_epi8(v0, lf),    _mm256_cmpeq_epi8(v0, cr)));
+    __m256i ws1 = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v1, space), _mm256_cmpeq_epi8(v1, tab)),
+                                  _mm256_or_si256(_mm256_cmpeq_epi8(v1, lf),    _mm256_cmpeq_epi8(v1, cr)));
+
+    json_block_masks masks;
+    masks.quote      = json_avx2_mask(_mm256_cmpeq_epi8(v0, quote), _mm256_cmpeq_epi8(v1, quote));
+    masks.backslash  = json_avx2_mask(_mm256_cmpeq_epi8(v0, backslash), _mm256_cmpeq_epi8(v1, backslash));
+    masks.op         = json_avx2_mask(op0, op1);
+    masks.whitespace = json_avx2_mask(ws0, ws1);
+    return masks;
+}
+
+#elif defined(JSON_SIMD_SSE)
+
+u64 json_sse_mask(__m128i m0, __m128i m1, __m128i m2, __m128i m3)
+{
+    u64 m = (u64)(u32)_mm_movemask_epi8(m0);
+    m    |= (u64)(u32)_mm_movemask_epi8(m1) << 16;
+    m    |= (u64)(u32)_mm_movemask_epi8(m2) << 32;
+    m    |= (u64)(u32)_mm_movemask_epi8(m3) << 48;
+    return m;
+}
+
+void classify_json_block_16(__m128i v, __m128i *quote_out, __m128i *backslash_out, __m128i *op_out, __m128i *ws_out)
+{
+    // Setting 0x20 maps [ and ] onto { and }, and leaves , and : unchanged
+    __m128i f = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    *quote_out     = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+    *backslash_out = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+    *op_out    = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(f, _mm_set1_epi8('{')), _mm_cmpeq_epi8(f, _mm_set1_epi8('}'))),
+                              _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(',')), _mm_cmpeq_epi8(v, _mm_set1_epi8(':'))));
+    *ws_out    = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),  _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                              _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+}
+
+json_block_masks classify_json_block(const char *block)
+{
+    __m128i q[4], b[4], o[4], w[4];
+    for(u32 i = 0; i < 4; i += 1)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(block + 16*i));
+        classify_json_block_16(v, &q[i], &b[i], &o[i], &w[i]);
+    }
+
+    json_block_masks masks;
+    masks.quote      = json_sse_mask(q[0], q[1], q[2], q[3]);
+    masks.backslash  = json_sse_mask(b[0], b[1], b[2], b[3]);
+    masks.op         = json_sse_mask(o[0], o[1], o[2], o[3]);
+    masks.whitespace = json_sse_mask(w[0], w[1], w[2], w[3]);
+    return masks;
+}
+
+#else
+
+json_block_masks classify_json_block(const char *block)
+{
+    json_block_masks masks = {0};
+    for(u32 i = 0; i < JSON_BLOCK_SIZE; i += 1)
+    {
+        unsigned char c = block[i];
+        u64 bit = (u64)1 << i;
+        if(c == '"')                                                 masks.quote      |= bit;
+        if(c == '\\')                                                masks.backslash  |= bit;
+        if(c == ',' || c == ':' || (c | 0x20) == '{' || (c | 0x20) == '}') masks.op   |= bit;
+        if(is_whitespace(c))                                         masks.whitespace |= bit;
+    }
+    return masks;
+}
+
+#endif
+
+// State carried from one block to the next
+typedef struct
+{
+    u64 prev_in_string;     // All ones if the previous block ended inside a string
+    u64 prev_scalar;        // 1 if the previous block ended inside a run of scalar characters
+    u64 prev_odd_backslash; // 1 if the previous block ended in an odd length run of backslashes
+} json_scanner;
+
+#define JSON_EVEN_BITS 0x5555555555555555ull
+#define JSON_ODD_BITS  0xAAAAAAAAAAAAAAAAull
+
+// Mask of chars escaped by the odd length runs of backslashes before them. A run's length is
+// odd when its start and the char after it are on bits of different parity, which falls out of
+// adding the run's start bit to the run (the carry lands just past the end).
+u64 find_json_escaped_chars(json_scanner *scanner, u64 backslash)
+{
+    u64 start_edges     = backslash & ~(backslash << 1);
+    u64 even_start_mask = JSON_EVEN_BITS ^ scanner->prev_odd_backslash;
+    u64 even_starts     = start_edges & even_start_mask;
+    u64 odd_starts      = start_edges & ~even_start_mask;
+    u64 even_carries    = backslash + even_starts;
+
+    u64 odd_carries     = backslash + odd_starts;
+    u8  ends_odd        = odd_carries < backslash; // Run carried out of the block
+    odd_carries        |= scanner->prev_odd_backslash;
+    scanner->prev_odd_backslash = ends_odd;
+
+    u64 even_carry_ends = even_carries & ~backslash;
+    u64 odd_carry_ends  = odd_carries & ~backslash;
+    return (even_carry_ends & JSON_ODD_BITS) | (odd_carry_ends & JSON_EVEN_BITS);
+}
+
+// Returns the mask of token start positions in a 64 byte block
+u64 scan_json_block(json_scanner *scanner, const char *block)
+{
+    json_block_masks masks = classify_json_block(block);
+
+    // Escaped quotes don't open or close strings
+    masks.quote &= ~find_json_escaped_chars(scanner, masks.backslash);
+
+    // Bit set from an opening quote up to (not including) its closing quote
+    u64 in_string = json_prefix_xor(masks.quote) ^ scanner->prev_in_string;
+    scanner->prev_in_string = (u64)((s64)in_string >> 63);
+
+    u64 scalar       = ~(masks.op | masks.whitespace | masks.quote) & ~in_string;
+    u64 scalar_start = scalar & ~((scalar << 1) | scanner->prev_scalar);
+    scanner->prev_scalar = scalar >> 63;
+
+    return (masks.op & ~in_string) | masks.quote | scalar_start;
+}
+
+u32 flatten_json_block_bits(u64 bits, json_size block_offset, json_size *dst)
+{
+    u32 count = 0;
+    while(bits)
+    {
+        dst[count] = block_offset + json_ctz64(bits);
+        bits      &= bits - 1;
+        count     += 1;
+    }
+    return count;
+}
+
+// UTF-8 is checked block by block as the index is built. The vector checkers look up the high and
+// low nibbles of each byte and the one before it in tables of the errors they could be part of
+// (after Keiser and Lemire), which leaves only multi-byte lengths to check. An error is located
+// afterwards by a scalar pass starting from the block it was found in.
+
+#define JSON_UTF8_TOO_SHORT      (1 << 0) // Lead byte followed by a lead byte or ASCII
+#define JSON_UTF8_TOO_LONG       (1 << 1) // ASCII followed by a continuation
+#define JSON_UTF8_OVERLONG_3     (1 << 2) // E0 followed by 80..9F
+#define JSON_UTF8_TOO_LARGE      (1 << 3) // F4 followed by 90..BF, or F5..FF
+#define JSON_UTF8_SURROGATE      (1 << 4) // ED followed by A0..BF
+#define JSON_UTF8_OVERLONG_2     (1 << 5) // C0 or C1
+#define JSON_UTF8_TOO_LARGE_1000 (1 << 6) // F5..FF followed by 80..8F
+#define JSON_UTF8_OVERLONG_4     (1 << 6) // F0 followed by 80..8F
+#define JSON_UTF8_TWO_CONTS      (1 << 7) // Continuation followed by a continuation
+#define JSON_UTF8_CARRY          (JSON_UTF8_TOO_SHORT | JSON_UTF8_TOO_LONG | JSON_UTF8_TWO_CONTS)
+
+// Tables indexed by the previous byte's high nibble, its low nibble and the byte's high nibble
+#define JSON_UTF8_BYTE_1_HIGH \
+    JSON_UTF8_TOO_LONG, JSON_UTF8_TOO_LONG, JSON_UTF8_TOO_LONG, JSON_UTF8_TOO_LONG, \
+    JSON_UTF8_TOO_LONG, JSON_UTF8_TOO_LONG, JSON_UTF8_TOO_LONG, JSON_UTF8_TOO_LONG, \
+    JSON_UTF8_TWO_CONTS, JSON_UTF8_TWO_CONTS, JSON_UTF8_TWO_CONTS, JSON_UTF8_TWO_CONTS, \
+    JSON_UTF8_TOO_SHORT | JSON_UTF8_OVERLONG_2, \
+    JSON_UTF8_TOO_SHORT, \
+    JSON_UTF8_TOO_SHORT | JSON_UTF8_OVERLONG_3 | JSON_UTF8_SURROGATE, \
+    JSON_UTF8_TOO_SHORT | JSON_UTF8_TOO_LARGE | JSON_UTF8_TOO_LARGE_1000 | JSON_UTF8_OVERLONG_4
+
+#define JSON_UTF8_BYTE_1_LOW \
+    JSON_UTF8_CARRY | JSON_UTF8_OVERLONG_3 | JSON_UTF8_OVERLONG_2 | JSON_UTF8_OVERLONG_4, \
+    JSON_UTF8_CARRY | JSON_UTF8_OVERLONG_2, \
+    JSON_UTF8_CARRY, \
+    JSON_UTF8_CARRY, \
+    JSON_UTF8_CARRY | JSON_UTF8_TOO_LARGE, \
+    JSON_UTF8_CARRY | JSON_UTF8_TOO_LARGE | JSON_UTF8_TOO_LARGE_1000, \
+    JSON_UTF8_CARRY | JSON_UTF8_TOO_LARGE | JSON_UTF8_TOO_LARGE_1000, \
+    JSON_UTF8_CARRY | JSON_UTF8_TOO_LARGE | JSON_UTF8_TOO_LARGE_1000, \
+    JSON_UTF8_CARRY | JSON_UTF8_TOO_LARGE | JSON_UTF8_TOO_LARGE_1000, \
+    JSON_UTF8_CARRY | JSON_UTF8_TOO_LARGE | JSON_UTF8_TOO_LARGE_1000, \
+    JSON_UTF8_CARRY | JSON_UTF8_TOO_LARGE | JSON_UTF8_TOO_LARGE_1000, \
+    JSON_UTF8_CARRY | JSON_UTF8_TOO_LARGE | JSON_UTF8_TOO_LARGE_1000, \
+    JSON_UTF8_CARRY | JSON_UTF8_TOO_LARGE | JSON_UTF8_TOO_LARGE_1000, \
+    JSON_UTF8_CARRY | JSON_UTF8_TOO_LARGE | JSON_UTF8_TOO_LARGE_1000 | JSON_UTF8_SURROGATE, \
+    JSON_UTF8_CARRY | JSON_UTF8_TOO_LARGE | JSON_UTF8_TOO_LARGE_1000, \
+    JSON_UTF8_CARRY | JSON_UTF8_TOO_LARGE | JSON_UTF8_TOO_LARGE_1000
+
+#define JSON_UTF8_BYTE_2_HIGH \
+    JSON_UTF8_TOO_SHORT, JSON_UTF8_TOO_SHORT, JSON_UTF8_TOO_SHORT, JSON_UTF8_TOO_SHORT, \
+    JSON_UTF8_TOO_SHORT, JSON_UTF8_TOO_SHORT, JSON_UTF8_TOO_SHORT, JSON_UTF8_TOO_SHORT, \
+    JSON_UTF8_TOO_LONG | JSON_UTF8_OVERLONG_2 | JSON_UTF8_TWO_CONTS | JSON_UTF8_OVERLONG_3 | JSON_UTF8_TOO_LARGE_1000 | JSON_UTF8_OVERLONG_4, \
+    JSON_UTF8_TOO_LONG | JSON_UTF8_OVERLONG_2 | JSON_UTF8_TWO_CONTS | JSON_UTF8_OVERLONG_3 | JSON_UTF8_TOO_LARGE, \
+    JSON_UTF8_TOO_LONG | JSON_UTF8_OVERLONG_2 | JSON_UTF8_TWO_CONTS | JSON_UTF8_SURROGATE  | JSON_UTF8_TOO_LARGE, \
+    JSON_UTF8_TOO_LONG | JSON_UTF8_OVERLONG_2 | JSON_UTF8_TWO_CONTS | JSON_UTF8_SURROGATE  | JSON_UTF8_TOO_LARGE, \
+    JSON_UTF8_TOO_SHORT, JSON_UTF8_TOO_SHORT, JSON_UTF8_TOO_SHORT, JSON_UTF8_TOO_SHORT
+
+// Lead bytes in the last 3 bytes of a vector which need bytes from the next one
+#define JSON_UTF8_MAX_COMPLETE_TAIL 0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+
+#if defined(JSON_SIMD_AVX2)
+
+typedef struct
+{
+    __m256i prev_input;
+    __m256i prev_incomplete;
+} json_utf8_vector_state;
+
+__m256i check_json_utf8_bytes(__m256i input, __m256i prev_input)
+{
+    __m256i byte_1_high_table = _mm256_broadcastsi128_si256(_mm_setr_epi8(JSON_UTF8_BYTE_1_HIGH));
+    __m256i byte_1_low_table  = _mm256_broadcastsi128_si256(_mm_setr_epi8(JSON_UTF8_BYTE_1_LOW));
+    __m256i byte_2_high_table = _mm256_broadcastsi128_si256(_mm_setr_epi8(JSON_UTF8_BYTE_2_HIGH));
+    __m256i low_nibble        = _mm256_set1_epi8(0x0F);
+
+    // Bytes 1, 2 and 3 places back, reaching into the previous vector
+    __m256i carried = _mm256_permute2x128_si256(prev_input, input, 0x21);
+    __m256i prev1   = _mm256_alignr_epi8(input, carried, 15);
+    __m256i prev2   = _mm256_alignr_epi8(input, carried, 14);
+    __m256i prev3   = _mm256_alignr_epi8(input, carried, 13);
+
+    __m256i byte_1_high = _mm256_shuffle_epi8(byte_1_high_table, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble));
+    __m256i byte_1_low  = _mm256_shuffle_epi8(byte_1_low_table,  _mm256_and_si256(prev1, low_nibble));
+    __m256i byte_2_high = _mm256_shuffle_epi8(byte_2_high_table, _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibble));
+    __m256i special     = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+    // Third and fourth bytes of sequences have to be continuations, which show up as TWO_CONTS
+    __m256i is_third_byte  = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 1)));
+    __m256i is_fourth_byte = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 1)));
+    __m256i must_continue  = _mm256_cmpgt_epi8(_mm256_or_si256(is_third_byte, is_fourth_byte), _mm256_setzero_si256());
+    return _mm256_xor_si256(_mm256_and_si256(must_continue, _mm256_set1_epi8((char)0x80)), special);
+}
+
+// Returns 1 if the block has an error in it
+u8 check_json_utf8_vectors(json_utf8_vector_state *state, const char *block)
+{
+    __m256i v0 = _mm256_loadu_si256((const __m256i*)block);
+    __m256i v1 = _mm256_loadu_si256((const __m256i*)(block + 32));
+    if(_mm256_movemask_epi8(_mm256_or_si256(v0, v1)) == 0)
+    {
+        // All ASCII, which is only wrong if the last block left a sequence unfinished
+        return !_mm256_testz_si256(state->prev_incomplete, state->prev_incomplete);
+    }
+
+    __m256i error = _mm256_or_si256(check_json_utf8_bytes(v0, state->prev_input), check_json_utf8_bytes(v1, v0));
+    __m256i max_complete = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                            JSON_UTF8_MAX_COMPLETE_TAIL);
+    state->prev_incomplete = _mm256_subs_epu8(v1, max_complete);
+    state->prev_input      = v1;
+    return !_mm256_testz_si256(error, error);
+}
+
+u8 json_utf8_vectors_incomplete(json_utf8_vector_state *state)
+{
+    return !_mm256_testz_si256(state->prev_incomplete, state->prev_incomplete);
+}
+
+#elif defined(JSON_SIMD_SSSE3)
+
+typedef struct
+{
+    __m128i prev_input;
+    __m128i prev_incomplete;
+} json_utf8_vector_state;
+
+__m128i check_json_utf8_bytes(__m128i input, __m128i prev_input)
+{
+    __m128i byte_1_high_table = _mm_setr_epi8(JSON_UTF8_BYTE_1_HIGH);
+    __m128i byte_1_low_table  = _mm_setr_epi8(JSON_UTF8_BYTE_1_LOW);
+    __m128i byte_2_high_table = _mm_setr_epi8(JSON_UTF8_BYTE_2_HIGH);
+    __m128i low_nibble        = _mm_set1_epi8(0x0F);
+
+    // Bytes 1, 2 and 3 places back, reaching into the previous vector
+    __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+    __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+    __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+
+    __m128i byte_1_high = _mm_shuffle_epi8(byte_1_high_table, _mm_and_si128(_mm_srli_epi16(prev1, 4), low_nibble));
+    __m128i byte_1_low  = _mm_shuffle_epi8(byte_1_low_table,  _mm_and_si128(prev1, low_nibble));
+    __m128i byte_2_high = _mm_shuffle_epi8(byte_2_high_table, _mm_and_si128(_mm_srli_epi16(input, 4), low_nibble));
+    __m128i special     = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+    // Third and fourth bytes of sequences have to be continuations, which show up as TWO_CONTS
+    __m128i is_third_byte  = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 1)));
+    __m128i is_fourth_byte = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 1)));
+    __m128i must_continue  = _mm_cmpgt_epi8(_mm_or_si128(is_third_byte, is_fourth_byte), _mm_setzero_si128());
+    return _mm_xor_si128(_mm_and_si128(must_continue, _mm_set1_epi8((char)0x80)), special);
+}
+
+// Returns 1 if the block has an error in it
+u8 check_json_utf8_vectors(json_utf8_vector_state *state, const char *block)
+{
+    __m128i v[4];
+    for(u32 i = 0; i < 4; i += 1) v[i] = _mm_loadu_si128((const __m128i*)(block + 16*i));
+    __m128i any = _mm_or_si128(_mm_or_si128(v[0], v[1]), _mm_or_si128(v[2], v[3]));
+    if(_mm_movemask_epi8(any) == 0)
+    {
+        // All ASCII, which is only wrong if the last block left a sequence unfinished
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(state->prev_incomplete, _mm_setzero_si128())) != 0xFFFF;
+    }
+
+    __m128i error = check_json_utf8_bytes(v[0], state->prev_input);
+    for(u32 i = 1; i < 4; i += 1) error = _mm_or_si128(error, check_json_utf8_bytes(v[i], v[i-1]));
+    __m128i max_complete = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, JSON_UTF8_MAX_COMPLETE_TAIL);
+    state->prev_incomplete = _mm_subs_epu8(v[3], max_complete);
+    state->prev_input      = v[3];
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF;
+}
+
+u8 json_utf8_vectors_incomplete(json_utf8_vector_state *state)
+{
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(state->prev_incomplete, _mm_setzero_si128())) != 0xFFFF;
+}
+
+#else
+
+// Without byte shuffles only ASCII blocks are skipped, the scalar pass checks the rest
+typedef struct
+{
+    u8 unused;
+} json_utf8_vector_state;
+
+u8 check_json_utf8_vectors(json_utf8_vector_state *state, const char *block)
+{
+    (void)state;
+    u64 any = 0;
+    for(u32 i = 0; i < JSON_BLOCK_SIZE; i += 8)
+    {
+        u64 word;
+        memcpy(&word, block + i, 8);
+        any |= word;
+    }
+    return (any & 0x8080808080808080ull) != 0;
+}
+
+u8 json_utf8_vectors_incomplete(json_utf8_vector_state *state)
+{
+    (void)state;
+    return 0;
+}
+
+#endif
+
+typedef struct
+{
+    json_utf8_vector_state vectors;
+    u8        suspect;     // Set once a block fails the vector check
+    json_size suspect_loc; // Offset of that block
+} json_utf8_checker;
+
+void check_json_utf8_block(json_utf8_checker *checker, const char *block, json_size block_offset)
+{
+    if(checker->suspect) return;
+    if(check_json_utf8_vectors(&checker->vectors, block))
+    {
+        checker->suspect     = 1;
+        checker->suspect_loc = block_offset;
+    }
+}
+
+// Returns the offset of the first invalid UTF-8 sequence at or after start, or src_size if there isn't one
+json_size find_invalid_json_utf8(const char *src, json_size start, json_size src_size)
+{
+    const unsigned char *s = (const unsigned char*)src;
+    json_size i = start;
+    while(i < src_size)
     {
-        if(num_tokens >= token_cap)
+        unsigned char c = s[i];
+        if(c < 0x80)
         {
-            token_cap *= 2;
-            tokens = (json_token*)resize_alloc(tokens, token_cap * sizeof(json_token));
+            i += 1;
+            continue;
         }
-        last_read    = &tokens[num_tokens];
-        *last_read   = read_json_token(src_current, src, src_end);
-        src_current  = last_read->loc + last_read->length;
-        num_tokens  += 1;
+
+        u32 length;
+        unsigned char min_second = 0x80;
+        unsigned char max_second = 0xBF;
+        if(c >= 0xC2 && c <= 0xDF)      length = 2;
+        else if(c == 0xE0)              {length = 3; min_second = 0xA0;} // Overlong
+        else if(c == 0xED)              {length = 3; max_second = 0x9F;} // Surrogates
+        else if(c >= 0xE1 && c <= 0xEF) length = 3;
+        else if(c == 0xF0)              {length = 4; min_second = 0x90;} // Overlong
+        else if(c >= 0xF1 && c <= 0xF3) length = 4;
+        else if(c == 0xF4)              {length = 4; max_second = 0x8F;} // Past U+10FFFF
+        else                            return i;
+
+        if(src_size - i < length)                         return i;
+        if(s[i+1] < min_second || s[i+1] > max_second)    return i;
+        for(u32 j = 2; j < length; j += 1)
+        {
+            if((s[i+j] & 0xC0) != 0x80)                   return i;
+        }
+        i += length;
     }
-    while(last_read->type != TOKEN_END && last_read->type != TOKEN_NONE);
+    return src_size;
+}
 
-    json_tokenised tokenised_json =
+// Returns the offset of the first invalid UTF-8 sequence in src, or src_size if there isn't one
+json_size locate_invalid_json_utf8(json_utf8_checker *checker, const char *src, json_size src_size)
+{
+    if(!checker->suspect && !json_utf8_vectors_incomplete(&checker->vectors)) return src_size;
+
+    // Whole src was seen, so an unfinished sequence at the end is in the last block
+    json_size start = checker->suspect ? checker->suspect_loc : (src_size - 1) & ~(json_size)(JSON_BLOCK_SIZE - 1);
+
+    // The error may be in a sequence started in the last 3 bytes of the block before. Sequences
+    // are resynced on the first byte there which isn't a continuation.
+    json_size block_start = start;
+    start = (start > 3) ? start - 3 : 0;
+    while(start < block_start && (src[start] & 0xC0) == 0x80) start += 1;
+    return find_invalid_json_utf8(src, start, src_size);
+}
+
+typedef struct
+{
+    json_size  num_positions;
+    json_size *positions;
+    json_size  utf8_error_offset; // Offset of the first invalid UTF-8 sequence, src_size if there isn't one
+} json_structural_index;
+
+// Block at block_offset, copied into padded with whitespace after end if it's a partial last block
+// so it's never read past
+const char *get_json_block(const char *src, json_size block_offset, json_size end, char *padded)
+{
+    if(block_offset + JSON_BLOCK_SIZE <= end) return src + block_offset;
+    memset(padded, ' ', JSON_BLOCK_SIZE);
+    memcpy(padded, src + block_offset, end - block_offset);
+    return padded;
+}
+
+// Indexes the blocks from start (block aligned) to end, returning the number of positions written.
+// checker is NULL if UTF-8 isn't checked.
+json_size index_json_blocks(json_scanner *scanner, json_utf8_checker *checker, const char *src, json_size start, json_size end, json_size *positions)
+{
+    json_size num_positions = 0;
+    char padded[JSON_BLOCK_SIZE];
+    for(json_size block_offset = start; block_offset < end; block_offset += JSON_BLOCK_SIZE)
     {
-        .num_tokens  = num_tokens,
-        .token_index = 0,
-        .tokens      = tokens,
-        .src         = src,
-        .src_size    = src_size
-    };
-    return tokenised_json;
+        const char *block = get_json_block(src, block_offset, end, padded);
+        u64 bits = scan_json_block(scanner, block);
+        num_positions += flatten_json_block_bits(bits, block_offset, positions + num_positions);
+        if(checker) check_json_utf8_block(checker, block, block_offset);
+    }
+    return num_positions;
 }
 
-void reset_tokenised_json(json_tokenised *tokenised_json)
+// index->positions has to have room for src_size + 1 positions, worst case every byte starts a token
+void fill_json_structural_index(json_structural_index *index, const char *src, json_size src_size, u8 check_utf8)
 {
-    tokenised_json->token_index = 0;
+    json_scanner      scanner = {0};
+    json_utf8_checker checker = {0};
+    index->num_positions     = index_json_blocks(&scanner, check_utf8 ? &checker : NULL, src, 0, src_size, index->positions);
+    index->utf8_error_offset = check_utf8 ? locate_invalid_json_utf8(&checker, src, src_size) : src_size;
+}
+
+// The index of a large src can be built on several threads, each taking a chunk of blocks. A chunk's
+// scan depends on the one before only through the scanner state at its start, which is worked out
+// without scanning the whole of the chunks before:
+//  - Whether it starts in a string is the parity of the unescaped quotes before it. Escapes don't
+//    depend on strings, so each chunk's quote parity is counted in parallel and prefix xor'd.
+//  - Whether it starts after an odd run of backslashes or a scalar char are read from the bytes
+//    just before it.
+// Each chunk writes its positions at its own offset into positions (there's at most one per byte)
+// and they're moved down together afterwards.
+
+#ifndef JSON_PARALLEL_MIN_CHUNK_SIZE
+#define JSON_PARALLEL_MIN_CHUNK_SIZE (1 << 20) // Smaller chunks aren't worth a thread
+#endif
+
+typedef struct
+{
+    const char       *src;
+    json_size         start; // Block aligned
+    json_size         end;
+    u8                check_utf8;
+    u64               quote_parity;
+    json_scanner      scanner;
+    json_size        *positions;
+    json_size         num_positions;
+    u8                utf8_suspect; // The checker's kept on the thread's stack, vectors need aligning
+    u8                utf8_incomplete;
+    json_size         utf8_suspect_loc;
+} json_index_chunk;
+
+u32 count_json_backslashes_before(const char *src, json_size offset)
+{
+    u32 count = 0;
+    for(; offset > 0 && src[offset-1] == '\\'; offset -= 1) count += 1;
+    return count;
 }
 
-void tokenise_json_in_parse_state(json_parse_state *parse_state, const char *src, u32 src_size)
+void find_json_chunk_quote_parity(void *chunk_arg)
 {
-    parse_state->token_src = tokenise_json(src, src_size);
-    parse_state->status    = JSON_STATUS_TOKENISED;
+    json_index_chunk *chunk   = (json_index_chunk*)chunk_arg;
+    json_scanner      scanner = chunk->scanner;
+    char padded[JSON_BLOCK_SIZE];
+    u64  parity = 0;
+    for(json_size block_offset = chunk->start; block_offset < chunk->end; block_offset += JSON_BLOCK_SIZE)
+    {
+        json_block_masks masks = classify_json_block(get_json_block(chunk->src, block_offset, chunk->end, padded));
+        u64 quote = masks.quote & ~find_json_escaped_chars(&scanner, masks.backslash);
+        parity   ^= json_prefix_xor(quote) >> 63;
+    }
+    chunk->quote_parity = parity;
+}
+
+void index_json_chunk(void *chunk_arg)
+{
+    json_index_chunk *chunk   = (json_index_chunk*)chunk_arg;
+    json_utf8_checker checker = {0};
+    if(chunk->check_utf8 && chunk->start > 0)
+    {
+        // Prime the checker with the block before, sequences can cross into this chunk
+        check_json_utf8_vectors(&checker.vectors, chunk->src + chunk->start - JSON_BLOCK_SIZE);
+    }
+    chunk->num_positions = index_json_blocks(&chunk->scanner, chunk->check_utf8 ? &checker : NULL, chunk->src, chunk->start, chunk->end, chunk->positions + chunk->start);
+    chunk->utf8_suspect     = checker.suspect;
+    chunk->utf8_suspect_loc = checker.suspect_loc;
+    chunk->utf8_incomplete  = json_utf8_vectors_incomplete(&checker.vectors);
+}
+
+void fill_json_structural_index_parallel(json_structural_index *index, const char *src, json_size src_size, u8 check_utf8, u32 num_threads, json_allocator *allocator)
+{
+    u64 num_blocks = ((u64)src_size + JSON_BLOCK_SIZE - 1) / JSON_BLOCK_SIZE;
+    u64 max_chunks = src_size / JSON_PARALLEL_MIN_CHUNK_SIZE;
+    if(num_threads > max_chunks) num_threads = max_chunks;
+    if(num_threads <= 1)
+    {
+        fill_json_structural_index(index, src, src_size, check_utf8);
+        return;
+    }
+
+    json_index_chunk *chunks = (json_index_chunk*)json_alloc(allocator, num_threads * sizeof(json_index_chunk));
+    for(u32 i = 0; i < num_threads; i += 1)
+    {
+        json_index_chunk *chunk = &chunks[i];
+        *chunk = (json_index_chunk){0};
+        chunk->src        = src;
+        chunk->start      = (json_size)((num_blocks * i / num_threads) * JSON_BLOCK_SIZE);
+        chunk->end        = (i + 1 < num_threads) ? (json_size)((num_blocks * (i+1) / num_threads) * JSON_BLOCK_SIZE) : src_size;
+        chunk->check_utf8 = check_utf8;
+        chunk->positions  = index->positions;
+        chunk->scanner.prev_odd_backslash = count_json_backslashes_before(src, chunk->start) & 1;
+    }
+    run_json_threads(find_json_chunk_quote_parity, chunks, sizeof(json_index_chunk), num_threads, allocator);
+
+    u64 in_string = 0;
+    for(u32 i = 1; i < num_threads; i += 1)
+    {
+        json_index_chunk *chunk = &chunks[i];
+        in_string ^= chunks[i-1].quote_parity;
+        chunk->scanner.prev_in_string = in_string ? ~0ull : 0;
+
+        // Classified as scan_json_block would the last char before the chunk
+        char last    = src[chunk->start - 1];
+        u8 is_op     = last == ',' || last == ':' || (last | 0x20) == '{' || (last | 0x20) == '}';
+        u8 is_quote  = last == '"' && !(count_json_backslashes_before(src, chunk->start - 1) & 1);
+        chunk->scanner.prev_scalar = !in_string && !is_op && !is_quote && !is_whitespace(last);
+    }
+    run_json_threads(index_json_chunk, chunks, sizeof(json_index_chunk), num_threads, allocator);
+
+    index->num_positions = 0;
+    for(u32 i = 0; i < num_threads; i += 1)
+    {
+        memmove(index->positions + index->num_positions, index->positions + chunks[i].start, chunks[i].num_positions * sizeof(json_size));
+        index->num_positions += chunks[i].num_positions;
+    }
+
+    index->utf8_error_offset = src_size;
+    if(check_utf8)
+    {
+        // The first suspect chunk has the first error, an unfinished sequence can only be in the last
+        json_utf8_checker checker = {0};
+        checker.suspect     = chunks[num_threads-1].utf8_incomplete;
+        checker.suspect_loc = (src_size - 1) & ~(json_size)(JSON_BLOCK_SIZE - 1);
+        for(u32 i = 0; i < num_threads; i += 1)
+        {
+            if(chunks[i].utf8_suspect)
+            {
+                checker.suspect     = 1;
+                checker.suspect_loc = chunks[i].utf8_suspect_loc;
+                break;
+            }
+        }
+        if(checker.suspect) index->utf8_error_offset = locate_invalid_json_utf8(&checker, src, src_size);
+    }
+    json_dealloc(allocator, chunks);
+}
+
+json_structural_index build_json_structural_index(const char *src, json_size src_size, u8 check_utf8, json_allocator *allocator)
+{
+    json_structural_index index = {0};
+    index.positions = (json_size*)json_alloc(allocator, ((u64)src_size + 1) * sizeof(json_size));
+    fill_json_structural_index(&index, src, src_size, check_utf8);
+    return index;
+}
+
+json_structural_index build_json_structural_index_parallel(const char *src, json_size src_size, u8 check_utf8, u32 num_threads, json_allocator *allocator)
+{
+    json_structural_index index = {0};
+    index.positions = (json_size*)json_alloc(allocator, ((u64)src_size + 1) * sizeof(json_size));
+    fill_json_structural_index_parallel(&index, src, src_size, check_utf8, num_threads, allocator);
+    return index;
+}
+
+void dealloc_json_structural_index(json_structural_index *index, json_allocator *allocator)
+{
+    json_dealloc(allocator, index->positions);
+    index->positions     = NULL;
+    index->num_positions = 0;
+}
+
+// ============================== Numbers ===================================
+
+// Numbers are read straight from the source, bounded by src_end, without atof. Anything that
+// fits in 19 digits with no fraction or exponent is an exact integer conversion. Otherwise the
+// decimal is w * 10^q: small cases are exact in double arithmetic (Clinger), the rest go
+// through Eisel-Lemire using the 128 bit powers of five table. The few inputs neither can round
+// correctly fall back to strtod on a normalised copy, which has no decimal point so the locale
+// doesn't matter.
+
+typedef struct
+{
+    u64 lo;
+    u64 hi;
+} json_u128;
+
+json_u128 json_mul_64(u64 a, u64 b)
+{
+    json_u128 product;
+#if defined(_MSC_VER)
+    product.lo = _umul128(a, b, &product.hi);
+#else
+    __uint128_t p = (__uint128_t)a * b;
+    product.lo = (u64)p;
+    product.hi = (u64)(p >> 64);
+#endif
+    return product;
+}
+
+u32 json_clz64(u64 x)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - index;
+#else
+    return __builtin_clzll(x);
+#endif
+}
+
+const f64 json_exact_powers_of_ten[] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// w * 10^q is infinite past this whatever w is (the table goes further for writing doubles)
+#define JSON_LARGEST_POWER_OF_TEN 308
+
+// Eisel-Lemire. Returns 0 if the result can't be rounded correctly from 128 bits of 5^q.
+u8 compute_json_float(s64 q, u64 w, u8 negative, f64 *value)
+{
+    if(w == 0 || q < JSON_SMALLEST_POWER_OF_FIVE)
+    {
+        *value = negative ? -0.0 : 0.0;
+        return 1;
+    }
+    if(q > JSON_LARGEST_POWER_OF_TEN)
+    {
+        *value = negative ? -HUGE_VAL : HUGE_VAL;
+        return 1;
+    }
+
+    u64 factor_hi = json_power_of_five_128[2*(q - JSON_SMALLEST_POWER_OF_FIVE)];
+    u64 factor_lo = json_power_of_five_128[2*(q - JSON_SMALLEST_POWER_OF_FIVE) + 1];
+
+    // floor(log2(10^q)) + 1 + 1023 + 63
+    s64 exponent = (((152170 + 65536) * q) >> 16) + 1024 + 63;
+    u32 lz       = json_clz64(w);
+    w <<= lz;
+
+    json_u128 product = json_mul_64(w, factor_hi);
+    u64 lower = product.lo;
+    u64 upper = product.hi;
+    if((upper & 0x1FF) == 0x1FF && lower + w < lower)
+    {
+        // Not enough bits yet to be sure of rounding, bring in the lower half of 5^q
+        json_u128 product_low = json_mul_64(w, factor_lo);
+        u64 product_middle = lower + product_low.hi;
+        if(product_middle < lower) upper += 1;
+        if(product_middle + 1 == 0 && (upper & 0x1FF) == 0x1FF && product_low.lo + w < product_low.lo) return 0;
+        lower = product_middle;
+    }
+
+    u64 upper_bit = upper >> 63;
+    u64 mantissa  = upper >> (upper_bit + 9);
+    lz += (u32)(1 ^ upper_bit);
+
+    // Exactly halfway between two doubles, leave it to the slow path
+    if(lower == 0 && (upper & 0x1FF) == 0 && (mantissa & 3) == 1) return 0;
+
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if(mantissa >= ((u64)1 << 53))
+    {
+        // Rounding up overflowed the mantissa
+        mantissa = (u64)1 << 52;
+        lz -= 1;
+    }
+    mantissa &= ~((u64)1 << 52);
+
+    // Subnormals and overflow are left to the slow path
+    s64 real_exponent = exponent - lz;
+    if(real_exponent < 1 || real_exponent > 2046) return 0;
+
+    mantissa |= (u64)real_exponent << 52;
+    mantissa |= (u64)negative << 63;
+    memcpy(value, &mantissa, sizeof(f64));
+    return 1;
+}
+
+// Rebuilds the number as "-<digits>e<exponent>" for strtod. 768 significant digits are enough
+// to round any double, a 769th digit is 1 if anything nonzero follows so halfway cases still work.
+f64 parse_json_number_slow(const char *digits_start, const char *digits_end, u8 negative, s64 explicit_exponent)
+{
+    char buffer[800];
+    u32  len = 0;
+    if(negative) buffer[len++] = '-';
+
+    s64 digits_exponent = 0;
+    u32 num_significant = 0;
+    u32 sticky_index    = 0;
+    u8  sticky          = 0;
+    u8  after_point     = 0;
+    for(const char *c = digits_start; c < digits_end; c += 1)
+    {
+        if(*c == '.')
+        {
+            after_point = 1;
+            continue;
+        }
+        if(num_significant == 0 && *c == '0')
+        {
+            if(after_point) digits_exponent -= 1;
+            continue;
+        }
+
+        num_significant += 1;
+        if(num_significant <= 768)
+        {
+            buffer[len++] = *c;
+            if(after_point) digits_exponent -= 1;
+        }
+        else if(num_significant == 769)
+        {
+            sticky_index  = len;
+            buffer[len++] = '0';
+            sticky        = *c != '0';
+            if(after_point) digits_exponent -= 1;
+        }
+        else
+        {
+            sticky |= *c != '0';
+            if(!after_point) digits_exponent += 1;
+        }
+    }
+    if(sticky)               buffer[sticky_index] = '1';
+    if(num_significant == 0) buffer[len++] = '0';
+
+    s64 exponent = explicit_exponent + digits_exponent;
+    if(exponent >  100000) exponent =  100000;
+    if(exponent < -100000) exponent = -100000;
+    snprintf(buffer + len, sizeof(buffer) - len, "e%lld", (long long)exponent);
+    return strtod(buffer, NULL);
+}
+
+// Length of the RFC 8259 number at src, or 0 if there isn't one. The tokeniser only checks
+// numbers, converting them is left until they're populated.
+u32 scan_json_number(const char *src, const char *src_end)
+{
+    const char *c = src;
+    if(c < src_end && *c == '-') c += 1;
+
+    const char *int_start = c;
+    for(; c < src_end && is_digit(*c); c += 1);
+    if(c == int_start || (c - int_start > 1 && *int_start == '0')) return 0;
+
+    if(c < src_end && *c == '.')
+    {
+        c += 1;
+        const char *frac_start = c;
+        for(; c < src_end && is_digit(*c); c += 1);
+        if(c == frac_start) return 0;
+    }
+
+    if(c < src_end && (*c == 'e' || *c == 'E'))
+    {
+        c += 1;
+        if(c < src_end && (*c == '+' || *c == '-')) c += 1;
+        const char *exp_start = c;
+        for(; c < src_end && is_digit(*c); c += 1);
+        if(c == exp_start) return 0;
+    }
+    return c - src;
+}
+
+// Reads an RFC 8259 number from src without going past src_end. Returns the number of chars
+// read, or 0 if src doesn't start with a valid number.
+u32 parse_json_number(const char *src, const char *src_end, json_number *number)
+{
+    const char *c        = src;
+    u8          negative = 0;
+    if(c < src_end && *c == '-')
+    {
+        negative = 1;
+        c       += 1;
+    }
+    const char *digits_start = c;
+
+    // Integer part - zero, or digits without a leading zero
+    u64 w = 0;
+    const char *int_start = c;
+    for(; c < src_end && is_digit(*c); c += 1) w = 10*w + (*c - '0');
+    u32 num_int_digits = c - int_start;
+    if(num_int_digits == 0 || (num_int_digits > 1 && *int_start == '0')) return 0;
+
+    // Fraction
+    s64 exponent        = 0;
+    u32 num_frac_digits = 0;
+    u8  has_fraction    = 0;
+    if(c < src_end && *c == '.')
+    {
+        has_fraction = 1;
+        c           += 1;
+        const char *frac_start = c;
+        for(; c < src_end && is_digit(*c); c += 1) w = 10*w + (*c - '0');
+        num_frac_digits = c - frac_start;
+        if(num_frac_digits == 0) return 0;
+        exponent = -(s64)num_frac_digits;
+    }
+
+    const char *digits_end = c;
+
+    // Exponent
+    u8  has_exponent      = 0;
+    s64 explicit_exponent = 0;
+    if(c < src_end && (*c == 'e' || *c == 'E'))
+    {
+        has_exponent = 1;
+        c           += 1;
+        u8 negative_exponent = 0;
+        if(c < src_end && (*c == '+' || *c == '-'))
+        {
+            negative_exponent = *c == '-';
+            c                += 1;
+        }
+        const char *exp_start = c;
+        for(; c < src_end && is_digit(*c); c += 1)
+        {
+            // Anything this big is zero or infinity anyway
+            if(explicit_exponent < 0x10000000) explicit_exponent = 10*explicit_exponent + (*c - '0');
+        }
+        if(c == exp_start) return 0;
+        if(negative_exponent) explicit_exponent = -explicit_exponent;
+        exponent += explicit_exponent;
+    }
+    u32 length = c - src;
+
+    if(!has_fraction && !has_exponent && num_int_digits <= 20 && !(negative && w == 0))
+    {
+        // w has wrapped if there are 20 digits, check them against UINT64_MAX = 18446744073709551615
+        u8 fits = 1;
+        if(num_int_digits == 20)
+        {
+            u64 w19 = 0;
+            for(const char *d = int_start; d < int_start + 19; d += 1) w19 = 10*w19 + (*d - '0');
+            u64 last_digit = int_start[19] - '0';
+            fits = w19 < 1844674407370955161ull || (w19 == 1844674407370955161ull && last_digit <= 5);
+        }
+
+        if(fits && !negative)
+        {
+            if(w <= (u64)INT64_MAX)
+            {
+                number->type  = JSON_INT64;
+                number->int64 = (s64)w;
+            }
+            else
+            {
+                number->type   = JSON_UINT64;
+                number->uint64 = w;
+            }
+            return length;
+        }
+        if(fits && negative && w <= (u64)INT64_MAX + 1)
+        {
+            number->type  = JSON_INT64;
+            number->int64 = (w == (u64)INT64_MAX + 1) ? INT64_MIN : -(s64)w;
+            return length;
+        }
+        // -0 and integers beyond 64 bits are f64s
+    }
+
+    number->type = JSON_NUMBER;
+    f64 *value   = &number->number;
+
+    u32 num_digits = num_int_digits + num_frac_digits;
+    if(num_digits > 19)
+    {
+        // Leading zeros don't count towards the 19 digits w can hold
+        for(const char *d = digits_start; d < digits_end && (*d == '0' || *d == '.'); d += 1)
+        {
+            if(*d == '0') num_digits -= 1;
+        }
+    }
+
+    if(num_digits <= 19)
+    {
+        if(!has_fraction && !has_exponent)
+        {
+            // u64 to f64 conversion is correctly rounded
+            *value = negative ? -(f64)w : (f64)w;
+            return length;
+        }
+        if(w <= ((u64)1 << 53) && exponent >= -22 && exponent <= 22)
+        {
+            // Clinger fast path, w and 10^|exponent| are both exact doubles
+            f64 d = (f64)w;
+            if(exponent < 0) d /= json_exact_powers_of_ten[-exponent];
+            else             d *= json_exact_powers_of_ten[exponent];
+            *value = negative ? -d : d;
+            return length;
+        }
+        if(compute_json_float(exponent, w, negative, value)) return length;
+    }
+    else
+    {
+        // Keep the first 19 significant digits. The true value is between w and w+1 of those,
+        // so if both round to the same double that's the answer.
+        w = 0;
+        u32 num_kept    = 0;
+        s64 w_exponent  = explicit_exponent;
+        u8  after_point = 0;
+        for(const char *d = digits_start; d < digits_end; d += 1)
+        {
+            if(*d == '.')
+            {
+                after_point = 1;
+                continue;
+            }
+            if(num_kept == 0 && *d == '0')
+            {
+                if(after_point) w_exponent -= 1;
+                continue;
+            }
+            if(num_kept < 19)
+            {
+                w         = 10*w + (*d - '0');
+                num_kept += 1;
+                if(after_point) w_exponent -= 1;
+            }
+            else if(!after_point)
+            {
+                w_exponent += 1;
+            }
+        }
+
+        f64 low, high;
+        if(compute_json_float(w_exponent, w, negative, &low) &&
+           compute_json_float(w_exponent, w + 1, negative, &high) &&
+           low == high)
+        {
+            *value = low;
+            return length;
+        }
+    }
+
+    *value = parse_json_number_slow(digits_start, digits_end, negative, explicit_exponent);
+    return length;
+}
+
+// ============================== Strings ===================================
+
+// String contents (between the quotes) are checked for control characters and bad escapes,
+// and unescaped into chars_arena. Both skip through runs of plain chars a vector at a time.
+
+#if defined(JSON_SIMD_AVX2)
+
+#define JSON_STRING_VECTOR_SIZE 32
+
+// Bit per byte which is a backslash or a control character
+u32 json_string_special_mask(const char *chars)
+{
+    __m256i v         = _mm256_loadu_si256((const __m256i*)chars);
+    __m256i backslash = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'));
+    __m256i control   = _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(0x1F)), _mm256_set1_epi8(0x1F));
+    return (u32)_mm256_movemask_epi8(_mm256_or_si256(backslash, control));
+}
+
+void copy_json_string_vector(char *dst, const char *chars)
+{
+    _mm256_storeu_si256((__m256i*)dst, _mm256_loadu_si256((const __m256i*)chars));
+}
+
+#elif defined(JSON_SIMD_SSE)
+
+#define JSON_STRING_VECTOR_SIZE 16
+
+// Bit per byte which is a backslash or a control character
+u32 json_string_special_mask(const char *chars)
+{
+    __m128i v         = _mm_loadu_si128((const __m128i*)chars);
+    __m128i backslash = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+    __m128i control   = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1F)), _mm_set1_epi8(0x1F));
+    return (u32)_mm_movemask_epi8(_mm_or_si128(backslash, control));
+}
+
+void copy_json_string_vector(char *dst, const char *chars)
+{
+    _mm_storeu_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)chars));
+}
+
+#endif
+
+u8 read_json_hex4(const char *c, u32 *value)
+{
+    *value = 0;
+    for(u32 i = 0; i < 4; i += 1)
+    {
+        unsigned char h = c[i];
+        u32 digit;
+        if(is_digit(h))                          digit = h - '0';
+        else if((h | 0x20) >= 'a' && (h | 0x20) <= 'f') digit = (h | 0x20) - 'a' + 10;
+        else                                     return 0;
+        *value = (*value << 4) | digit;
+    }
+    return 1;
+}
+
+// Reads the escape sequence at c (which is a backslash). Returns its length in chars, or 0 if
+// it's invalid. \u escapes of UTF-16 surrogate pairs are read as one 12 char sequence.
+u32 read_json_escape(const char *c, const char *end, u32 *code_point)
+{
+    if(end - c < 2) return 0;
+    switch(c[1])
+    {
+        case '"':  *code_point = '"';  return 2;
+        case '\\': *code_point = '\\'; return 2;
+        case '/':  *code_point = '/';  return 2;
+        case 'b':  *code_point = '\b'; return 2;
+        case 'f':  *code_point = '\f'; return 2;
+        case 'n':  *code_point = '\n'; return 2;
+        case 'r':  *code_point = '\r'; return 2;
+        case 't':  *code_point = '\t'; return 2;
+        case 'u':
+        {
+            u32 high;
+            if(end - c < 6 || !read_json_hex4(c + 2, &high)) return 0;
+            if(high < 0xD800 || high > 0xDFFF)
+            {
+                *code_point = high;
+                return 6;
+            }
+            if(high > 0xDBFF) return 0; // Low surrogate on its own
+
+            u32 low;
+            if(end - c < 12 || c[6] != '\\' || c[7] != 'u' || !read_json_hex4(c + 8, &low)) return 0;
+            if(low < 0xDC00 || low > 0xDFFF) return 0;
+            *code_point = 0x10000 + ((high - 0xD800) << 10) + (low - 0xDC00);
+            return 12;
+        }
+        default: return 0;
+    }
+}
+
+u32 encode_json_utf8(u32 code_point, char *dst)
+{
+    if(code_point < 0x80)
+    {
+        dst[0] = (char)code_point;
+        return 1;
+    }
+    if(code_point < 0x800)
+    {
+        dst[0] = (char)(0xC0 | (code_point >> 6));
+        dst[1] = (char)(0x80 | (code_point & 0x3F));
+        return 2;
+    }
+    if(code_point < 0x10000)
+    {
+        dst[0] = (char)(0xE0 | (code_point >> 12));
+        dst[1] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+        dst[2] = (char)(0x80 | (code_point & 0x3F));
+        return 3;
+    }
+    dst[0] = (char)(0xF0 | (code_point >> 18));
+    dst[1] = (char)(0x80 | ((code_point >> 12) & 0x3F));
+    dst[2] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+    dst[3] = (char)(0x80 | (code_point & 0x3F));
+    return 4;
+}
+
+// Returns 0 if the string has control characters or bad escapes in it
+u8 check_json_string(const char *chars, u32 length, u8 *has_escapes)
+{
+    *has_escapes = 0;
+    u32 i = 0;
+    while(i < length)
+    {
+#if defined(JSON_STRING_VECTOR_SIZE)
+        if(i + JSON_STRING_VECTOR_SIZE <= length)
+        {
+            u32 mask = json_string_special_mask(chars + i);
+            if(mask == 0)
+            {
+                i += JSON_STRING_VECTOR_SIZE;
+                continue;
+            }
+            i += json_ctz64(mask);
+        }
+#endif
+        unsigned char c = chars[i];
+        if(c < 0x20) return 0;
+        if(c != '\\')
+        {
+            i += 1;
+            continue;
+        }
+
+        u32 code_point;
+        u32 escape_length = read_json_escape(chars + i, chars + length, &code_point);
+        if(escape_length == 0) return 0;
+        *has_escapes = 1;
+        i += escape_length;
+    }
+    return 1;
+}
+
+// Unescapes a checked string into dst, which has room for length chars (unescaping only ever
+// shrinks a string). Returns the unescaped length.
+u32 unescape_json_string(const char *chars, u32 length, char *dst)
+{
+    u32 in  = 0;
+    u32 out = 0;
+    while(in < length)
+    {
+#if defined(JSON_STRING_VECTOR_SIZE)
+        if(in + JSON_STRING_VECTOR_SIZE <= length)
+        {
+            // out <= in, so a whole vector always fits in dst
+            u32 mask = json_string_special_mask(chars + in);
+            copy_json_string_vector(dst + out, chars + in);
+            if(mask == 0)
+            {
+                in  += JSON_STRING_VECTOR_SIZE;
+                out += JSON_STRING_VECTOR_SIZE;
+                continue;
+            }
+            u32 run = json_ctz64(mask);
+            in  += run;
+            out += run;
+        }
+#endif
+        if(chars[in] != '\\')
+        {
+            dst[out] = chars[in];
+            in  += 1;
+            out += 1;
+            continue;
+        }
+
+        u32 code_point;
+        u32 escape_length = read_json_escape(chars + in, chars + length, &code_point);
+        if(escape_length == 0)
+        {
+            // Unchecked bad escape, keep the backslash as is
+            dst[out] = chars[in];
+            in  += 1;
+            out += 1;
+            continue;
+        }
+        out += encode_json_utf8(code_point, dst + out);
+        in  += escape_length;
+    }
+    return out;
+}
+
+// ============================== Tokenising ===================================
+
+void print_token_type(json_token_type t)
+{
+    switch(t)
+    {
+        case TOKEN_STRING: printf("TOKEN_STRING"); break;
+        case TOKEN_WORD:   printf("TOKEN_WORD");   break;
+        case TOKEN_NUMBER: printf("TOKEN_NUMBER"); break;
+        case TOKEN_BOOL:   printf("TOKEN_BOOL");   break;
+        case TOKEN_NULL:   printf("TOKEN_NULL");   break;
+        case TOKEN_STOP:   printf("TOKEN_STOP");   break;
+        case TOKEN_COMMA:  printf("TOKEN_COMMA");  break;
+        case TOKEN_COLON:  printf("TOKEN_COLON");  break;
+        case TOKEN_OBRACK: printf("TOKEN_OBRACK"); break;
+        case TOKEN_CBRACK: printf("TOKEN_CBRACK"); break;
+        case TOKEN_OBRACE: printf("TOKEN_OBRACE"); break;
+        case TOKEN_CBRACE: printf("TOKEN_CBRACE"); break;
+        case TOKEN_END:    printf("TOKEN_END");    break;
+        default:           printf("TOKEN_UNKNOWN");break;
+    }
+}
+
+// Escape sequences are unescaped, so the string's size may be less than token_length-2
+json_string copy_to_json_string_no_quotes(const char *token_loc, u32 token_length, char *string_buffer)
+{
+    json_string string = {.chars = string_buffer};
+    string.size = unescape_json_string(token_loc + 1, token_length - 2, string_buffer);
+    compute_json_string_hash(&string);
+    return string;
+}
+
+u8 json_string_token_has_escapes(const char *token_loc, u32 token_length)
+{
+    return memchr(token_loc + 1, '\\', token_length - 2) != NULL;
+}
+
+json_string token_to_json_string_no_copy(const char *token_loc, u32 token_length)
+{
+    json_string string = {.size = token_length, .chars = (char*)token_loc};
+    compute_json_string_hash(&string);
+    return string;
+}
+
+// Reads the type and full length of the token starting at src, which isn't whitespace
+json_token_type read_json_token_type(const char *src, const char *src_end, u32 *length)
+{
+    json_token_type type = TOKEN_NONE;
+    *length = 0;
+    switch(*src)
+    {
+        case ',':
+        case ':':
+        case '[':
+        case ']':
+        case '{':
+        case '}':
+        case '.':
+        {
+            type    = *src;
+            *length = 1;
+            break;
+        }
+        case '"':
+        {
+            // String token includes the surrounding quote marks, escaped quotes don't end it
+            type = TOKEN_STRING;
+            const char *c = src + 1;
+            for(; c < src_end && *c != '"'; c += (*c == '\\') ? 2 : 1);
+            if(c > src_end) c = src_end;
+            *length = (c - src) + 1;
+            break;
+        }
+        case 'n':
+        {
+            if(src_end - src >= 4 && src[1] == 'u' && src[2] == 'l' && src[3] == 'l')
+            {
+                type    = TOKEN_NULL;
+                *length = 4;
+            }
+            break;
+        }
+        case 't':
+        {
+            if(src_end - src >= 4 && src[1] == 'r' && src[2] == 'u' && src[3] == 'e')
+            {
+                type    = TOKEN_BOOL;
+                *length = 4;
+            }
+            break;
+        }
+        case 'f':
+        {
+            if(src_end - src >= 5 && src[1] == 'a' && src[2] == 'l' && src[3] == 's' && src[4] == 'e')
+            {
+                type    = TOKEN_BOOL;
+                *length = 5;
+            }
+            break;
+        }
+        case '-':
+        default:
+        {
+            // Numbers always start with minus or digit
+            if(is_digit(*src) || *src == '-')
+            {
+                type    = TOKEN_NUMBER;
+                *length = scan_json_number(src, src_end);
+
+                const char *c = src + *length;
+                if(*length == 0 || (c < src_end && is_number_char(*c)))
+                {
+                    // Not a valid number (e.g. 01, 1., 1.2.3), make it a word so validation rejects it
+                    for(; c < src_end && is_number_char(*c); c += 1);
+                    type    = TOKEN_WORD;
+                    *length = c - src;
+                }
+            }
+            else if(!is_symbol_with_meaning(*src))
+            {
+                type = TOKEN_WORD;
+                const char *c = src + 1;
+                for(; c < src_end && !is_symbol_with_meaning(*c); c += 1);
+                *length = c - src;
+            }
+        }
+    }
+    return type;
+}
+
+u32 get_json_token_length(json_tokenised *token_src, json_token *token)
+{
+    if(token->length < JSON_TOKEN_MAX_LENGTH) return token->length;
+
+    u32 length;
+    read_json_token_type(token_src->src + token->loc, token_src->src + token_src->src_size, &length);
+    return length;
+}
+
+const char *get_json_token_loc(json_tokenised *token_src, json_token *token)
+{
+    return token_src->src + token->loc;
+}
+
+void print_json_token_info(json_tokenised *token_src, json_token *t)
+{
+    printf("Token: Type("); print_token_type(t->type); printf(") ");
+    printf("Loc(%llu), Len(%u)\n", (unsigned long long)t->loc, get_json_token_length(token_src, t));
+}
+
+void print_json_token(json_tokenised *token_src, json_token *t)
+{
+    const char *loc = get_json_token_loc(token_src, t);
+    switch(t->type)
+    {
+        case TOKEN_STRING:
+        case TOKEN_WORD:
+        case TOKEN_NUMBER:
+        case TOKEN_BOOL:
+        {
+            printf("%.*s", get_json_token_length(token_src, t), loc);
+            break;
+        }
+        case TOKEN_NULL:
+        {
+            printf("null");
+            break;
+        }
+        case TOKEN_END:
+        {
+            printf("<END>");
+            break;
+        }
+        case TOKEN_COMMA:
+        case TOKEN_COLON:
+        case TOKEN_OBRACK:
+        case TOKEN_CBRACK:
+        case TOKEN_OBRACE:
+        case TOKEN_CBRACE:
+        {
+            printf("%c", t->type);
+            break;
+        }
+        default:
+        {
+            printf("<?\?\?>");
+            break;
+        }
+    }
+}
+
+json_token read_json_token(const char *src, const char *src_start, const char *src_end)
+{
+    for(; src < src_end && is_whitespace(*src); src += 1);
+    if(src >= src_end) return make_json_token(TOKEN_END, src_end - src_start, 0);
+
+    u32 length;
+    json_token_type type = read_json_token_type(src, src_end, &length);
+    return make_json_token(type, src - src_start, length);
+}
+
+// Stage two of tokenising - turns indexed positions into tokens
+typedef struct
+{
+    const char           *src;
+    const char           *src_end;
+    const char           *src_current;
+    json_size             next_position;
+    json_structural_index index;
+} json_index_reader;
+
+json_index_reader init_json_index_reader(const char *src, json_size src_size, json_structural_index index)
+{
+    json_index_reader reader =
+    {
+        .src           = src,
+        .src_end       = src + src_size,
+        .src_current   = src,
+        .next_position = 0,
+        .index         = index
+    };
+    return reader;
+}
+
+json_token read_indexed_json_token(json_index_reader *reader)
+{
+    const char *src       = reader->src;
+    const char *src_end   = reader->src_end;
+    json_size  *positions = reader->index.positions;
+    json_size   num_positions = reader->index.num_positions;
+
+    // Skip positions covered by the last token (closing quotes, words containing spaces)
+    json_size i = reader->next_position;
+    for(; i < num_positions && src + positions[i] < reader->src_current; i += 1);
+
+    const char *token_start = (i < num_positions) ? src + positions[i] : src_end;
+    u8          is_indexed  = 1;
+    if(reader->src_current < token_start && !is_whitespace(*reader->src_current))
+    {
+        // The index sees runs like "12abc" as one token start, read what's left of the run
+        token_start = reader->src_current;
+        is_indexed  = 0;
+    }
+
+    json_token_type type   = TOKEN_END;
+    u32             length = 0;
+    if(token_start >= src_end)
+    {
+        token_start = src_end;
+    }
+    else if(is_indexed && *token_start == '"')
+    {
+        // String token includes the surrounding quote marks, the closing quote is the next position
+        const char *closing_quote = (i + 1 < num_positions) ? src + positions[i+1] : src_end;
+        type   = TOKEN_STRING;
+        length = (closing_quote - token_start) + 1;
+    }
+    else
+    {
+        type = read_json_token_type(token_start, src_end, &length);
+    }
+
+    reader->src_current   = token_start + length;
+    reader->next_position = i;
+    return make_json_token(type, token_start - src, length);
+}
+
+// Reads tokens into tokens (growing it) up to and including the END or NONE token, returning how many
+json_size read_indexed_json_tokens(json_index_reader *reader, json_token **tokens, json_size *token_cap, json_allocator *allocator)
+{
+    json_size num_tokens  = 0;
+    json_token *last_read = NULL;
+    do
+    {
+        if(num_tokens >= *token_cap)
+        {
+            *token_cap *= 2;
+            *tokens = (json_token*)json_resize(allocator, *tokens, *token_cap * sizeof(json_token));
+        }
+        last_read   = &(*tokens)[num_tokens];
+        *last_read  = read_indexed_json_token(reader);
+        num_tokens += 1;
+    }
+    while(last_read->type != TOKEN_END && last_read->type != TOKEN_NONE);
+    return num_tokens;
+}
+
+// Reads all of index's tokens into tokens, which is grown (without keeping what was in it) if it's
+// smaller than the usual need. There's about one token per indexed position, only runs like
+// "12abc" make more.
+json_size read_json_index_tokens(const char *src, json_size src_size, json_structural_index index, json_token **tokens, json_size *token_cap, json_allocator *allocator)
+{
+    if(*token_cap < index.num_positions + 2)
+    {
+        if(*tokens) json_dealloc(allocator, *tokens);
+        *token_cap = index.num_positions + 2;
+        *tokens    = (json_token*)json_alloc(allocator, *token_cap * sizeof(json_token));
+    }
+    json_index_reader reader = init_json_index_reader(src, src_size, index);
+    return read_indexed_json_tokens(&reader, tokens, token_cap, allocator);
+}
+
+json_tokenised tokenise_json_index(const char *src, json_size src_size, json_structural_index index, json_allocator *allocator)
+{
+    json_token *tokens     = NULL;
+    json_size   token_cap  = 0;
+    json_size   num_tokens = read_json_index_tokens(src, src_size, index, &tokens, &token_cap, allocator);
+    dealloc_json_structural_index(&index, allocator);
+
+    json_tokenised tokenised_json =
+    {
+        .num_tokens  = num_tokens,
+        .token_index = 0,
+        .tokens      = tokens,
+        .src         = src,
+        .src_size    = src_size
+    };
+    return tokenised_json;
+}
+
+// Tokenising in parallel splits the index at ops, which are a token of their own, so each chunk
+// reads the same tokens the whole would have. The chunks' END tokens are dropped when their tokens
+// are joined up, and a NONE token ends it as it would have. The one exception is invalid src where
+// an escaped quote outside a string starts a string token over an op, then it's read again whole.
+
+typedef struct
+{
+    json_index_reader reader;
+    json_allocator   *allocator;
+    json_token       *tokens;
+    json_size         token_cap;
+    json_size         num_tokens;
+} json_token_chunk;
+
+void tokenise_json_chunk(void *chunk_arg)
+{
+    json_token_chunk *chunk = (json_token_chunk*)chunk_arg;
+    chunk->token_cap  = (chunk->reader.index.num_positions - chunk->reader.next_position) + 2;
+    chunk->tokens     = (json_token*)json_alloc(chunk->allocator, chunk->token_cap * sizeof(json_token));
+    chunk->num_tokens = read_indexed_json_tokens(&chunk->reader, &chunk->tokens, &chunk->token_cap, chunk->allocator);
+}
+
+// As read_json_index_tokens, the chunks' tokens are joined up in tokens
+json_size read_json_index_tokens_parallel(const char *src, json_size src_size, json_structural_index index, u32 num_threads, json_token **tokens, json_size *token_cap, json_allocator *allocator)
+{
+    u64 max_chunks = src_size / JSON_PARALLEL_MIN_CHUNK_SIZE;
+    if(num_threads > max_chunks) num_threads = max_chunks;
+    if(num_threads <= 1) return read_json_index_tokens(src, src_size, index, tokens, token_cap, allocator);
+
+    json_token_chunk *chunks = (json_token_chunk*)json_alloc(allocator, num_threads * sizeof(json_token_chunk));
+    u32       num_chunks = 0;
+    json_size first      = 0;
+    for(u32 i = 1; i <= num_threads; i += 1)
+    {
+        json_size split = (json_size)((u64)index.num_positions * i / num_threads);
+        for(; split < index.num_positions; split += 1)
+        {
+            char c = src[index.positions[split]];
+            if(c == ',' || c == ':' || c == '[' || c == ']' || c == '{' || c == '}') break;
+        }
+        if(split <= first && !(i == num_threads && num_chunks == 0)) continue;
+
+        json_token_chunk *chunk = &chunks[num_chunks];
+        *chunk = (json_token_chunk){0};
+        chunk->reader    = init_json_index_reader(src, src_size, index);
+        chunk->allocator = allocator;
+        chunk->reader.index.num_positions = split;
+        chunk->reader.next_position       = first;
+        if(first > 0)                    chunk->reader.src_current = src + index.positions[first];
+        if(split < index.num_positions)  chunk->reader.src_end     = src + index.positions[split];
+        num_chunks += 1;
+        first       = split;
+    }
+    run_json_threads(tokenise_json_chunk, chunks, sizeof(json_token_chunk), num_chunks, allocator);
+
+    // Join up to the first chunk to end in NONE, or the last (which ends in END)
+    json_size num_tokens  = 0;
+    u32       last_chunk  = 0;
+    u8        overlapping = 0;
+    for(; last_chunk < num_chunks; last_chunk += 1)
+    {
+        json_token_chunk *chunk = &chunks[last_chunk];
+        if(chunk->tokens[chunk->num_tokens-1].type == TOKEN_NONE || last_chunk + 1 == num_chunks)
+        {
+            num_tokens += chunk->num_tokens;
+            break;
+        }
+        if(chunk->num_tokens > 1)
+        {
+            json_token *last_token = &chunk->tokens[chunk->num_tokens-2];
+            overlapping |= last_token->length == JSON_TOKEN_MAX_LENGTH || // Unknown, play safe
+                           last_token->loc + last_token->length > (json_size)(chunk->reader.src_end - src);
+        }
+        num_tokens += chunk->num_tokens - 1;
+    }
+    if(overlapping)
+    {
+        for(u32 i = 0; i < num_chunks; i += 1) json_dealloc(allocator, chunks[i].tokens);
+        json_dealloc(allocator, chunks);
+        return read_json_index_tokens(src, src_size, index, tokens, token_cap, allocator);
+    }
+
+    if(*token_cap < num_tokens)
+    {
+        if(*tokens) json_dealloc(allocator, *tokens);
+        *token_cap = num_tokens;
+        *tokens    = (json_token*)json_alloc(allocator, *token_cap * sizeof(json_token));
+    }
+    json_size num_copied = 0;
+    for(u32 i = 0; i < num_chunks; i += 1)
+    {
+        json_token_chunk *chunk = &chunks[i];
+        if(i <= last_chunk)
+        {
+            json_size num_to_copy = (i == last_chunk) ? chunk->num_tokens : chunk->num_tokens - 1;
+            memcpy(*tokens + num_copied, chunk->tokens, num_to_copy * sizeof(json_token));
+            num_copied += num_to_copy;
+        }
+        json_dealloc(allocator, chunk->tokens);
+    }
+    json_dealloc(allocator, chunks);
+    return num_tokens;
+}
+
+json_tokenised tokenise_json_index_parallel(const char *src, json_size src_size, json_structural_index index, u32 num_threads, json_allocator *allocator)
+{
+    json_token *tokens     = NULL;
+    json_size   token_cap  = 0;
+    json_size   num_tokens = read_json_index_tokens_parallel(src, src_size, index, num_threads, &tokens, &token_cap, allocator);
+    dealloc_json_structural_index(&index, allocator);
+
+    json_tokenised tokenised_json =
+    {
+        .num_tokens  = num_tokens,
+        .token_index = 0,
+        .tokens      = tokens,
+        .src         = src,
+        .src_size    = src_size
+    };
+    return tokenised_json;
+}
+
+void reset_tokenised_json(json_tokenised *tokenised_json)
+{
+    tokenised_json->token_index = 0;
+}
+
+json_tokenised tokenise_json(const char *src, json_size src_size, json_allocator *allocator)
+{
+    return tokenise_json_index(src, src_size, build_json_structural_index(src, src_size, 0, allocator), allocator);
+}
+
+u8 check_json_index_utf8(json_parse_state *parse_state, json_structural_index *index, json_size src_size)
+{
+    if(index->utf8_error_offset == src_size) return 1;
+
+    parse_state->status       = JSON_STATUS_INVALID_UTF8;
+    parse_state->error_offset = index->utf8_error_offset;
+    printf("Parse error: Invalid UTF-8 at byte %llu\n", (unsigned long long)index->utf8_error_offset);
+    return 0;
+}
+
+void tokenise_json_in_parse_state(json_parse_state *parse_state, const char *src, json_size src_size)
+{
+    json_parser *parser = parse_state->parser;
+    if(parser->positions_cap < (u64)src_size + 1)
+    {
+        parser->positions_cap = src_size + 1;
+        parser->positions     = (json_size*)grow_json_parser_mem(parser, parser->positions, (u64)parser->positions_cap * sizeof(json_size));
+    }
+
+    u8 check_utf8 = (parse_state->flags & JSON_PARSE_CHECK_UTF8) != 0;
+    json_structural_index index = {.positions = parser->positions};
+    fill_json_structural_index_parallel(&index, src, src_size, check_utf8, parse_state->num_threads, parse_state->allocator);
+    if(!check_json_index_utf8(parse_state, &index, src_size)) return;
+
+    json_size num_tokens = read_json_index_tokens_parallel(src, src_size, index, parse_state->num_threads, &parser->tokens, &parser->token_cap, parse_state->allocator);
+    parse_state->token_src = (json_tokenised){.num_tokens = num_tokens, .tokens = parser->tokens, .src = src, .src_size = src_size};
+    parse_state->status    = JSON_STATUS_TOKENISED;
+}
+
+// Gets last consumed token
+json_token *current_token(json_tokenised *token_src)
+{
+    // Assume no one is calling at the start of a token array
+    json_size token_index = token_src->token_index - 1;
+    json_token *token = &token_src->tokens[token_index];
+    return token;
+}
+
+json_token *next_token(json_tokenised *token_src)
+{
+    json_token *token = &token_src->tokens[token_src->token_index];
+    token_src->token_index += 1;
+    return token;
+}
+
+// Same as next_token but without considering next token parsed
+json_token *lookahead_token(json_tokenised *token_src)
+{
+    json_token *token = &token_src->tokens[token_src->token_index];
+    return token;
+}
+
+// ============================== Validation ===================================
+
+void print_offending_token(json_parse_state *parse_state, json_token *offending_token)
+{
+    // These figures don't include trailing ellipses
+    u32 max_chars_before_offending = 20;
+    u32 max_chars_after_offending  = 10;
+
+    const char *src_end = parse_state->token_src.src + parse_state->token_src.src_size;
+    parse_state->error_offset = offending_token->loc;
+
+    // Error positions are worked out from the token's offset
+    const char *token_loc             = get_json_token_loc(&parse_state->token_src, offending_token);
+    u32         token_length          = get_json_token_length(&parse_state->token_src, offending_token);
+    json_size   loc_by_chars          = offending_token->loc;
+    json_size   loc_from_end_by_chars = parse_state->token_src.src_size - offending_token->loc;
+    if(token_length > loc_from_end_by_chars) token_length = loc_from_end_by_chars; // Unterminated strings
+
+    const char *src_info_start_loc;
+    const char *src_info_end_loc;
+
+    if(max_chars_before_offending > loc_by_chars)
+    {
+        src_info_start_loc = parse_state->token_src.src;
+    }
+    else
+    {
+        src_info_start_loc = token_loc - max_chars_before_offending;
+    }
+    if(max_chars_after_offending > (loc_from_end_by_chars - token_length))
+    {
+        src_info_end_loc = src_end;
+    }
+    else
+    {
+        src_info_end_loc = token_loc + token_length + max_chars_after_offending;
+    }
+
+    u32 src_info_str_token_loc = token_loc - src_info_start_loc;
+
+    char src_info_str[64] = {0};
+    u32  src_info_str_len = 0;
+    
+    if(src_info_start_loc != parse_state->token_src.src)
+    {
+        for(u32 i = 0; i < 3; i += 1)
+        {
+            src_info_str[i]   = '.';
+            src_info_str_len += 1;
+            src_info_str_token_loc += 1;
+        }
+    }
+
+    // Long tokens are cut short, leaving room for the trailing ellipses
+    u32 max_src_info_str_len = sizeof(src_info_str) - 3;
+    for(const char *c = src_info_start_loc; c != src_info_end_loc && src_info_str_len < max_src_info_str_len; c += 1)
+    {
+        if(*c == '\n') src_info_str[src_info_str_len] = ' ';
+        else           src_info_str[src_info_str_len] = *c;
+
+        src_info_str_len += 1;
+    }
+
+    if(src_info_end_loc != src_end)
+    {
+        for(u32 i = 0; i < 3; i += 1)
+        {
+            src_info_str[src_info_str_len] = '.';
+            src_info_str_len += 1;
+        }
+    }
+
+    printf("Parse error at:\n");
+
+    // Print offending token and surrounding characters, including ellipses where appropriate
+    printf("%.*s\n", src_info_str_len, src_info_str);
+
+    // Print arrow underneath, pointing to offending token
+    for(u32 i = 0; i < src_info_str_token_loc; i += 1) printf(" ");
+    printf("^");
+    for(u32 i = 0; i < token_length; i += 1) printf("~");
+    printf("\n");
+}
+
+void _json_validation_error(json_parse_state *parse_state, json_token *offending_token, json_token_type *expected_types, u32 num_expected_types)
+{
+    print_offending_token(parse_state, offending_token);
+
+    // Print cause of error
+    json_token_type got_type = offending_token->type;
+    printf("Got: "); print_token_type(got_type);
+    printf(". Expected: [");
+    for(u32 i = 0; i < num_expected_types; i += 1)
+    {
+        print_token_type(expected_types[i]); printf(" ");
+    }
+    printf("]\n");
+}
+
+void json_empty_key_error(json_parse_state *parse_state, json_token *offending_token)
+{
+    print_offending_token(parse_state, offending_token);
+    printf("You cannot have empty key strings in JSON object fields!\n");
+}
+
+#define json_validation_error(parse_state, got_token, ...) \
+    json_token_type expected[] = {__VA_ARGS__}; \
+    u32 num_expected = sizeof(expected)/sizeof(json_token_type); \
+    _json_validation_error(parse_state, got_token, expected, num_expected)
+
+// Used for keys and string values
+u8 validate_json_string(json_parse_state *parse_state, json_token *token)
+{
+    const char *loc    = get_json_token_loc(&parse_state->token_src, token);
+    u32         length = get_json_token_length(&parse_state->token_src, token);
+    u8 has_escapes;
+    if(!check_json_string(loc + 1, length - 2, &has_escapes))
+    {
+        print_offending_token(parse_state, token);
+        printf("Strings cannot contain control characters or invalid escape sequences!\n");
+        return 0;
+    }
+    return 1;
+}
+
+void json_depth_error(json_parse_state *parse_state, json_token *offending_token)
+{
+    print_offending_token(parse_state, offending_token);
+    printf("Objects and arrays are nested more than %u deep!\n", parse_state->max_depth);
+}
+
+u8 validate_json_scalar(json_parse_state *parse_state)
+{
+    json_token *token = next_token(&parse_state->token_src);
+    switch(token->type)
+    {
+        case TOKEN_STRING:
+        {
+            if(!validate_json_string(parse_state, token)) return 0;
+            break;
+        }
+        case TOKEN_NUMBER:
+        case TOKEN_BOOL:
+        case TOKEN_NULL:
+        break;
+        default:
+        {
+            json_validation_error(parse_state, token, TOKEN_STRING, TOKEN_NUMBER, TOKEN_BOOL, TOKEN_NULL, TOKEN_OBRACE, TOKEN_OBRACK);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Key string and colon of an object's pair
+u8 validate_json_key(json_parse_state *parse_state)
+{
+    json_token *token = next_token(&parse_state->token_src);
+    if(token->type != TOKEN_STRING)
+    {
+        json_validation_error(parse_state, token, TOKEN_STRING);
+        return 0;
+    }
+    if(!validate_json_string(parse_state, token)) return 0;
+    if(get_json_token_length(&parse_state->token_src, token) == 2)
+    {
+        json_empty_key_error(parse_state, token);
+        return 0;
+    }
+
+    token = next_token(&parse_state->token_src);
+    if(token->type != TOKEN_COLON)
+    {
+        json_validation_error(parse_state, token, TOKEN_COLON);
+        return 0;
+    }
+    return 1;
+}
+
+// Objects are an obrace, 0 or more key-value pairs separated by commas, then a cbrace. Arrays are
+// the same with values and brackets.
+u8 validate_json_ooas(json_parse_state *parse_state)
+{
+    json_tokenised  *token_src = &parse_state->token_src;
+    json_open_level *levels    = parse_state->levels;
+    u32              depth     = 0;
+
+    json_token *token = next_token(token_src);
+    if(token->type != TOKEN_OBRACE)
+    {
+        json_validation_error(parse_state, token, TOKEN_OBRACE);
+        return 0;
+    }
+    levels[depth].type = JSON_OBJECT;
+    depth += 1;
+
+    while(depth > 0)
+    {
+        json_type       type       = levels[depth-1].type;
+        json_token_type close_type = (type == JSON_OBJECT) ? TOKEN_CBRACE : TOKEN_CBRACK;
+        json_token     *lh         = lookahead_token(token_src);
+        if(lh->type == close_type)
+        {
+            if(current_token(token_src)->type == TOKEN_COMMA)
+            {
+                // Ends with comma followed by close
+                json_validation_error(parse_state, lh, TOKEN_NUMBER, TOKEN_STRING, TOKEN_BOOL, TOKEN_NULL);
+                return 0;
+            }
+            next_token(token_src); // Consume close
+            depth -= 1;
+            if(depth == 0) break;
+        }
+        else
+        {
+            if(type == JSON_OBJECT && !validate_json_key(parse_state)) return 0;
+
+            lh = lookahead_token(token_src);
+            if(lh->type == TOKEN_OBRACE || lh->type == TOKEN_OBRACK)
+            {
+                if(depth == parse_state->max_depth)
+                {
+                    json_depth_error(parse_state, lh);
+                    return 0;
+                }
+                next_token(token_src);
+                levels[depth].type = (lh->type == TOKEN_OBRACE) ? JSON_OBJECT : JSON_ARRAY;
+                depth += 1;
+                continue; // Its values come before the rest of this one's
+            }
+            if(!validate_json_scalar(parse_state)) return 0;
+        }
+
+        // After a value, which may be the ooa just closed
+        close_type = (levels[depth-1].type == JSON_OBJECT) ? TOKEN_CBRACE : TOKEN_CBRACK;
+        lh         = lookahead_token(token_src);
+        if(lh->type == TOKEN_COMMA)
+        {
+            next_token(token_src);
+        }
+        else if(lh->type != close_type)
+        {
+            json_validation_error(parse_state, lh, TOKEN_COMMA, close_type);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void validate_json(json_parse_state *parse_state)
+{
+    if(parse_state->status != JSON_STATUS_TOKENISED)
+    {
+        printf("Error: Cannot validate JSON. It hasn't been tokenised yet!\n");
+        return;
+    }
+
+    reset_tokenised_json(&parse_state->token_src);
+    u8 json_validated = validate_json_ooas(parse_state);
+    if(json_validated) parse_state->status = JSON_STATUS_VALID;
+    else               parse_state->status = JSON_STATUS_INVALID;
+}
+
+// ============================== Count JSON ===================================
+
+// Ooas are only populated apart from each other (and need spans) when there are threads to do it
+#ifndef JSON_PARALLEL_MIN_OOAS
+#define JSON_PARALLEL_MIN_OOAS 4096
+#endif
+
+// Called as an ooa's pushed, before its open's read
+void open_json_ooa_span(json_parse_state *parse_state)
+{
+    if(parse_state->num_threads <= 1) return;
+    json_size span_index = alloc_growable_arena_mem(&parse_state->ooa_spans, sizeof(json_ooa_span), 1, parse_state->allocator);
+    json_ooa_span *span = get_arena_nth_alloc((&parse_state->ooa_spans), span_index, json_ooa_span);
+    span->first_token   = parse_state->token_src.token_index;
+    span->chars_before  = parse_state->num_chars_counted;
+}
+
+// Called after its close's read
+void close_json_ooa_span(json_parse_state *parse_state, json_ooa_ptr ooa_index)
+{
+    if(parse_state->num_threads <= 1) return;
+    json_ooa_span *span = get_arena_nth_alloc((&parse_state->ooa_spans), ooa_index, json_ooa_span);
+    span->last_token    = parse_state->token_src.token_index - 1;
+    span->end_ooa       = parse_state->ooa_list.size;
+    span->chars_after   = parse_state->num_chars_counted;
+}
+
+// Chars a string token will take in chars_arena
+u32 count_json_string_chars(json_token *token, json_parse_state *parse_state)
+{
+    const char *loc    = get_json_token_loc(&parse_state->token_src, token);
+    u32         length = get_json_token_length(&parse_state->token_src, token);
+    if((parse_state->flags & JSON_PARSE_ZERO_COPY) && !json_string_token_has_escapes(loc, length)) return 0;
+    return length - 2; // Exclude quote marks
+}
+
+// Pushes an ooa and consumes its open
+void open_counted_json_ooa(json_parse_state *parse_state, json_open_level *level, json_type type)
+{
+    // Counting nested ooas can move the list, so hold on to an index rather than a pointer
+    level->type       = type;
+    level->ooa        = parse_state->ooa_list.size;
+    level->num_values = 0;
+    push_ooa_to_list(&parse_state->ooa_list, type, parse_state->allocator);
+    open_json_ooa_span(parse_state);
+    next_token(&parse_state->token_src);
+}
+
+// Src's been validated, so token types can be trusted to be where they should be
+void count_json_ooas(json_parse_state *parse_state)
+{
+    json_tokenised  *token_src = &parse_state->token_src;
+    json_open_level *levels    = parse_state->levels;
+    u32              depth     = 0;
+
+    open_counted_json_ooa(parse_state, &levels[depth], JSON_OBJECT);
+    depth += 1;
+    while(depth > 0)
+    {
+        json_open_level *level = &levels[depth-1];
+        json_token      *lh    = lookahead_token(token_src);
+        if(lh->type == TOKEN_CBRACE || lh->type == TOKEN_CBRACK)
+        {
+            next_token(token_src); // Consume close
+            parse_state->ooa_list.ooas[level->ooa].size = level->num_values;
+            close_json_ooa_span(parse_state, level->ooa);
+            depth -= 1;
+            if(depth == 0) break;
+        }
+        else
+        {
+            level->num_values += 1;
+            if(level->type == JSON_OBJECT)
+            {
+                json_token *key = next_token(token_src);
+                parse_state->num_chars_counted += count_json_string_chars(key, parse_state);
+                next_token(token_src); // Colon
+                lh = lookahead_token(token_src);
+            }
+
+            if(lh->type == TOKEN_OBRACE || lh->type == TOKEN_OBRACK)
+            {
+                open_counted_json_ooa(parse_state, &levels[depth], (lh->type == TOKEN_OBRACE) ? JSON_OBJECT : JSON_ARRAY);
+                depth += 1;
+                continue;
+            }
+
+            json_token *token = next_token(token_src);
+            if(token->type == TOKEN_STRING)
+            {
+                parse_state->num_chars_counted += count_json_string_chars(token, parse_state) + JSON_BOXED_STRING_CHARS;
+            }
+            else if(token->type == TOKEN_NUMBER && token->length > JSON_INLINE_NUMBER_LENGTH)
+            {
+                parse_state->num_chars_counted += JSON_BOXED_INTEGER_CHARS;
+            }
+        }
+
+        if(lookahead_token(token_src)->type == TOKEN_COMMA) next_token(token_src);
+    }
+}
+
+void count_json_ooas_values_and_strings(json_parse_state *parse_state)
+{   
+    if(parse_state->status != JSON_STATUS_VALID)
+    {
+        printf("Error: Cannot count JSON. It hasn't been validated yet!\n");
+        return;
+    }
+
+    parse_state->ooa_list.size = 0;
+    push_ooa_to_list(&parse_state->ooa_list, JSON_NONE, parse_state->allocator); // NULL ooa
+    if(parse_state->num_threads > 1)
+    {
+        alloc_growable_arena_mem(&parse_state->ooa_spans, sizeof(json_ooa_span), 1, parse_state->allocator); // NULL ooa's
+    }
+    reset_tokenised_json(&parse_state->token_src);
+    count_json_ooas(parse_state);
+
+    parse_state->status = JSON_STATUS_COUNTED;
+}
+
+// ============================== Populate parsed JSON ===================================
+
+json_ooa_ptr get_next_ooa(json_parse_state *parse_state)
+{
+    json_ooa_ptr ooa = parse_state->num_ooas_parsed;
+    parse_state->num_ooas_parsed += 1;
+    return ooa;
+}
+
+// Used for keys and string values
+json_string populate_json_string(json_token *token, json_parse_state *parse_state)
+{
+    const char *loc    = get_json_token_loc(&parse_state->token_src, token);
+    u32         length = get_json_token_length(&parse_state->token_src, token);
+    if((parse_state->flags & JSON_PARSE_ZERO_COPY) && !json_string_token_has_escapes(loc, length))
+    {
+        return token_to_json_string_no_copy(loc + 1, length - 2);
+    }
+
+    char *chars        = alloc_json_chars((&parse_state->chars_arena), length-2);
+    json_string string = copy_to_json_string_no_quotes(loc, length, chars);
+
+    // Give back what unescaping didn't use
+    free_arena_mem(&parse_state->chars_arena, 1, (length-2) - string.size);
+    return string;
+}
+
+// Bits of a table with room for twice num_entries, up to twice max_entries
+u32 get_json_table_bits(u64 num_entries, u32 max_entries)
+{
+    if(num_entries > max_entries) num_entries = max_entries;
+    return get_json_hash_bucket_bits(2 * (u32)num_entries);
+}
+
+// Empties the tables for a parse of up to num_keys keys and num_objects objects
+void reset_json_key_tables(json_parse_state *parse_state, u64 num_keys, u64 num_objects)
+{
+    json_parser *parser = parse_state->parser;
+    parse_state->interned     = NULL;
+    parse_state->num_interned = 0;
+    parse_state->shapes       = NULL;
+    parse_state->num_shapes   = 0;
+    if(parse_state->flags & JSON_PARSE_NO_KEY_SHARING || num_keys < JSON_KEY_SHARING_THRESHOLD) return;
+
+    // Room's made for the most slots, but only the slots used are cleared
+    u32 interned_max_bits = get_json_table_bits(num_keys, JSON_MAX_INTERNED_KEYS);
+    u32 shape_max_bits    = get_json_table_bits(num_objects, JSON_MAX_SHAPES);
+    if(parser->interned_cap < (1u << interned_max_bits))
+    {
+        parser->interned_cap = 1u << interned_max_bits;
+        parser->interned     = (json_string*)grow_json_parser_mem(parser, parser->interned, (u64)parser->interned_cap * sizeof(json_string));
+    }
+    if(parser->shapes_cap < (1u << shape_max_bits))
+    {
+        parser->shapes_cap = 1u << shape_max_bits;
+        parser->shapes     = (json_shape*)grow_json_parser_mem(parser, parser->shapes, (u64)parser->shapes_cap * sizeof(json_shape));
+    }
+
+    parse_state->interned_max_bits = interned_max_bits;
+    parse_state->interned_bits     = (interned_max_bits < JSON_KEY_TABLE_BITS) ? interned_max_bits : JSON_KEY_TABLE_BITS;
+    parse_state->interned          = parser->interned;
+    parse_state->shape_max_bits    = shape_max_bits;
+    parse_state->shape_bits        = (shape_max_bits < JSON_KEY_TABLE_BITS) ? shape_max_bits : JSON_KEY_TABLE_BITS;
+    parse_state->shapes            = parser->shapes;
+    memset(parse_state->interned, 0, (1u << parse_state->interned_bits) * sizeof(json_string));
+    memset(parse_state->shapes, 0, (1u << parse_state->shape_bits) * sizeof(json_shape));
+}
+
+// Doubling a table moves each entry to where it goes in the bigger one, in place. An entry moved
+// past where's been looked at is just moved again.
+void grow_json_interned_keys(json_parse_state *parse_state)
+{
+    json_string *interned  = parse_state->interned;
+    u32          num_slots = 1u << parse_state->interned_bits;
+    parse_state->interned_bits += 1;
+    memset(interned + num_slots, 0, num_slots * sizeof(json_string));
+    for(u32 i = 0; i < num_slots; i += 1)
+    {
+        if(!interned[i].chars) continue;
+        json_string key   = interned[i];
+        interned[i].chars = NULL;
+
+        u32 slot = get_json_hash_bucket(key.hash, parse_state->interned_bits);
+        while(interned[slot].chars) slot = (slot + 1) & (2*num_slots - 1);
+        interned[slot] = key;
+    }
+}
+
+void grow_json_shapes(json_parse_state *parse_state)
+{
+    json_shape *shapes    = parse_state->shapes;
+    u32         num_slots = 1u << parse_state->shape_bits;
+    parse_state->shape_bits += 1;
+    memset(shapes + num_slots, 0, num_slots * sizeof(json_shape));
+    for(u32 i = 0; i < num_slots; i += 1)
+    {
+        if(shapes[i].ooa == 0) continue;
+        json_shape shape = shapes[i];
+        shapes[i].ooa    = 0;
+
+        u32 slot = get_json_hash_bucket(shape.hash, parse_state->shape_bits);
+        while(shapes[slot].ooa != 0) slot = (slot + 1) & (2*num_slots - 1);
+        shapes[slot] = shape;
+    }
+}
+
+// Read like other strings, but a key that's been read before gets the first one's chars
+json_string populate_json_key(json_token *token, json_parse_state *parse_state)
+{
+    if(!parse_state->interned) return populate_json_string(token, parse_state);
+
+    // It's looked up before it's copied, unless it has to be unescaped to be
+    const char *loc         = get_json_token_loc(&parse_state->token_src, token);
+    u32         length      = get_json_token_length(&parse_state->token_src, token);
+    u8          has_escapes = json_string_token_has_escapes(loc, length);
+    json_string key         = has_escapes ? populate_json_string(token, parse_state) : token_to_json_string_no_copy(loc + 1, length - 2);
+
+    u32 num_slots = 1u << parse_state->interned_bits;
+    for(u32 slot = get_json_hash_bucket(key.hash, parse_state->interned_bits); ; slot = (slot + 1) & (num_slots - 1))
+    {
+        json_string *interned = &parse_state->interned[slot];
+        if(interned->chars && json_string_eq(*interned, key))
+        {
+            if(has_escapes) free_arena_mem(&parse_state->chars_arena, 1, key.size); // Give back what it was unescaped to
+            return *interned;
+        }
+        if(!interned->chars)
+        {
+            if(!has_escapes && !(parse_state->flags & JSON_PARSE_ZERO_COPY))
+            {
+                char *chars = alloc_json_chars((&parse_state->chars_arena), key.size);
+                memcpy(chars, key.chars, key.size);
+                key.chars = chars;
+            }
+            if(parse_state->num_interned >= num_slots/2 && parse_state->interned_bits < parse_state->interned_max_bits)
+            {
+                grow_json_interned_keys(parse_state);
+                num_slots = 1u << parse_state->interned_bits;
+                slot      = get_json_hash_bucket(key.hash, parse_state->interned_bits);
+                while(parse_state->interned[slot].chars) slot = (slot + 1) & (num_slots - 1);
+                interned  = &parse_state->interned[slot];
+            }
+            if(parse_state->num_interned < num_slots/2)
+            {
+                *interned = key;
+                parse_state->num_interned += 1;
+            }
+            return key;
+        }
+    }
+}
+
+u32 hash_json_keys(json_string *keys, u32 num_keys)
+{
+    u32 hash = num_keys;
+    for(u32 i = 0; i < num_keys; i += 1) hash = (hash ^ keys[i].hash) * 0x01000193u;
+    return hash;
+}
+
+// Slot of the first object with these keys, or the empty slot they'd go in
+json_shape *find_json_shape(json_parse_state *parse_state, json_string *keys, u32 num_keys, u32 hash)
+{
+    json_string *stored_keys = (json_string*)parse_state->keys_arena.buffer;
+    u32          num_slots   = 1u << parse_state->shape_bits;
+    for(u32 slot = get_json_hash_bucket(hash, parse_state->shape_bits); ; slot = (slot + 1) & (num_slots - 1))
+    {
+        json_shape *shape = &parse_state->shapes[slot];
+        if(shape->ooa == 0) return shape;
+
+        json_ooa *ooa = &parse_state->ooa_list.ooas[shape->ooa];
+        if(shape->hash != hash || ooa->size != num_keys) continue;
+        u32 k = 0;
+        while(k < num_keys && json_string_eq(stored_keys[ooa->keys_index + k], keys[k])) k += 1;
+        if(k == num_keys) return shape;
+    }
+}
+
+// An object's keys go in keys_arena once it's read them all, unless an object before it has the
+// same ones. keys can be in keys_arena already, past where they're put.
+void store_json_object_keys(json_parse_state *parse_state, json_ooa_ptr ooa_index, json_string *keys)
+{
+    json_ooa   *ooa   = &parse_state->ooa_list.ooas[ooa_index];
+    json_shape *shape = NULL;
+    u32         hash  = 0;
+    if(parse_state->shapes)
+    {
+        hash  = hash_json_keys(keys, ooa->size);
+        shape = find_json_shape(parse_state, keys, ooa->size, hash);
+        if(shape->ooa != 0)
+        {
+            ooa->keys_index = parse_state->ooa_list.ooas[shape->ooa].keys_index;
+            ooa->shape      = shape->ooa;
+            return;
+        }
+    }
+
+    ooa->keys_index = alloc_json_strings((&parse_state->keys_arena), ooa->size);
+    ooa->shape      = ooa_index;
+    if(ooa->size > 0) memmove(get_arena_nth_alloc((&parse_state->keys_arena), ooa->keys_index, json_string), keys, ooa->size * sizeof(json_string));
+    if(shape && parse_state->num_shapes >= (1u << parse_state->shape_bits)/2 && parse_state->shape_bits < parse_state->shape_max_bits)
+    {
+        grow_json_shapes(parse_state);
+        shape = find_json_shape(parse_state, get_arena_nth_alloc((&parse_state->keys_arena), ooa->keys_index, json_string), ooa->size, hash);
+    }
+    if(shape && parse_state->num_shapes < (1u << parse_state->shape_bits)/2)
+    {
+        shape->hash = hash;
+        shape->ooa  = ooa_index;
+        parse_state->num_shapes += 1;
+    }
+}
+
+void populate_json_scalar(json_value *dst, json_token *token, json_parse_state *parse_state)
+{
+    switch(token->type)
+    {
+        case TOKEN_NUMBER:
+        {
+            // Tokenising checked the number, it's converted here. All representations are 64 bits wide.
+            json_number number;
+            const char *src_end = parse_state->token_src.src + parse_state->token_src.src_size;
+            parse_json_number(get_json_token_loc(&parse_state->token_src, token), src_end, &number);
+            dst->type   = number.type;
+            dst->uint64 = number.uint64;
+            break;
+        }
+        case TOKEN_BOOL:
+        {
+            dst->type    = JSON_BOOL;
+            dst->boolean = *get_json_token_loc(&parse_state->token_src, token) == 't';
+            break;
+        }
+        case TOKEN_STRING:
+        {
+            dst->type   = JSON_STRING;
+            dst->string = populate_json_string(token, parse_state);
+            break;
+        }
+        case TOKEN_NULL:
+        {
+            dst->type = JSON_NULL;
+            break;
+        }
+    }
+}
+
+// Gives the next ooa its values and consumes its open, and its close when it's empty. An object's
+// keys are read onto the key stack, and stored when it closes.
+json_ooa_ptr open_populated_json_ooa(json_parse_state *parse_state, json_open_level *level, json_type type)
+{
+    json_ooa_ptr ooa_index = get_next_ooa(parse_state);
+    json_ooa    *ooa       = &parse_state->ooa_list.ooas[ooa_index];
+
+    ooa->vals_index = alloc_json_values(&parse_state->values_arena, ooa->size);
+    if(type == JSON_OBJECT)
+    {
+        level->keys_base = alloc_growable_arena_mem(&parse_state->parser->key_stack, sizeof(json_string), ooa->size, parse_state->allocator);
+    }
+
+    next_token(&parse_state->token_src);
+    if(ooa->size == 0) next_token(&parse_state->token_src); // Consume empty ooa's close
+
+    level->type       = type;
+    level->ooa        = ooa_index;
+    level->num_values = 0;
+    return ooa_index;
+}
+
+// Ooas are populated in the order they were counted, which is the order they open
+void populate_json_ooas(json_parse_state *parse_state)
+{
+    json_tokenised  *token_src = &parse_state->token_src;
+    json_mem_arena  *key_stack = &parse_state->parser->key_stack;
+    json_open_level *levels    = parse_state->levels;
+    u32              depth     = 0;
+
+    open_populated_json_ooa(parse_state, &levels[depth], JSON_OBJECT);
+    depth += 1;
+    while(depth > 0)
+    {
+        json_open_level *level = &levels[depth-1];
+        json_ooa        *ooa   = &parse_state->ooa_list.ooas[level->ooa];
+        if(level->num_values == ooa->size)
+        {
+            if(level->type == JSON_OBJECT)
+            {
+                u32 num_keys = ooa->size;
+                store_json_object_keys(parse_state, level->ooa, get_arena_nth_alloc(key_stack, level->keys_base, json_string));
+                free_arena_mem(key_stack, sizeof(json_string), num_keys);
+            }
+            depth -= 1;
+            if(depth > 0) next_token(token_src); // Comma or close after it in its parent
+            continue;
+        }
+
+        u32 i = level->num_values;
+        level->num_values += 1;
+        if(level->type == JSON_OBJECT)
+        {
+            json_token  *key    = next_token(token_src);
+            json_string *string = get_arena_nth_alloc(key_stack, level->keys_base + i, json_string);
+            *string             = populate_json_key(key, parse_state);
+            next_token(token_src); // Colon
+        }
+
+        json_stored_value *dst   = get_arena_nth_alloc((&parse_state->values_arena), ooa->vals_index + i, json_stored_value);
+        json_token        *token = lookahead_token(token_src);
+        json_value         value;
+        if(token->type == TOKEN_OBRACE || token->type == TOKEN_OBRACK)
+        {
+            value.type = (token->type == TOKEN_OBRACE) ? JSON_OBJECT : JSON_ARRAY;
+            value.ooa  = open_populated_json_ooa(parse_state, &levels[depth], value.type);
+            store_json_value(dst, &value, &parse_state->chars_arena);
+            depth += 1;
+            continue;
+        }
+
+        populate_json_scalar(&value, token, parse_state);
+        store_json_value(dst, &value, &parse_state->chars_arena);
+        next_token(token_src);
+        next_token(token_src); // Comma or close
+    }
+}
+
+// Populating in parallel, every ooa is populated apart from the others. Ooas take their values and
+// keys in the order they open, so where each ooa's go is a prefix sum of the counted sizes, and its
+// spans say where its tokens start and the chars its strings start from. Nested ooas are pointed
+// to and skipped over. The result's the same as populating in order but for where some of it sits:
+// chars given back after unescaping leave zeroed gaps rather than being reused, keys aren't interned and
+// objects' keys are stored in the order they open rather than close.
+
+#ifndef JSON_POPULATE_RUN_SIZE
+#define JSON_POPULATE_RUN_SIZE 256 // Ooas a thread takes at a time
+#endif
+
+// Chars from where the arena's got to up to where the next were counted from are a gap unescaping
+// gave back. It's zeroed so it doesn't hold whatever the arena did.
+void zero_json_chars_gap(json_mem_arena *chars_arena, json_size counted_to)
+{
+    if(chars_arena->allocd < counted_to) memset(chars_arena->buffer + chars_arena->allocd, 0, counted_to - chars_arena->allocd);
+}
+
+// Only the ooa's own keys and values, its vals_index and keys_index have to be set
+void populate_json_ooa_alone(json_parse_state *parse_state, json_ooa_ptr ooa_index)
+{
+    json_ooa      *ooa   = &parse_state->ooa_list.ooas[ooa_index];
+    json_ooa_span *spans = (json_ooa_span*)parse_state->ooa_spans.buffer;
+    parse_state->token_src.token_index = spans[ooa_index].first_token + 1; // Past the open
+    parse_state->chars_arena.allocs    = spans[ooa_index].chars_before;
+    parse_state->chars_arena.allocd    = spans[ooa_index].chars_before;
+
+    json_stored_value *value_ptr  = get_arena_nth_alloc((&parse_state->values_arena), ooa->vals_index, json_stored_value);
+    json_string       *string_ptr = get_arena_nth_alloc((&parse_state->keys_arena), ooa->keys_index, json_string);
+    json_ooa_ptr       child      = ooa_index + 1;
+    for(json_size i = 0; i < ooa->size; i += 1)
+    {
+        json_token *token = NULL;
+        if(ooa->type == JSON_OBJECT)
+        {
+            token       = next_token(&parse_state->token_src); // Key string
+            *string_ptr = populate_json_string(token, parse_state);
+            string_ptr += 1;
+            token       = next_token(&parse_state->token_src); // Colon
+        }
+
+        json_value value;
+        token = lookahead_token(&parse_state->token_src);
+        if(token->type == TOKEN_OBRACE || token->type == TOKEN_OBRACK)
+        {
+            value.type = (token->type == TOKEN_OBRACE) ? JSON_OBJECT : JSON_ARRAY;
+            value.ooa  = child;
+            store_json_value(value_ptr, &value, &parse_state->chars_arena);
+            zero_json_chars_gap(&parse_state->chars_arena, spans[child].chars_before);
+            parse_state->token_src.token_index = spans[child].last_token + 1;
+            parse_state->chars_arena.allocs    = spans[child].chars_after;
+            parse_state->chars_arena.allocd    = spans[child].chars_after;
+            child = spans[child].end_ooa;
+        }
+        else
+        {
+            populate_json_scalar(&value, token, parse_state);
+            store_json_value(value_ptr, &value, &parse_state->chars_arena);
+            token = next_token(&parse_state->token_src);
+        }
+        value_ptr += 1;
+        token = next_token(&parse_state->token_src); // Comma or close
+    }
+    zero_json_chars_gap(&parse_state->chars_arena, spans[ooa_index].chars_after);
+}
+
+typedef struct
+{
+    json_parse_state parse_state; // Own copy for its token index and chars arena
+    json_work_slice *slices;
+    u32              num_slices;
+    u32              own_slice;
+} json_populate_worker;
+
+void populate_json_ooa_runs(void *worker_arg)
+{
+    json_populate_worker *worker = (json_populate_worker*)worker_arg;
+    json_size num_ooas = worker->parse_state.ooa_list.size;
+    u32 first, end;
+    while(next_json_work(worker->slices, worker->num_slices, worker->own_slice, 1, &first, &end))
+    {
+        json_size first_ooa = 1 + (json_size)first * JSON_POPULATE_RUN_SIZE; // Past NULL ooa
+        json_size end_ooa   = 1 + (json_size)end * JSON_POPULATE_RUN_SIZE;
+        if(end_ooa > num_ooas) end_ooa = num_ooas;
+        for(json_size i = first_ooa; i < end_ooa; i += 1) populate_json_ooa_alone(&worker->parse_state, i);
+    }
+}
+
+// Ooas' vals_index and keys_index have to be set
+void populate_json_ooas_parallel(json_parse_state *parse_state)
+{
+    u32 num_threads = parse_state->num_threads;
+    json_work_slice      *slices  = (json_work_slice*)json_alloc(parse_state->allocator, num_threads * sizeof(json_work_slice));
+    json_populate_worker *workers = (json_populate_worker*)json_alloc(parse_state->allocator, num_threads * sizeof(json_populate_worker));
+
+    // Slices are of runs rather than ooas, which there can be more of than work slices count
+    u32 num_runs = (u32)((parse_state->ooa_list.size - 1 + JSON_POPULATE_RUN_SIZE - 1) / JSON_POPULATE_RUN_SIZE);
+    init_json_work_slices(slices, num_threads, 0, num_runs);
+    for(u32 i = 0; i < num_threads; i += 1)
+    {
+        workers[i].parse_state = *parse_state;
+        workers[i].slices      = slices;
+        workers[i].num_slices  = num_threads;
+        workers[i].own_slice   = i;
+    }
+    run_json_threads(populate_json_ooa_runs, workers, sizeof(json_populate_worker), num_threads, parse_state->allocator);
+
+    json_dealloc(parse_state->allocator, workers);
+    json_dealloc(parse_state->allocator, slices);
+}
+
+// Populated in parallel, objects' keys go where populating in order would, so shapes are found
+// afterwards and keys_arena's closed up over the repeats. Keys are in ooa order, so only move down.
+// Keys aren't interned, their chars were copied as they were populated.
+void share_json_object_shapes(json_parse_state *parse_state)
+{
+    if(!parse_state->shapes) return;
+
+    json_mem_arena *keys_arena = &parse_state->keys_arena;
+    keys_arena->allocs = 1; // Past NULL key
+    keys_arena->allocd = sizeof(json_string);
+    for(json_size i = 1; i < parse_state->ooa_list.size; i += 1)
+    {
+        json_ooa *ooa = &parse_state->ooa_list.ooas[i];
+        if(ooa->type == JSON_OBJECT) store_json_object_keys(parse_state, i, get_arena_nth_alloc(keys_arena, ooa->keys_index, json_string));
+    }
+}
+
+typedef struct
+{
+    json_parse_status status;       // JSON_STATUS_PARSED, or why parsing failed
+    json_size         error_offset; // Offset into src of the error when parsing failed
+    json_allocator    allocator;    // What it was allocated with, to free it with
+    u8                in_parser;    // In a json_parser's buffers, which it frees
+    u8                in_snapshot;  // In a snapshot's image, which is only freed if it's in file
+    void *free_mem_base;
+    json_ooa_list  ooa_list;
+    json_mem_arena keys_arena;
+    json_mem_arena values_arena;
+    json_mem_arena chars_arena;
+    json_mem_arena hash_arena;   // Key hash tables of large objects, allocated separately
+    json_file      file;         // Kept by parse_json_file_with_parser while strings point into it
+} json_parsed;
+
+json_ooa *get_json_ooa_addr(json_parsed *json, json_size index)
+{
+    json_ooa *ooas = json->ooa_list.ooas;
+    return &ooas[index];
+}
+
+json_string *get_json_key_addr(json_parsed *json, json_size index)
+{
+    json_string *keys = (json_string*)json->keys_arena.buffer;
+    return &keys[index];
+}
+
+json_stored_value *get_json_value_addr(json_parsed *json, json_size index)
+{
+    json_stored_value *values = (json_stored_value*)json->values_arena.buffer;
+    return &values[index];
+}
+
+json_value load_parsed_json_value(json_parsed *json, json_size index)
+{
+    return load_json_value(get_json_value_addr(json, index), (const char*)json->chars_arena.buffer);
+}
+
+// Objects with fewer keys than this are scanned, which is quicker when they fit in a few cache lines
+#ifndef JSON_OBJECT_HASH_THRESHOLD
+#define JSON_OBJECT_HASH_THRESHOLD 32
+#endif
+
+// A table is its bucket bit count, then a bucket per power of two at or above the object's
+// size, then a next link per key. Buckets and links hold key positions plus one, with 0 ending
+// the chain. Chains run in key order so duplicate keys find the first, like the scan does.
+#define get_json_hash_table_size(num_keys, bucket_bits) (1 + (1u << (bucket_bits)) + (num_keys))
+
+void build_json_key_hashes(json_parsed *parsed_json)
+{
+    json_ooa_list *ooa_list = &parsed_json->ooa_list;
+
+    // Objects sharing a shape share the first's table
+    u64 num_entries = 1; // Skip NULL table
+    for(json_size i = 1; i < ooa_list->size; i += 1)
+    {
+        json_ooa *ooa = &ooa_list->ooas[i];
+        if(ooa->type == JSON_OBJECT && ooa->size >= JSON_OBJECT_HASH_THRESHOLD && (ooa->shape == 0 || ooa->shape == i))
+        {
+            num_entries += get_json_hash_table_size(ooa->size, get_json_hash_bucket_bits(ooa->size));
+        }
+    }
+    if(num_entries == 1) return;
+
+    // Grows the buffer it's given, if there is one
+    json_mem_arena *arena = &parsed_json->hash_arena;
+    if(arena->cap < num_entries * sizeof(u32))
+    {
+        if(arena->buffer) json_dealloc(&parsed_json->allocator, arena->buffer);
+        arena->cap    = num_entries * sizeof(u32);
+        arena->buffer = json_alloc(&parsed_json->allocator, arena->cap);
+    }
+    arena->allocd = 0;
+    arena->allocs = 0;
+    alloc_arena_mem(arena, sizeof(u32), 1);
+
+    for(json_size i = 1; i < ooa_list->size; i += 1)
+    {
+        json_ooa *ooa = &ooa_list->ooas[i];
+        if(ooa->type != JSON_OBJECT || ooa->size < JSON_OBJECT_HASH_THRESHOLD) continue;
+        if(ooa->shape != 0 && ooa->shape != i) continue;
+
+        u32 bucket_bits = get_json_hash_bucket_bits(ooa->size);
+        u32 num_buckets = 1u << bucket_bits;
+        ooa->hash_index = alloc_arena_mem(arena, sizeof(u32), get_json_hash_table_size(ooa->size, bucket_bits));
+
+        u32 *table   = get_arena_nth_alloc(arena, ooa->hash_index, u32);
+        u32 *buckets = table + 1;
+        u32 *next    = buckets + num_buckets;
+        table[0]     = bucket_bits;
+        memset(buckets, 0, num_buckets * sizeof(u32));
+
+        // Keys are pushed onto the front of their chains, last first
+        json_string *keys = get_json_key_addr(parsed_json, ooa->keys_index);
+        for(u32 k = (u32)ooa->size; k > 0; k -= 1)
+        {
+            u32 bucket      = get_json_hash_bucket(keys[k-1].hash, bucket_bits);
+            next[k-1]       = buckets[bucket];
+            buckets[bucket] = k;
+        }
+    }
+    for(json_size i = 1; i < ooa_list->size; i += 1)
+    {
+        json_ooa *ooa = &ooa_list->ooas[i];
+        if(ooa->type != JSON_OBJECT || ooa->size < JSON_OBJECT_HASH_THRESHOLD) continue;
+        if(ooa->shape != 0 && ooa->shape != i) ooa->hash_index = ooa_list->ooas[ooa->shape].hash_index;
+    }
+}
+
+json_parsed populate_parsed_json(json_parse_state *parse_state)
+{
+    json_parsed parsed_json = {0};
+    parsed_json.allocator   = *get_json_allocator(parse_state->allocator);
+    if(parse_state->status != JSON_STATUS_COUNTED)
+    {
+        printf("Error: Cannot fill parsed json. It hasn't been counted yet!\n");
+    }
+    else
+    {
+        // Populating in parallel, each ooa's values and keys go where populating in order would put them
+        u8  in_parallel = parse_state->num_threads > 1 && parse_state->ooa_list.size >= JSON_PARALLEL_MIN_OOAS;
+        json_size num_keys   = 1;
+        json_size num_values = 1;
+        for(json_size i = 0; i < parse_state->ooa_list.size; i += 1)
+        {
+            json_ooa *ooa = &parse_state->ooa_list.ooas[i];
+            if(in_parallel && i > 0)
+            {
+                ooa->vals_index = num_values;
+                ooa->keys_index = (ooa->type == JSON_OBJECT) ? num_keys : 0;
+            }
+            num_values += ooa->size;
+            if(ooa->type == JSON_OBJECT) num_keys += ooa->size;
+        }
+        json_size num_chars = parse_state->num_chars_counted;
+
+        u64 keys_buffer_size   = (u64)num_keys   * sizeof(json_string);
+        u64 values_buffer_size = (u64)num_values * sizeof(json_stored_value);
+        u64 chars_buffer_size  = (u64)num_chars  * sizeof(char);
+        u64 total_buffer_size  = keys_buffer_size + values_buffer_size + chars_buffer_size;
+
+        json_parser *parser = parse_state->parser;
+        if(parser->parsed_cap < total_buffer_size)
+        {
+            parser->parsed_cap    = total_buffer_size;
+            parser->parsed_buffer = (char*)grow_json_parser_mem(parser, parser->parsed_buffer, parser->parsed_cap);
+        }
+        void *parsed_buffer = parser->parsed_buffer;
+        void *keys_buffer   = parsed_buffer;
+        void *values_buffer = parsed_buffer + keys_buffer_size;
+        void *chars_buffer  = values_buffer + values_buffer_size;
+
+        json_mem_arena keys_arena   = {.cap = keys_buffer_size,   .allocd = 0, .allocs = 0, .buffer = keys_buffer};
+        json_mem_arena values_arena = {.cap = values_buffer_size, .allocd = 0, .allocs = 0, .buffer = values_buffer};
+        json_mem_arena chars_arena  = {.cap = chars_buffer_size,  .allocd = 0, .allocs = 0, .buffer = chars_buffer};
+
+        json_val_ptr none_value_index = alloc_json_values(&values_arena, 1);
+        json_value none_value = {.type = JSON_DOESNT_EXIST, .ooa = 1}; // Root object index - Useful for returning root when deref'ing non-existant value
+        store_json_value(get_arena_nth_alloc((&values_arena), none_value_index, json_stored_value), &none_value, &chars_arena);
+
+        json_str_ptr none_string_index = alloc_json_strings(&keys_arena, 1);
+        *get_arena_nth_alloc((&keys_arena), none_string_index, json_string) = (json_string){0};
+
+        reset_json_key_tables(parse_state, num_keys, parse_state->ooa_list.size);
+        parse_state->num_ooas_parsed   = 1; // Skip NULL ooa
+        parse_state->keys_arena        = keys_arena;
+        parse_state->values_arena      = values_arena;
+        parse_state->chars_arena       = chars_arena;
+        // Needs to fill values, strings and chars memory
+        if(in_parallel)
+        {
+            populate_json_ooas_parallel(parse_state);
+            parse_state->num_ooas_parsed = parse_state->ooa_list.size;
+            alloc_arena_mem(&parse_state->values_arena, sizeof(json_stored_value), num_values - 1);
+            alloc_arena_mem(&parse_state->keys_arena, sizeof(json_string), num_keys - 1);
+            alloc_arena_mem(&parse_state->chars_arena, 1, num_chars);
+            share_json_object_shapes(parse_state);
+        }
+        else
+        {
+            reset_tokenised_json(&parse_state->token_src);
+            populate_json_ooas(parse_state);
+        }
+        parse_state->status = JSON_STATUS_PARSED;
+
+        parsed_json.in_parser     = 1;
+        parsed_json.free_mem_base = parsed_buffer;
+        parsed_json.ooa_list      = parse_state->ooa_list;
+        parsed_json.keys_arena    = parse_state->keys_arena;
+        parsed_json.values_arena  = parse_state->values_arena;
+        parsed_json.chars_arena   = parse_state->chars_arena;
+    }
+    return parsed_json;
+}
+
+json_parsed parse_json_multi_pass(json_parse_state *parse_state, const char *src, json_size src_size)
+{
+    tokenise_json_in_parse_state(parse_state, src, src_size);
+    if(parse_state->status == JSON_STATUS_INVALID_UTF8)
+    {
+        json_parsed parsed_json  = {0};
+        parsed_json.status       = parse_state->status;
+        parsed_json.error_offset = parse_state->error_offset;
+        parsed_json.allocator    = *get_json_allocator(parse_state->allocator);
+        return parsed_json;
+    }
+
+    // Validate json to make populating object values easier
+    validate_json(parse_state);
+
+    // Get json structure
+    // Parse objects and arrays in order
+    count_json_ooas_values_and_strings(parse_state);
+
+    // Parse and divvy json_values memory
+    json_parsed parsed_json  = populate_parsed_json(parse_state);
+    parsed_json.status       = parse_state->status;
+    parsed_json.error_offset = parse_state->error_offset;
+    return parsed_json;
+}
+
+// ============================== Single pass parse ===================================
+
+// Validates and populates in one walk over the structural index, without a token array or a
+// counting pass. A container's values can't be placed until its size is known, so they wait on
+// a stack and move into values_arena when it closes. Ooas are still numbered in the order they
+// open, so the result has the same layout and accessors as parse_json's.
+
+typedef struct
+{
+    json_ooa_ptr ooa;
+    json_type    type;
+    json_size    stack_values_base;
+    json_size    stack_keys_base;
+    u8           after_value;
+} json_open_ooa;
+
+typedef struct
+{
+    json_parse_state *parse_state;
+    json_index_reader reader;
+    json_mem_arena    open_ooas;   // json_open_ooa
+    json_mem_arena    value_stack; // json_stored_value
+    json_mem_arena    key_stack;   // json_string
+} json_single_pass_state;
+
+void open_json_ooa(json_single_pass_state *state, json_type type)
+{
+    json_parse_state *parse_state = state->parse_state;
+
+    json_size open_index      = alloc_growable_arena_mem(&state->open_ooas, sizeof(json_open_ooa), 1, parse_state->allocator);
+    json_open_ooa *open = get_arena_nth_alloc((&state->open_ooas), open_index, json_open_ooa);
+    open->ooa               = parse_state->ooa_list.size;
+    open->type              = type;
+    open->stack_values_base = state->value_stack.allocs;
+    open->stack_keys_base   = state->key_stack.allocs;
+    open->after_value       = 0;
+    push_ooa_to_list(&parse_state->ooa_list, type, parse_state->allocator);
+}
+
+void close_json_ooa(json_single_pass_state *state)
+{
+    json_parse_state *parse_state = state->parse_state;
+
+    json_open_ooa *open = get_arena_nth_alloc((&state->open_ooas), state->open_ooas.allocs-1, json_open_ooa);
+    json_ooa      *ooa  = &parse_state->ooa_list.ooas[open->ooa];
+    json_size num_values      = state->value_stack.allocs - open->stack_values_base;
+
+    ooa->size       = num_values;
+    ooa->vals_index = alloc_json_values((&parse_state->values_arena), num_values);
+    if(num_values > 0) // Empty ooas' stack can still be unallocated
+    {
+        memcpy(get_arena_nth_alloc((&parse_state->values_arena), ooa->vals_index, json_stored_value),
+               get_arena_nth_alloc((&state->value_stack), open->stack_values_base, json_stored_value),
+               num_values * sizeof(json_stored_value));
+    }
+    free_arena_mem(&state->value_stack, sizeof(json_stored_value), num_values);
+    if(open->type == JSON_OBJECT)
+    {
+        store_json_object_keys(parse_state, open->ooa, get_arena_nth_alloc((&state->key_stack), open->stack_keys_base, json_string));
+        free_arena_mem(&state->key_stack, sizeof(json_string), num_values);
+    }
+
+    json_type    type      = open->type;
+    json_ooa_ptr ooa_index = open->ooa;
+    free_arena_mem(&state->open_ooas, sizeof(json_open_ooa), 1);
+    if(state->open_ooas.allocs > 0)
+    {
+        // The closed ooa is now a value of its parent
+        json_size value_index  = alloc_growable_arena_mem(&state->value_stack, sizeof(json_stored_value), 1, parse_state->allocator);
+        json_value value = {.type = type, .ooa = ooa_index};
+        store_json_value(get_arena_nth_alloc((&state->value_stack), value_index, json_stored_value), &value, &parse_state->chars_arena);
+    }
+}
+
+u8 single_pass_json(json_single_pass_state *state)
+{
+    json_parse_state *parse_state = state->parse_state;
+
+    json_token token = read_indexed_json_token(&state->reader);
+    if(token.type != TOKEN_OBRACE)
+    {
+        json_validation_error(parse_state, &token, TOKEN_OBRACE);
+        return 0;
+    }
+    open_json_ooa(state, JSON_OBJECT);
+
+    while(state->open_ooas.allocs > 0)
+    {
+        json_open_ooa  *open       = get_arena_nth_alloc((&state->open_ooas), state->open_ooas.allocs-1, json_open_ooa);
+        json_token_type close_type = (open->type == JSON_OBJECT) ? TOKEN_CBRACE : TOKEN_CBRACK;
+
+        token = read_indexed_json_token(&state->reader);
+        if(open->after_value)
+        {
+            if(token.type == close_type)
+            {
+                close_json_ooa(state);
+                continue;
+            }
+            if(token.type != TOKEN_COMMA)
+            {
+                json_validation_error(parse_state, &token, TOKEN_COMMA, close_type);
+                return 0;
+            }
+            token = read_indexed_json_token(&state->reader);
+            if(token.type == close_type)
+            {
+                // Ends with comma followed by close
+                json_validation_error(parse_state, &token, TOKEN_NUMBER, TOKEN_STRING, TOKEN_BOOL, TOKEN_NULL);
+                return 0;
+            }
+        }
+        else if(token.type == close_type)
+        {
+            close_json_ooa(state); // Empty object or array
+            continue;
+        }
+
+        if(open->type == JSON_OBJECT)
+        {
+            // Key string
+            if(token.type != TOKEN_STRING)
+            {
+                json_validation_error(parse_state, &token, TOKEN_STRING);
+                return 0;
+            }
+            if(!validate_json_string(parse_state, &token)) return 0;
+            if(get_json_token_length(&parse_state->token_src, &token) == 2)
+            {
+                json_empty_key_error(parse_state, &token);
+                return 0;
+            }
+            json_size key_index    = alloc_growable_arena_mem(&state->key_stack, sizeof(json_string), 1, parse_state->allocator);
+            json_string *key = get_arena_nth_alloc((&state->key_stack), key_index, json_string);
+            *key             = populate_json_key(&token, parse_state);
+
+            // Colon
+            token = read_indexed_json_token(&state->reader);
+            if(token.type != TOKEN_COLON)
+            {
+                json_validation_error(parse_state, &token, TOKEN_COLON);
+                return 0;
+            }
+            token = read_indexed_json_token(&state->reader);
+        }
+
+        open->after_value = 1;
+        if((token.type == TOKEN_OBRACE || token.type == TOKEN_OBRACK) && state->open_ooas.allocs == parse_state->max_depth)
+        {
+            json_depth_error(parse_state, &token);
+            return 0;
+        }
+        switch(token.type)
+        {
+            case TOKEN_OBRACE: open_json_ooa(state, JSON_OBJECT); break;
+            case TOKEN_OBRACK: open_json_ooa(state, JSON_ARRAY);  break;
+            case TOKEN_STRING:
+            {
+                if(!validate_json_string(parse_state, &token)) return 0;
+            } // Fall through
+            case TOKEN_NUMBER:
+            case TOKEN_BOOL:
+            case TOKEN_NULL:
+            {
+                json_size value_index = alloc_growable_arena_mem(&state->value_stack, sizeof(json_stored_value), 1, parse_state->allocator);
+                json_value value;
+                populate_json_scalar(&value, &token, parse_state);
+                store_json_value(get_arena_nth_alloc((&state->value_stack), value_index, json_stored_value), &value, &parse_state->chars_arena);
+                break;
+            }
+            default:
+            {
+                json_validation_error(parse_state, &token, TOKEN_STRING, TOKEN_NUMBER, TOKEN_BOOL, TOKEN_NULL, TOKEN_OBRACE, TOKEN_OBRACK);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+json_parsed parse_json_single_pass(json_parse_state *parse_state, const char *src, json_size src_size)
+{
+    json_parser *parser = parse_state->parser;
+    parse_state->token_src.src      = src;
+    parse_state->token_src.src_size = src_size;
+
+    if(parser->positions_cap < (u64)src_size + 1)
+    {
+        parser->positions_cap = src_size + 1;
+        parser->positions     = (json_size*)grow_json_parser_mem(parser, parser->positions, (u64)parser->positions_cap * sizeof(json_size));
+    }
+
+    json_parsed parsed_json = {0};
+    parsed_json.allocator   = parser->allocator;
+    json_structural_index index = {.positions = parser->positions};
+    fill_json_structural_index_parallel(&index, src, src_size, (parse_state->flags & JSON_PARSE_CHECK_UTF8) != 0, parse_state->num_threads, parse_state->allocator);
+    if(!check_json_index_utf8(parse_state, &index, src_size))
+    {
+        parsed_json.status       = parse_state->status;
+        parsed_json.error_offset = parse_state->error_offset;
+        return parsed_json;
+    }
+
+    json_single_pass_state state = {0};
+    state.parse_state = parse_state;
+    state.reader      = init_json_index_reader(src, src_size, index);
+    state.open_ooas   = parser->open_ooas;
+    state.value_stack = parser->value_stack;
+    state.key_stack   = parser->key_stack;
+    state.open_ooas.allocd   = state.open_ooas.allocs   = 0;
+    state.value_stack.allocd = state.value_stack.allocs = 0;
+    state.key_stack.allocd   = state.key_stack.allocs   = 0;
+
+    parse_state->ooa_list.size = 0;
+    push_ooa_to_list(&parse_state->ooa_list, JSON_NONE, parse_state->allocator); // NULL ooa
+
+    // Without counting, arenas are sized from the index. Every value starts at an indexed
+    // position and every key takes at least four (quotes, colon and value), and strings never
+    // hold more chars than the source. Pages past what's used are never touched.
+    json_size num_positions = state.reader.index.num_positions;
+    u64 num_keys      = num_positions/4 + 1;
+    u64 num_values    = (u64)num_positions + 1;
+    u64 num_chars     = src_size + get_json_boxed_chars_bound(num_positions, src_size);
+
+    u64 keys_buffer_size   = num_keys   * sizeof(json_string);
+    u64 values_buffer_size = num_values * sizeof(json_stored_value);
+    u64 chars_buffer_size  = num_chars  * sizeof(char);
+    u64 total_buffer_size  = keys_buffer_size + values_buffer_size + chars_buffer_size;
+
+    if(parser->parsed_cap < total_buffer_size)
+    {
+        parser->parsed_cap    = total_buffer_size;
+        parser->parsed_buffer = (char*)grow_json_parser_mem(parser, parser->parsed_buffer, parser->parsed_cap);
+    }
+    char *parsed_buffer = parser->parsed_buffer;
+    char *keys_buffer   = parsed_buffer;
+    char *values_buffer = keys_buffer + keys_buffer_size;
+    char *chars_buffer  = values_buffer + values_buffer_size;
+
+    parse_state->keys_arena   = (json_mem_arena){.cap = keys_buffer_size,   .allocd = 0, .allocs = 0, .buffer = keys_buffer};
+    parse_state->values_arena = (json_mem_arena){.cap = values_buffer_size, .allocd = 0, .allocs = 0, .buffer = values_buffer};
+    parse_state->chars_arena  = (json_mem_arena){.cap = chars_buffer_size,  .allocd = 0, .allocs = 0, .buffer = chars_buffer};
+
+    json_val_ptr none_value_index = alloc_json_values((&parse_state->values_arena), 1);
+    json_value none_value = {.type = JSON_DOESNT_EXIST, .ooa = 1}; // Root object index - Useful for returning root when deref'ing non-existant value
+    store_json_value(get_arena_nth_alloc((&parse_state->values_arena), none_value_index, json_stored_value), &none_value, &parse_state->chars_arena);
+
+    json_str_ptr none_string_index = alloc_json_strings((&parse_state->keys_arena), 1);
+    *get_arena_nth_alloc((&parse_state->keys_arena), none_string_index, json_string) = (json_string){0};
+
+    reset_json_key_tables(parse_state, num_keys, num_positions/2 + 1);
+    if(single_pass_json(&state))
+    {
+        parse_state->status       = JSON_STATUS_PARSED;
+        parsed_json.in_parser     = 1;
+        parsed_json.free_mem_base = parsed_buffer;
+        parsed_json.ooa_list      = parse_state->ooa_list;
+        parsed_json.keys_arena    = parse_state->keys_arena;
+        parsed_json.values_arena  = parse_state->values_arena;
+        parsed_json.chars_arena   = parse_state->chars_arena;
+    }
+    else
+    {
+        parse_state->status = JSON_STATUS_INVALID;
+    }
+
+    // The stacks may have grown
+    parser->open_ooas   = state.open_ooas;
+    parser->value_stack = state.value_stack;
+    parser->key_stack   = state.key_stack;
+    parsed_json.status       = parse_state->status;
+    parsed_json.error_offset = parse_state->error_offset;
+    return parsed_json;
+}
+
+// ============================== Parse ===================================
+
+// A NULL allocator uses the functions given to set_allocation_functions
+json_parser init_json_parser(json_allocator *allocator, u32 flags)
+{
+    json_parser parser = {0};
+    parser.allocator   = *get_json_allocator(allocator);
+    parser.flags       = flags;
+    return parser;
+}
+
+// Parsing with a fixed buffer never allocates, the buffers are carved from it as big as a parse of
+// that much src could need (see get_json_parser_buffer_size). Parsing src too big for it fails with
+// JSON_STATUS_OUT_OF_MEMORY. Parses are on the calling thread, whatever the flags.
+json_parser init_json_parser_with_buffer(void *buffer, u64 buffer_size, u32 flags)
+{
+    json_parser parser  = init_json_parser(NULL, flags);
+    parser.fixed_buffer = (char*)buffer;
+    parser.fixed_size   = buffer_size;
+    return parser;
+}
+
+u32 get_json_parser_max_depth(json_parser *parser)
+{
+    return (parser->max_depth > 0) ? parser->max_depth : JSON_MAX_DEPTH;
+}
+
+u64 carve_json_parser_mem(u64 *buffer_size, u64 size)
+{
+    u64 offset   = (*buffer_size + 15) & ~15ull;
+    *buffer_size = offset + size;
+    return offset;
+}
+
+// Lays the buffers out for the worst case of src_size bytes of src, carving them from the fixed
+// buffer if it's big enough, and returns the size they take. That's a position and a token for
+// every byte, an ooa for every two (every byte single pass, where brackets needn't match), a value
+// for every byte, a key for every four (quotes, colon and value) and as many chars as bytes. Key
+// hash tables take less than four u32s per key. No more than max_depth ooas are open at a time.
+// Key and shape tables are sized for their most entries, see reset_json_key_tables.
+u64 carve_json_parser_buffers(json_parser *parser, json_size src_size)
+{
+    u8  single_pass = (parser->flags & JSON_PARSE_SINGLE_PASS) != 0;
+    u64 num_bytes   = src_size;
+    u64 num_ooas    = single_pass ? num_bytes + 2 : num_bytes/2 + 2;
+    u64 num_values  = num_bytes + 1;
+    u64 num_keys    = num_bytes/4 + 2;
+    u64 num_hashes  = (parser->flags & JSON_PARSE_NO_KEY_HASH) ? 0 : num_bytes + 5;
+    u64 num_tokens  = single_pass ? 0 : num_bytes + 2;
+    u64 num_stacked = single_pass ? 1 : 0;
+    u64 num_levels  = get_json_parser_max_depth(parser);
+    u64 num_open    = (num_levels < num_ooas) ? num_levels : num_ooas;
+    u8  sharing     = !(parser->flags & JSON_PARSE_NO_KEY_SHARING) && num_keys >= JSON_KEY_SHARING_THRESHOLD;
+    u64 num_slots   = sharing ? 1ull << get_json_table_bits(num_keys, JSON_MAX_INTERNED_KEYS) : 0;
+    u64 num_shapes  = sharing ? 1ull << get_json_table_bits(single_pass ? num_bytes/2 + 2 : num_ooas, JSON_MAX_SHAPES) : 0;
+
+    u64 num_chars      = num_bytes + get_json_boxed_chars_bound(num_bytes, src_size);
+    u64 parsed_size    = num_keys * sizeof(json_string) + num_values * sizeof(json_stored_value) + num_chars;
+    u64 buffer_size    = 0;
+    u64 positions_at   = carve_json_parser_mem(&buffer_size, (num_bytes + 1) * sizeof(json_size));
+    u64 tokens_at      = carve_json_parser_mem(&buffer_size, num_tokens * sizeof(json_token));
+    u64 ooas_at        = carve_json_parser_mem(&buffer_size, num_ooas * sizeof(json_ooa));
+    u64 levels_at      = carve_json_parser_mem(&buffer_size, num_levels * sizeof(json_open_level));
+    u64 open_ooas_at   = carve_json_parser_mem(&buffer_size, num_stacked * num_open * sizeof(json_open_ooa));
+    u64 value_stack_at = carve_json_parser_mem(&buffer_size, num_stacked * num_values * sizeof(json_stored_value));
+    u64 key_stack_at   = carve_json_parser_mem(&buffer_size, num_keys * sizeof(json_string));
+    u64 interned_at    = carve_json_parser_mem(&buffer_size, num_slots * sizeof(json_string));
+    u64 shapes_at      = carve_json_parser_mem(&buffer_size, num_shapes * sizeof(json_shape));
+    u64 parsed_at      = carve_json_parser_mem(&buffer_size, parsed_size);
+    u64 hash_at        = carve_json_parser_mem(&buffer_size, num_hashes * sizeof(u32));
+    if(!parser->fixed_buffer || buffer_size > parser->fixed_size) return buffer_size;
+
+    char *buffer = parser->fixed_buffer;
+    parser->positions_cap = num_bytes + 1;
+    parser->positions     = (json_size*)(buffer + positions_at);
+    parser->token_cap     = num_tokens;
+    parser->tokens        = (json_token*)(buffer + tokens_at);
+    parser->levels_cap    = num_levels;
+    parser->levels        = (json_open_level*)(buffer + levels_at);
+    parser->ooa_list      = (json_ooa_list){.cap = num_ooas, .ooas = (json_ooa*)(buffer + ooas_at)};
+    parser->open_ooas     = (json_mem_arena){.cap = num_stacked * num_open * sizeof(json_open_ooa), .buffer = buffer + open_ooas_at};
+    parser->value_stack   = (json_mem_arena){.cap = num_stacked * num_values * sizeof(json_stored_value), .buffer = buffer + value_stack_at};
+    parser->key_stack     = (json_mem_arena){.cap = num_keys * sizeof(json_string), .buffer = buffer + key_stack_at};
+    parser->interned_cap  = (u32)num_slots;
+    parser->interned      = (json_string*)(buffer + interned_at);
+    parser->shapes_cap    = (u32)num_shapes;
+    parser->shapes        = (json_shape*)(buffer + shapes_at);
+    parser->parsed_cap    = parsed_size;
+    parser->parsed_buffer = buffer + parsed_at;
+    parser->hash_arena    = (json_mem_arena){.cap = num_hashes * sizeof(u32), .buffer = buffer + hash_at};
+    return buffer_size;
+}
+
+// Size of fixed buffer a parser with these flags needs to parse any src_size bytes of src
+u64 get_json_parser_buffer_size(json_size src_size, u32 flags)
+{
+    json_parser parser = init_json_parser_with_buffer(NULL, 0, flags);
+    return carve_json_parser_buffers(&parser, src_size);
+}
+
+// Forgets the last parse's result, keeping the buffers
+void reset_json_parser(json_parser *parser)
+{
+    parser->ooa_list.size     = 0;
+    parser->ooa_spans.allocd  = parser->ooa_spans.allocs   = 0;
+    parser->open_ooas.allocd  = parser->open_ooas.allocs   = 0;
+    parser->value_stack.allocd = parser->value_stack.allocs = 0;
+    parser->key_stack.allocd  = parser->key_stack.allocs   = 0;
+    parser->hash_arena.allocd = parser->hash_arena.allocs  = 0;
+}
+
+void dealloc_json_parser(json_parser *parser)
+{
+    if(!parser->fixed_buffer)
+    {
+        json_allocator *allocator = &parser->allocator;
+        if(parser->positions)          json_dealloc(allocator, parser->positions);
+        if(parser->tokens)             json_dealloc(allocator, parser->tokens);
+        if(parser->levels)             json_dealloc(allocator, parser->levels);
+        if(parser->ooa_list.ooas)      json_dealloc(allocator, parser->ooa_list.ooas);
+        if(parser->ooa_spans.buffer)   json_dealloc(allocator, parser->ooa_spans.buffer);
+        if(parser->open_ooas.buffer)   json_dealloc(allocator, parser->open_ooas.buffer);
+        if(parser->value_stack.buffer) json_dealloc(allocator, parser->value_stack.buffer);
+        if(parser->key_stack.buffer)   json_dealloc(allocator, parser->key_stack.buffer);
+        if(parser->interned)           json_dealloc(allocator, parser->interned);
+        if(parser->shapes)             json_dealloc(allocator, parser->shapes);
+        if(parser->parsed_buffer)      json_dealloc(allocator, parser->parsed_buffer);
+        if(parser->hash_arena.buffer)  json_dealloc(allocator, parser->hash_arena.buffer);
+    }
+    json_parser deallocd = init_json_parser(&parser->allocator, parser->flags);
+    deallocd.num_threads = parser->num_threads;
+    deallocd.max_depth   = parser->max_depth;
+    *parser = deallocd;
+}
+
+// The result is in the parser's buffers until its next parse, reset or dealloc
+json_parsed parse_json_with_parser(json_parser *parser, const char *src, json_size src_size)
+{
+    u32 flags = parser->flags;
+    json_parse_state parse_state = {0};
+    parse_state.flags       = flags;
+    parse_state.num_threads = !(flags & JSON_PARSE_PARALLEL) ? 1 : (parser->num_threads > 0) ? parser->num_threads : get_json_num_cores();
+    parse_state.parser      = parser;
+    parse_state.allocator   = &parser->allocator;
+    parse_state.max_depth   = get_json_parser_max_depth(parser);
+
+    json_parsed parsed_json = {0};
+    parsed_json.allocator   = parser->allocator;
+    if(src_size > JSON_MAX_SRC_SIZE)
+    {
+        printf("Parse error: %llu bytes is too big without JSON_64BIT_OFFSETS\n", (unsigned long long)src_size);
+        parsed_json.status = JSON_STATUS_UNREADABLE;
+        return parsed_json;
+    }
+    if(parser->fixed_buffer)
+    {
+        parse_state.num_threads = 1; // Threads would allocate
+        u64 buffer_size = carve_json_parser_buffers(parser, src_size);
+        if(buffer_size > parser->fixed_size)
+        {
+            printf("Parse error: Parsing %llu bytes needs a %llu byte buffer, the parser's is %llu\n", (unsigned long long)src_size, (unsigned long long)buffer_size, (unsigned long long)parser->fixed_size);
+            parsed_json.status = JSON_STATUS_OUT_OF_MEMORY;
+            return parsed_json;
+        }
+    }
+    else if(parser->levels_cap < parse_state.max_depth)
+    {
+        parser->levels_cap = parse_state.max_depth;
+        parser->levels     = (json_open_level*)grow_json_parser_mem(parser, parser->levels, (u64)parser->levels_cap * sizeof(json_open_level));
+    }
+    reset_json_parser(parser);
+    parse_state.levels    = parser->levels;
+    parse_state.ooa_list  = parser->ooa_list;
+    parse_state.ooa_spans = parser->ooa_spans;
+
+    if(flags & JSON_PARSE_SINGLE_PASS) parsed_json = parse_json_single_pass(&parse_state, src, src_size);
+    else                               parsed_json = parse_json_multi_pass(&parse_state, src, src_size);
+
+    // They may have grown
+    parser->ooa_list  = parse_state.ooa_list;
+    parser->ooa_spans = parse_state.ooa_spans;
+
+    if(parsed_json.status == JSON_STATUS_PARSED && !(flags & JSON_PARSE_NO_KEY_HASH))
+    {
+        parsed_json.hash_arena = parser->hash_arena;
+        build_json_key_hashes(&parsed_json);
+        parser->hash_arena = parsed_json.hash_arena;
+    }
+    return parsed_json;
+}
+
+// Hands the parser's last result the buffers it's in, so it outlives the parser's next parse and is
+// freed by dealloc_parsed_json. The parser allocates new ones when it next needs them. Results
+// in a fixed buffer stay there, they're returned as they are.
+json_parsed detach_parsed_json(json_parser *parser, json_parsed parsed_json)
+{
+    if(!parsed_json.in_parser || parser->fixed_buffer) return parsed_json;
+
+    parsed_json.in_parser = 0;
+    parsed_json.allocator = parser->allocator;
+    parser->ooa_list      = (json_ooa_list){0};
+    parser->parsed_cap    = 0;
+    parser->parsed_buffer = NULL;
+    if(parsed_json.hash_arena.buffer == parser->hash_arena.buffer) parser->hash_arena = (json_mem_arena){0};
+    return parsed_json;
+}
+
+// num_threads of 0 uses one per core
+json_parsed parse_json_parallel(const char *src, json_size src_size, u32 flags, u32 num_threads)
+{
+    json_parser parser = init_json_parser(NULL, flags | JSON_PARSE_PARALLEL);
+    parser.num_threads = num_threads;
+    json_parsed parsed_json = detach_parsed_json(&parser, parse_json_with_parser(&parser, src, src_size));
+    dealloc_json_parser(&parser);
+    return parsed_json;
+}
+
+json_parsed parse_json_with_flags(const char *src, json_size src_size, u32 flags)
+{
+    json_parser parser = init_json_parser(NULL, flags);
+    json_parsed parsed_json = detach_parsed_json(&parser, parse_json_with_parser(&parser, src, src_size));
+    dealloc_json_parser(&parser);
+    return parsed_json;
+}
+
+json_parsed parse_json(const char *src, json_size src_size)
+{
+    return parse_json_with_flags(src, src_size, JSON_PARSE_DEFAULT);
+}
+
+// Parses the file at path, mapped where it can be (see Files), with the parser's settings and into
+// its buffers like parse_json_with_parser. With JSON_PARSE_ZERO_COPY strings point into the file,
+// so it's kept until dealloc_parsed_json (which it needs even in the parser), otherwise it goes
+// once it's parsed. Files of 4 GB and over need JSON_64BIT_OFFSETS.
+json_parsed parse_json_file_with_parser(json_parser *parser, const char *path)
+{
+    json_file file = map_json_file(path, JSON_FILE_SEQUENTIAL, &parser->allocator);
+    if(!file.src || file.size > JSON_MAX_SRC_SIZE)
+    {
+        if(!file.src) printf("Parse error: Couldn't read %s\n", path);
+        else          printf("Parse error: %s is too big without JSON_64BIT_OFFSETS\n", path);
+        unmap_json_file(&file, &parser->allocator);
+        return (json_parsed){.status = JSON_STATUS_UNREADABLE};
+    }
+
+    json_parsed parsed_json = parse_json_with_parser(parser, file.src, (json_size)file.size);
+    if((parser->flags & JSON_PARSE_ZERO_COPY) && parsed_json.status == JSON_STATUS_PARSED) parsed_json.file = file;
+    else unmap_json_file(&file, &parser->allocator);
+    return parsed_json;
+}
+
+json_parsed parse_json_file(const char *path, u32 flags)
+{
+    json_parser parser = init_json_parser(NULL, flags);
+    json_parsed parsed_json = detach_parsed_json(&parser, parse_json_file_with_parser(&parser, path));
+    dealloc_json_parser(&parser);
+    return parsed_json;
+}
+
+// ============================== SAX ===================================
+
+// Events for each value as it's read from src, for consumers which don't need json_parsed. It reads
+// tokens straight from src and allocates nothing, keeping one bit per open object or array.
+// Callbacks can be NULL, and returning 0 from one stops parsing with JSON_STATUS_ABORTED. Keys and
+// strings point into src and are as they are there, escapes and all (see unescape_json_string).
+
+#ifndef JSON_SAX_MAX_DEPTH
+#define JSON_SAX_MAX_DEPTH 1024
+#endif
+
+typedef struct
+{
+    void *user_data;
+    u8 (*start_object)(void *user_data);
+    u8 (*end_object)(void *user_data);
+    u8 (*start_array)(void *user_data);
+    u8 (*end_array)(void *user_data);
+    u8 (*key)(void *user_data, json_string key);
+    u8 (*number)(void *user_data, json_number number);
+    u8 (*string)(void *user_data, json_string string);
+    u8 (*boolean)(void *user_data, u8 boolean);
+    u8 (*null)(void *user_data);
+} json_sax_handler;
+
+typedef struct
+{
+    json_parse_state  parse_state; // Only token_src's src is used, for error messages
+    json_sax_handler *handler;
+    const char       *src_current;
+    u32               depth;
+    u64               open_objects[JSON_SAX_MAX_DEPTH/64]; // Bit set for an object, clear for an array
+} json_sax_state;
+
+json_token read_sax_json_token(json_sax_state *state)
+{
+    const char *src     = state->parse_state.token_src.src;
+    const char *src_end = src + state->parse_state.token_src.src_size;
+    const char *c       = state->src_current;
+    for(; c < src_end && is_whitespace(*c); c += 1);
+    if(c >= src_end)
+    {
+        state->src_current = src_end;
+        return make_json_token(TOKEN_END, src_end - src, 0);
+    }
+
+    u32 length;
+    json_token_type type = read_json_token_type(c, src_end, &length);
+    state->src_current   = c + length;
+    return make_json_token(type, c - src, length);
+}
+
+json_string get_sax_json_string(json_sax_state *state, json_token *token)
+{
+    const char *loc    = get_json_token_loc(&state->parse_state.token_src, token);
+    u32         length = get_json_token_length(&state->parse_state.token_src, token);
+    return token_to_json_string_no_copy(loc + 1, length - 2);
+}
+
+u8 is_sax_json_object_open(json_sax_state *state)
+{
+    u32 top = state->depth - 1;
+    return (state->open_objects[top/64] >> (top%64)) & 1;
+}
+
+// Returns 0 if the callback aborted or it's nested too deeply
+u8 open_sax_json_ooa(json_sax_state *state, json_token *token)
+{
+    if(state->depth == JSON_SAX_MAX_DEPTH)
+    {
+        print_offending_token(&state->parse_state, token);
+        printf("Objects and arrays are nested more than %u deep!\n", JSON_SAX_MAX_DEPTH);
+        state->parse_state.status = JSON_STATUS_INVALID;
+        return 0;
+    }
+
+    u32 top = state->depth;
+    u64 bit = 1ull << (top%64);
+    state->depth += 1;
+
+    json_sax_handler *handler = state->handler;
+    if(token->type == TOKEN_OBRACE)
+    {
+        state->open_objects[top/64] |= bit;
+        return !handler->start_object || handler->start_object(handler->user_data);
+    }
+    state->open_objects[top/64] &= ~bit;
+    return !handler->start_array || handler->start_array(handler->user_data);
+}
+
+u8 close_sax_json_ooa(json_sax_state *state)
+{
+    json_sax_handler *handler = state->handler;
+    u8 is_object  = is_sax_json_object_open(state);
+    state->depth -= 1;
+    if(is_object) return !handler->end_object || handler->end_object(handler->user_data);
+    else          return !handler->end_array  || handler->end_array(handler->user_data);
+}
+
+// Returns 0 if the value's invalid or the callback aborted
+u8 read_sax_json_scalar(json_sax_state *state, json_token *token)
+{
+    json_sax_handler *handler = state->handler;
+    switch(token->type)
+    {
+        case TOKEN_STRING:
+        {
+            if(!validate_json_string(&state->parse_state, token))
+            {
+                state->parse_state.status = JSON_STATUS_INVALID;
+                return 0;
+            }
+            return !handler->string || handler->string(handler->user_data, get_sax_json_string(state, token));
+        }
+        case TOKEN_NUMBER:
+        {
+            if(!handler->number) return 1;
+            json_number number;
+            const char *src_end = state->parse_state.token_src.src + state->parse_state.token_src.src_size;
+            parse_json_number(get_json_token_loc(&state->parse_state.token_src, token), src_end, &number);
+            return handler->number(handler->user_data, number);
+        }
+        case TOKEN_BOOL:
+        {
+            u8 boolean = *get_json_token_loc(&state->parse_state.token_src, token) == 't';
+            return !handler->boolean || handler->boolean(handler->user_data, boolean);
+        }
+        case TOKEN_NULL:
+        {
+            return !handler->null || handler->null(handler->user_data);
+        }
+        default:
+        {
+            json_validation_error(&state->parse_state, token, TOKEN_STRING, TOKEN_NUMBER, TOKEN_BOOL, TOKEN_NULL, TOKEN_OBRACE, TOKEN_OBRACK);
+            state->parse_state.status = JSON_STATUS_INVALID;
+            return 0;
+        }
+    }
+}
+
+// Same grammar and errors as single pass parsing. The status is INVALID or ABORTED if it stopped early.
+u8 sax_json(json_sax_state *state)
+{
+    json_parse_state *parse_state = &state->parse_state;
+    json_sax_handler *handler     = state->handler;
+    parse_state->status           = JSON_STATUS_ABORTED;
+
+    json_token token = read_sax_json_token(state);
+    if(token.type != TOKEN_OBRACE)
+    {
+        json_validation_error(parse_state, &token, TOKEN_OBRACE);
+        parse_state->status = JSON_STATUS_INVALID;
+        return 0;
+    }
+    if(!open_sax_json_ooa(state, &token)) return 0;
+
+    u8 after_value = 0;
+    while(state->depth > 0)
+    {
+        u8 in_object = is_sax_json_object_open(state);
+        json_token_type close_type = in_object ? TOKEN_CBRACE : TOKEN_CBRACK;
+
+        token = read_sax_json_token(state);
+        if(after_value)
+        {
+            if(token.type == close_type)
+            {
+                if(!close_sax_json_ooa(state)) return 0;
+                continue;
+            }
+            if(token.type != TOKEN_COMMA)
+            {
+                json_validation_error(parse_state, &token, TOKEN_COMMA, close_type);
+                parse_state->status = JSON_STATUS_INVALID;
+                return 0;
+            }
+            token = read_sax_json_token(state);
+            if(token.type == close_type)
+            {
+                // Ends with comma followed by close
+                json_validation_error(parse_state, &token, TOKEN_NUMBER, TOKEN_STRING, TOKEN_BOOL, TOKEN_NULL);
+                parse_state->status = JSON_STATUS_INVALID;
+                return 0;
+            }
+        }
+        else if(token.type == close_type)
+        {
+            // Empty object or array
+            after_value = 1;
+            if(!close_sax_json_ooa(state)) return 0;
+            continue;
+        }
+
+        if(in_object)
+        {
+            // Key string
+            if(token.type != TOKEN_STRING)
+            {
+                json_validation_error(parse_state, &token, TOKEN_STRING);
+                parse_state->status = JSON_STATUS_INVALID;
+                return 0;
+            }
+            if(!validate_json_string(parse_state, &token))
+            {
+                parse_state->status = JSON_STATUS_INVALID;
+                return 0;
+            }
+            if(get_json_token_length(&parse_state->token_src, &token) == 2)
+            {
+                json_empty_key_error(parse_state, &token);
+                parse_state->status = JSON_STATUS_INVALID;
+                return 0;
+            }
+            if(handler->key && !handler->key(handler->user_data, get_sax_json_string(state, &token))) return 0;
+
+            // Colon
+            token = read_sax_json_token(state);
+            if(token.type != TOKEN_COLON)
+            {
+                json_validation_error(parse_state, &token, TOKEN_COLON);
+                parse_state->status = JSON_STATUS_INVALID;
+                return 0;
+            }
+            token = read_sax_json_token(state);
+        }
+
+        if(token.type == TOKEN_OBRACE || token.type == TOKEN_OBRACK)
+        {
+            after_value = 0;
+            if(!open_sax_json_ooa(state, &token)) return 0;
+        }
+        else
+        {
+            after_value = 1;
+            if(!read_sax_json_scalar(state, &token)) return 0;
+        }
+    }
+    parse_state->status = JSON_STATUS_PARSED;
+    return 1;
+}
+
+// Returns JSON_STATUS_PARSED, JSON_STATUS_INVALID or JSON_STATUS_ABORTED. error_offset can be NULL.
+json_parse_status parse_json_sax(const char *src, json_size src_size, json_sax_handler *handler, json_size *error_offset)
+{
+    json_sax_state state = {0};
+    state.parse_state.token_src.src      = src;
+    state.parse_state.token_src.src_size = src_size;
+    state.handler     = handler;
+    state.src_current = src;
+
+    sax_json(&state);
+    if(error_offset) *error_offset = state.parse_state.error_offset;
+    return state.parse_state.status;
+}
+
+// ============================== Push parse ===================================
+
+// SAX parsing of a document fed in chunks as they arrive, so parsing can overlap with receiving it.
+// Tokens are read where they are in each chunk, except one cut off by the end of a chunk, which is
+// carried (copied) until the chunk which finishes it. Keys and strings passed to callbacks point into
+// the chunk or the carry, so only last as long as the callback.
+
+typedef enum
+{
+    JSON_PUSH_ROOT,        // Root object's obrace
+    JSON_PUSH_FIRST,       // First key or value, or close of an empty object or array
+    JSON_PUSH_KEY,         // Key after a comma
+    JSON_PUSH_COLON,
+    JSON_PUSH_VALUE,       // Value after a colon, or after a comma in an array
+    JSON_PUSH_AFTER_VALUE, // Comma or close
+    JSON_PUSH_DONE,
+} json_push_expect;
+
+typedef struct
+{
+    json_sax_state   sax;           // token_src is the chunk or carry being read
+    json_push_expect expect;
+    json_size        chunk_offset;  // Bytes fed before the current chunk
+    json_size        carry_offset;  // Where the carried token starts in the document
+    u32              carry_size;
+    u32              carry_cap;
+    u8               carry_escaped; // Carried string ends part way through an escape
+    char            *carry;
+    json_allocator   allocator;     // For the carry
+} json_push_parser;
+
+// A NULL allocator uses the functions given to set_allocation_functions
+void init_json_push_parser(json_push_parser *parser, json_sax_handler *handler, json_allocator *allocator)
+{
+    *parser = (json_push_parser){0};
+    parser->allocator              = *get_json_allocator(allocator);
+    parser->sax.handler            = handler;
+    parser->sax.parse_state.status = JSON_STATUS_NEED_MORE;
+}
+
+void dealloc_json_push_parser(json_push_parser *parser)
+{
+    if(parser->carry) json_dealloc(&parser->allocator, parser->carry);
+    parser->carry      = NULL;
+    parser->carry_size = 0;
+    parser->carry_cap  = 0;
+}
+
+// Whether c ends a number, literal or word
+u8 is_json_token_delimiter(char c)
+{
+    return is_whitespace(c) || (is_symbol_with_meaning(c) && c != '.');
+}
+
+// Same grammar and errors as sax_json, a token at a time. Returns 0 if the token's invalid or a
+// callback aborted, setting the status to JSON_STATUS_INVALID for the former.
+u8 push_sax_json_token(json_push_parser *parser, json_token *token)
+{
+    json_sax_state   *state       = &parser->sax;
+    json_parse_state *parse_state = &state->parse_state;
+    u8 in_object = state->depth > 0 && is_sax_json_object_open(state);
+    json_token_type close_type = in_object ? TOKEN_CBRACE : TOKEN_CBRACK;
+
+    switch(parser->expect)
+    {
+        case JSON_PUSH_ROOT:
+        {
+            if(token->type != TOKEN_OBRACE)
+            {
+                json_validation_error(parse_state, token, TOKEN_OBRACE);
+                parse_state->status = JSON_STATUS_INVALID;
+                return 0;
+            }
+            parser->expect = JSON_PUSH_FIRST;
+            return open_sax_json_ooa(state, token);
+        }
+        case JSON_PUSH_FIRST:
+        {
+            if(token->type == close_type)
+            {
+                // Empty object or array
+                parser->expect = (state->depth > 1) ? JSON_PUSH_AFTER_VALUE : JSON_PUSH_DONE;
+                return close_sax_json_ooa(state);
+            }
+            parser->expect = in_object ? JSON_PUSH_KEY : JSON_PUSH_VALUE;
+            return push_sax_json_token(parser, token);
+        }
+        case JSON_PUSH_KEY:
+        {
+            if(token->type == close_type)
+            {
+                // Ends with comma followed by close
+                json_validation_error(parse_state, token, TOKEN_NUMBER, TOKEN_STRING, TOKEN_BOOL, TOKEN_NULL);
+                parse_state->status = JSON_STATUS_INVALID;
+                return 0;
+            }
+            if(token->type != TOKEN_STRING)
+            {
+                json_validation_error(parse_state, token, TOKEN_STRING);
+                parse_state->status = JSON_STATUS_INVALID;
+                return 0;
+            }
+            if(!validate_json_string(parse_state, token))
+            {
+                parse_state->status = JSON_STATUS_INVALID;
+                return 0;
+            }
+            if(get_json_token_length(&parse_state->token_src, token) == 2)
+            {
+                json_empty_key_error(parse_state, token);
+                parse_state->status = JSON_STATUS_INVALID;
+                return 0;
+            }
+            parser->expect = JSON_PUSH_COLON;
+            json_sax_handler *handler = state->handler;
+            return !handler->key || handler->key(handler->user_data, get_sax_json_string(state, token));
+        }
+        case JSON_PUSH_COLON:
+        {
+            if(token->type != TOKEN_COLON)
+            {
+                json_validation_error(parse_state, token, TOKEN_COLON);
+                parse_state->status = JSON_STATUS_INVALID;
+                return 0;
+            }
+            parser->expect = JSON_PUSH_VALUE;
+            return 1;
+        }
+        case JSON_PUSH_VALUE:
+        {
+            if(token->type == close_type && !in_object)
+            {
+                // Ends with comma followed by close
+                json_validation_error(parse_state, token, TOKEN_NUMBER, TOKEN_STRING, TOKEN_BOOL, TOKEN_NULL);
+                parse_state->status = JSON_STATUS_INVALID;
+                return 0;
+            }
+            if(token->type == TOKEN_OBRACE || token->type == TOKEN_OBRACK)
+            {
+                parser->expect = JSON_PUSH_FIRST;
+                return open_sax_json_ooa(state, token);
+            }
+            parser->expect = JSON_PUSH_AFTER_VALUE;
+            return read_sax_json_scalar(state, token);
+        }
+        case JSON_PUSH_AFTER_VALUE:
+        {
+            if(token->type == close_type)
+            {
+                parser->expect = (state->depth > 1) ? JSON_PUSH_AFTER_VALUE : JSON_PUSH_DONE;
+                return close_sax_json_ooa(state);
+            }
+            if(token->type != TOKEN_COMMA)
+            {
+                json_validation_error(parse_state, token, TOKEN_COMMA, close_type);
+                parse_state->status = JSON_STATUS_INVALID;
+                return 0;
+            }
+            parser->expect = in_object ? JSON_PUSH_KEY : JSON_PUSH_VALUE;
+            return 1;
+        }
+        case JSON_PUSH_DONE: break;
+    }
+    return 1;
+}
+
+// Pushes the tokens in buffer, which starts at base in the document, until one which doesn't end in
+// buffer (if it could be finished by the next chunk) or the root object's closed. Returns bytes read.
+u32 push_json_buffer(json_push_parser *parser, const char *buffer, u32 size, json_size base, u8 more_to_come)
+{
+    json_parse_state *parse_state = &parser->sax.parse_state;
+    parse_state->token_src.src      = buffer;
+    parse_state->token_src.src_size = size;
+
+    const char *c   = buffer;
+    const char *end = buffer + size;
+    while(parse_state->status == JSON_STATUS_NEED_MORE)
+    {
+        for(; c < end && is_whitespace(*c); c += 1);
+        if(c >= end) break;
+
+        const char *token_end = c + 1;
+        if(*c == '"')
+        {
+            for(; token_end < end && *token_end != '"'; token_end += (*token_end == '\\') ? 2 : 1);
+            if(token_end >= end && more_to_come) break;
+            token_end = (token_end < end) ? token_end + 1 : end;
+        }
+        else if(!is_json_token_delimiter(*c))
+        {
+            for(; token_end < end && !is_json_token_delimiter(*token_end); token_end += 1);
+            if(token_end == end && more_to_come) break;
+        }
+
+        u32 length;
+        json_token_type type = read_json_token_type(c, token_end, &length);
+        json_token token     = make_json_token(type, c - buffer, length);
+
+        parse_state->status = JSON_STATUS_ABORTED;
+        if(!push_sax_json_token(parser, &token))
+        {
+            if(parse_state->status == JSON_STATUS_INVALID) parse_state->error_offset += base;
+            break;
+        }
+        parse_state->status = (parser->expect == JSON_PUSH_DONE) ? JSON_STATUS_PARSED : JSON_STATUS_NEED_MORE;
+        c += length;
+    }
+    return (c < end) ? c - buffer : size;
+}
+
+void carry_json_chars(json_push_parser *parser, const char *chars, u32 num_chars)
+{
+    if(parser->carry_size + num_chars > parser->carry_cap)
+    {
+        u32 cap = (parser->carry_cap > 0) ? parser->carry_cap : 256;
+        while(cap < parser->carry_size + num_chars) cap *= 2;
+        parser->carry     = (char*)json_resize(&parser->allocator, parser->carry, cap);
+        parser->carry_cap = cap;
+    }
+    memcpy(parser->carry + parser->carry_size, chars, num_chars);
+    parser->carry_size += num_chars;
+}
+
+// Returns JSON_STATUS_NEED_MORE until the root object's closed, then JSON_STATUS_PARSED, or
+// JSON_STATUS_INVALID or JSON_STATUS_ABORTED if it stopped. Anything after the root is ignored.
+json_parse_status feed_json_push_parser(json_push_parser *parser, const char *chunk, u32 chunk_size)
+{
+    json_parse_state *parse_state = &parser->sax.parse_state;
+    if(parse_state->status != JSON_STATUS_NEED_MORE) return parse_state->status;
+
+    u32 read = 0;
+    if(parser->carry_size > 0)
+    {
+        // Carry as much of the chunk as finishes the carried token
+        u8 finished = 0;
+        if(parser->carry[0] == '"')
+        {
+            for(; read < chunk_size && !finished; read += 1)
+            {
+                if(parser->carry_escaped)    parser->carry_escaped = 0;
+                else if(chunk[read] == '\\') parser->carry_escaped = 1;
+                else if(chunk[read] == '"')  finished = 1;
+            }
+        }
+        else
+        {
+            for(; read < chunk_size && !is_json_token_delimiter(chunk[read]); read += 1);
+            finished = read < chunk_size;
+        }
+        carry_json_chars(parser, chunk, read);
+        if(!finished)
+        {
+            parser->chunk_offset += chunk_size;
+            return parse_state->status;
+        }
+
+        push_json_buffer(parser, parser->carry, parser->carry_size, parser->carry_offset, 0);
+        parser->carry_size = 0;
+    }
+
+    read += push_json_buffer(parser, chunk + read, chunk_size - read, parser->chunk_offset + read, 1);
+    if(parse_state->status == JSON_STATUS_NEED_MORE && read < chunk_size)
+    {
+        // Carry the cut off token
+        parser->carry_offset  = parser->chunk_offset + read;
+        parser->carry_escaped = 0;
+        if(chunk[read] == '"')
+        {
+            for(u32 i = read + 1; i < chunk_size; i += 1)
+            {
+                parser->carry_escaped = !parser->carry_escaped && chunk[i] == '\\';
+            }
+        }
+        carry_json_chars(parser, chunk + read, chunk_size - read);
+    }
+    parser->chunk_offset += chunk_size;
+    return parse_state->status;
+}
+
+// Call once there's no more input. Returns JSON_STATUS_PARSED if the whole document was read.
+json_parse_status finish_json_push_parser(json_push_parser *parser)
+{
+    json_parse_state *parse_state = &parser->sax.parse_state;
+    if(parse_state->status != JSON_STATUS_NEED_MORE) return parse_state->status;
+
+    if(parser->carry_size > 0)
+    {
+        push_json_buffer(parser, parser->carry, parser->carry_size, parser->carry_offset, 0);
+        parser->carry_size = 0;
+    }
+    if(parse_state->status == JSON_STATUS_NEED_MORE)
+    {
+        printf("Parse error: JSON ended at byte %llu before the root object was closed\n", (unsigned long long)parser->chunk_offset);
+        parse_state->status       = JSON_STATUS_INVALID;
+        parse_state->error_offset = parser->chunk_offset;
+    }
+    return parse_state->status;
+}
+
+// ============================== Output ===================================
+
+// JSON is written into a json_output's buffer. Without a write function the buffer's the result,
+// grown as it's needed, or the caller's, which fails once it's full. With one, whatever's buffered
+// is handed to it each time the buffer fills (or reaches flush_size), so output goes out in a few
+// large writes with bounded memory instead of a call per token.
+
+#define JSON_OUTPUT_BUFFER_SIZE     (64*1024) // Given to growable outputs when they get a write function
+#define JSON_OUTPUT_MIN_BUFFER_SIZE 64        // Any one number, escape or run of indent fits in this
+
+typedef u8 (*json_write_func)(void *user_data, const char *chars, u64 size); // 0 if it failed
+
+typedef struct
+{
+    char           *buffer;
+    u64             size;        // Bytes in buffer not handed to write yet
+    u64             capacity;
+    u64             limit;       // Writing past this flushes or grows the buffer
+    u64             flush_size;  // See set_json_output_flush_size, 0 only flushes when the buffer's full
+    u64             written;     // Bytes handed to write so far
+    json_write_func write;
+    void           *user_data;   // Handed back to write
+    json_allocator  allocator;
+    u8              owns_buffer;
+    u8              can_grow;
+    u8              failed;      // Out of memory, out of buffer or a write failed, anything after's dropped
+} json_output;
+
+// Output into a buffer which grows as it's needed. A NULL allocator uses the functions given to
+// set_allocation_functions.
+json_output init_json_output(json_allocator *allocator)
+{
+    json_output out = {0};
+    out.allocator   = *get_json_allocator(allocator);
+    out.can_grow    = 1;
+    return out;
+}
+
+// Output into the caller's buffer, which never grows. Output past its end fails, unless it's given a
+// write function, when it has to be at least JSON_OUTPUT_MIN_BUFFER_SIZE.
+json_output init_json_output_with_buffer(void *buffer, u64 buffer_size)
+{
+    json_output out = init_json_output(NULL);
+    out.buffer      = (char*)buffer;
+    out.capacity    = buffer_size;
+    out.limit       = buffer_size;
+    out.can_grow    = 0;
+    return out;
+}
+
+void update_json_output_limit(json_output *out)
+{
+    out->limit = out->capacity;
+    if(out->write && out->flush_size > 0 && out->flush_size < out->capacity) out->limit = out->flush_size;
+    if(out->failed) out->limit = 0;
+}
+
+// Reported on stderr, since the output's as likely as not going to stdout
+void fail_json_output(json_output *out, const char *reason)
+{
+    if(!out->failed) fprintf(stderr, "Output error: %s\n", reason);
+    out->failed = 1;
+    out->limit  = 0;
+}
+
+// Hands buffered output to write with fewer than flush_size bytes buffered, instead of waiting for
+// the buffer to fill. Smaller for lower latency, larger for fewer writes.
+void set_json_output_flush_size(json_output *out, u64 flush_size)
+{
+    out->flush_size = flush_size;
+    update_json_output_limit(out);
+}
+
+// From now on the buffer's handed to write instead of growing. Growable outputs get a buffer of
+// JSON_OUTPUT_BUFFER_SIZE if theirs is smaller.
+void set_json_output_func(json_output *out, json_write_func write, void *user_data)
+{
+    out->write     = write;
+    out->user_data = user_data;
+    if(out->can_grow && out->capacity < JSON_OUTPUT_BUFFER_SIZE)
+    {
+        char *buffer = (char*)json_resize(&out->allocator, out->owns_buffer ? out->buffer : NULL, JSON_OUTPUT_BUFFER_SIZE);
+        if(buffer)
+        {
+            out->buffer      = buffer;
+            out->capacity    = JSON_OUTPUT_BUFFER_SIZE;
+            out->owns_buffer = 1;
+        }
+        else fail_json_output(out, "Couldn't allocate the output buffer");
+    }
+    out->can_grow = 0;
+    update_json_output_limit(out);
+}
+
+#if defined(JSON_FD_POSIX)
+
+u8 write_json_to_fd(void *user_data, const char *chars, u64 size)
+{
+    int fd = (int)(intptr_t)user_data;
+    while(size > 0)
+    {
+        ssize_t written = write(fd, chars, size);
+        if(written < 0)
+        {
+            if(errno == EINTR) continue;
+            return 0;
+        }
+        chars += written;
+        size  -= (u64)written;
+    }
+    return 1;
+}
+
+#elif defined(JSON_FD_WIN32)
+
+u8 write_json_to_fd(void *user_data, const char *chars, u64 size)
+{
+    int fd = (int)(intptr_t)user_data;
+    while(size > 0)
+    {
+        unsigned int chunk = (size > (1u << 30)) ? (1u << 30) : (unsigned int)size;
+        int written = _write(fd, chars, chunk);
+        if(written < 0) return 0;
+        chars += written;
+        size  -= (u64)written;
+    }
+    return 1;
+}
+
+#endif
+
+#if defined(JSON_FD_POSIX) || defined(JSON_FD_WIN32)
+// Output to a file descriptor, which stays the caller's to close
+void set_json_output_fd(json_output *out, int fd)
+{
+    set_json_output_func(out, &write_json_to_fd, (void*)(intptr_t)fd);
+}
+#endif
+
+// Hands whatever's buffered to write. Returns 0 if the output's failed. Outputs without a write
+// function keep everything in their buffer, so there's nothing to do.
+u8 flush_json_output(json_output *out)
+{
+    if(out->failed) return 0;
+    if(!out->write || out->size == 0) return 1;
+    if(!out->write(out->user_data, out->buffer, out->size))
+    {
+        fail_json_output(out, "Write failed");
+        return 0;
+    }
+    out->written += out->size;
+    out->size     = 0;
+    return 1;
+}
+
+// Doesn't flush first
+void dealloc_json_output(json_output *out)
+{
+    if(out->owns_buffer && out->buffer) json_dealloc(&out->allocator, out->buffer);
+    out->buffer      = NULL;
+    out->owns_buffer = 0;
+    out->size        = 0;
+    out->capacity    = 0;
+    out->limit       = 0;
+}
+
+u8 grow_json_output(json_output *out, u64 needed)
+{
+    u64 capacity = (out->capacity > 0) ? out->capacity : 4096;
+    while(capacity < needed) capacity *= 2;
+    char *buffer = (char*)json_resize(&out->allocator, out->buffer, capacity);
+    if(!buffer) return 0;
+    out->buffer      = buffer;
+    out->capacity    = capacity;
+    out->owns_buffer = 1;
+    update_json_output_limit(out);
+    return 1;
+}
+
+// Makes room for n more bytes past size, flushing or growing the buffer. Returns NULL if it can't.
+char *reserve_json_output_slow(json_output *out, u64 n)
+{
+    if(out->failed) return NULL;
+    if(out->write)
+    {
+        if(!flush_json_output(out)) return NULL;
+        if(n <= out->capacity) return out->buffer;
+        fail_json_output(out, "Output buffer is smaller than JSON_OUTPUT_MIN_BUFFER_SIZE");
+        return NULL;
+    }
+    if(!out->can_grow)
+    {
+        fail_json_output(out, "Output doesn't fit in its buffer");
+        return NULL;
+    }
+    if(!grow_json_output(out, out->size + n))
+    {
+        fail_json_output(out, "Couldn't grow the output buffer");
+        return NULL;
+    }
+    return out->buffer + out->size;
+}
+
+// Where the next n bytes go, which the caller adds to size once they're there. n is at most
+// JSON_OUTPUT_MIN_BUFFER_SIZE. NULL if the output's failed.
+char *reserve_json_output(json_output *out, u64 n)
+{
+    if(out->size + n <= out->limit) return out->buffer + out->size;
+    return reserve_json_output_slow(out, n);
+}
+
+void write_json_chars_slow(json_output *out, const char *chars, u64 size)
+{
+    if(out->failed) return;
+    if(out->write)
+    {
+        if(!flush_json_output(out)) return;
+        if(size > out->limit)
+        {
+            // Anything as big as the buffer goes straight to write
+            if(!out->write(out->user_data, chars, size)) fail_json_output(out, "Write failed");
+            else                                         out->written += size;
+            return;
+        }
+    }
+    else if(!out->can_grow)
+    {
+        fail_json_output(out, "Output doesn't fit in its buffer");
+        return;
+    }
+    else if(!grow_json_output(out, out->size + size))
+    {
+        fail_json_output(out, "Couldn't grow the output buffer");
+        return;
+    }
+    memcpy(out->buffer + out->size, chars, size);
+    out->size += size;
+}
+
+// Writes chars as they are
+void write_json_chars(json_output *out, const char *chars, u64 size)
+{
+    if(out->size + size <= out->limit && size > 0)
+    {
+        memcpy(out->buffer + out->size, chars, size);
+        out->size += size;
+    }
+    else if(size > 0) write_json_chars_slow(out, chars, size);
+}
+
+void write_json_char(json_output *out, char c)
+{
+    char *dst = reserve_json_output(out, 1);
+    if(!dst) return;
+    *dst = c;
+    out->size += 1;
+}
+
+// A newline then num_spaces spaces
+void write_json_newline(json_output *out, u64 num_spaces)
+{
+    u64 n = 1 + num_spaces;
+    while(n > 0)
+    {
+        u64 run = (n < JSON_OUTPUT_MIN_BUFFER_SIZE) ? n : JSON_OUTPUT_MIN_BUFFER_SIZE;
+        char *dst = reserve_json_output(out, run);
+        if(!dst) return;
+        memset(dst, ' ', run);
+        if(n == 1 + num_spaces) dst[0] = '\n';
+        out->size += run;
+        n -= run;
+    }
+}
+
+// ============================== Formatting ===================================
+
+// Kernels formatting numbers and strings straight into an output's buffer. Integers are written
+// two digits at a time. Doubles are written as the shortest decimal which reads back as the same
+// double, found with Schubfach (Giulietti) using the same 128 bit powers of five as reading them.
+// Strings are escaped a vector at a time, copying runs without anything to escape in one go.
+
+const char json_digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// 10^i, but 0 for i = 0 so 0 has a digit
+const u64 json_digit_thresholds[] =
+{
+    0,                  10,                  100,                  1000,
+    10000,              100000,              1000000,              10000000,
+    100000000,          1000000000,          10000000000,          100000000000,
+    1000000000000,      10000000000000,      100000000000000,      1000000000000000,
+    10000000000000000,  100000000000000000,  1000000000000000000,  10000000000000000000u,
+};
+
+u32 count_json_digits(u64 x)
+{
+    u32 guess = ((64 - json_clz64(x | 1)) * 1233) >> 12; // floor(log10(2^bits)), one short at most
+    return guess + (x >= json_digit_thresholds[guess]);
+}
+
+// Writes x's digits (up to 20) at dst, returning how many
+u32 format_json_u64(char *dst, u64 x)
+{
+    u32 num_digits = count_json_digits(x);
+    char *c = dst + num_digits;
+    while(x >= 100)
+    {
+        c -= 2;
+        memcpy(c, json_digit_pairs + 2*(x % 100), 2);
+        x /= 100;
+    }
+    if(x >= 10) memcpy(c - 2, json_digit_pairs + 2*x, 2);
+    else        c[-1] = (char)('0' + x);
+    return num_digits;
+}
+
+// Up to 20 chars
+u32 format_json_s64(char *dst, s64 x)
+{
+    if(x >= 0) return format_json_u64(dst, (u64)x);
+    dst[0] = '-';
+    return 1 + format_json_u64(dst + 1, (u64)0 - (u64)x);
+}
+
+// digits * 10^exponent
+typedef struct
+{
+    u64 digits;
+    s32 exponent;
+} json_decimal;
+
+// 10^-k scaled to 126 bits and rounded up, as 63 bit halves. It's the table's 5^-k shifted down
+// two bits, which is truncated but for -k in -27..-1.
+json_u128 get_json_power_of_ten_126(s32 k)
+{
+    s32 q  = -k;
+    u64 hi = json_power_of_five_128[2*(q - JSON_SMALLEST_POWER_OF_FIVE)];
+    u64 lo = json_power_of_five_128[2*(q - JSON_SMALLEST_POWER_OF_FIVE) + 1];
+    if(q >= -27 && q < 0)
+    {
+        if(lo == 0) hi -= 1;
+        lo -= 1;
+    }
+    lo  = (lo >> 2) | (hi << 62);
+    hi >>= 2;
+    lo += 1;
+    if(lo == 0) hi += 1;
+
+    json_u128 g;
+    g.hi = (hi << 1) | (lo >> 63);
+    g.lo = lo & 0x7FFFFFFFFFFFFFFF;
+    return g;
+}
+
+// cp * g / 2^127, with its lowest bit set if it wasn't exact (rounded to odd)
+u64 json_round_to_odd(json_u128 g, u64 cp)
+{
+    u64       x1 = json_mul_64(g.lo, cp).hi;
+    json_u128 y  = json_mul_64(g.hi, cp);
+    u64 z = (y.lo >> 1) + x1;
+    u64 v = y.hi + (z >> 63);
+    return v | (((z & 0x7FFFFFFFFFFFFFFF) + 0x7FFFFFFFFFFFFFFF) >> 63);
+}
+
+// Of the decimals which read back as v (finite, not zero), the one with fewest digits and of those,
+// the closest. Trailing zeros aren't stripped.
+json_decimal compute_json_shortest_decimal(f64 v)
+{
+    u64 bits;
+    memcpy(&bits, &v, sizeof(f64));
+    u64 fraction = bits & 0xFFFFFFFFFFFFF;
+    s32 biased_exponent = (s32)((bits >> 52) & 0x7FF);
+
+    // v = c * 2^q
+    u64 c;
+    s32 q;
+    if(biased_exponent != 0)
+    {
+        c = ((u64)1 << 52) | fraction;
+        q = biased_exponent - 1075;
+        if(q < 0 && q > -53)
+        {
+            // Integers are exact
+            u64 integer = c >> -q;
+            if(integer << -q == c) return (json_decimal){integer, 0};
+        }
+    }
+    else
+    {
+        c = fraction;
+        q = -1074;
+    }
+
+    // The doubles either side are halfway to c - 1 and c + 1, all four times bigger here. At powers
+    // of two the one below is half as far. k is floor(log10(2^q)), or of 3/4 * 2^q then.
+    u64 out = c & 1;
+    u64 cb  = c << 2;
+    u64 cbr = cb + 2;
+    u64 cbl;
+    s32 k;
+    if(c != ((u64)1 << 52) || q == -1074)
+    {
+        cbl = cb - 2;
+        k   = (s32)(((s64)q * 661971961083) >> 41);
+    }
+    else
+    {
+        cbl = cb - 1;
+        k   = (s32)(((s64)q * 661971961083 - 274743187321) >> 41);
+    }
+    s32 h = q + (s32)(((s64)-k * 913124641741) >> 38) + 2;
+
+    // Scaled by 10^-k, the decimals in range are the integers between vbl and vbr
+    json_u128 g = get_json_power_of_ten_126(k);
+    u64 vb  = json_round_to_odd(g, cb << h);
+    u64 vbl = json_round_to_odd(g, cbl << h);
+    u64 vbr = json_round_to_odd(g, cbr << h);
+
+    // One fewer digit if a multiple of 10 is in range
+    u64 s    = vb >> 2;
+    u64 sp10 = 10 * (s / 10);
+    u64 tp10 = sp10 + 10;
+    u8 upin = vbl + out <= (sp10 << 2);
+    u8 wpin = (tp10 << 2) + out <= vbr;
+    if(upin != wpin) return (json_decimal){upin ? sp10 : tp10, k};
+
+    // Otherwise s or s + 1, whichever's in range, or closer if both are, or even if they're as close
+    u64 t = s + 1;
+    u8 uin = vbl + out <= (s << 2);
+    u8 win = (t << 2) + out <= vbr;
+    if(uin != win) return (json_decimal){uin ? s : t, k};
+    s64 cmp = (s64)(vb - ((s + t) << 1));
+    return (json_decimal){(cmp < 0 || (cmp == 0 && (s & 1) == 0)) ? s : t, k};
+}
+
+#define JSON_MAX_F64_CHARS 32
+
+// Writes v at dst as the shortest decimal which reads back as v, returning how many chars (up to
+// JSON_MAX_F64_CHARS). Integral values keep a ".0" so they read back as JSON_NUMBER rather than
+// an integer. Infinities and NaN aren't JSON, they're written as null.
+u32 format_json_f64(char *dst, f64 v)
+{
+    u64 bits;
+    memcpy(&bits, &v, sizeof(f64));
+    if(((bits >> 52) & 0x7FF) == 0x7FF)
+    {
+        memcpy(dst, "null", 4);
+        return 4;
+    }
+
+    char *c = dst;
+    if(bits >> 63) *c++ = '-';
+    if((bits << 1) == 0)
+    {
+        memcpy(c, "0.0", 3);
+        return (u32)(c + 3 - dst);
+    }
+
+    json_decimal decimal = compute_json_shortest_decimal(v);
+    while(decimal.digits % 10 == 0)
+    {
+        decimal.digits   /= 10;
+        decimal.exponent += 1;
+    }
+    char digits[20];
+    s32 num_digits = (s32)format_json_u64(digits, decimal.digits);
+    s32 point      = num_digits + decimal.exponent; // Digits before the decimal point
+
+    if(point > 0 && point <= 21)
+    {
+        if(decimal.exponent >= 0)
+        {
+            memcpy(c, digits, num_digits);
+            memset(c + num_digits, '0', decimal.exponent);
+            c += point;
+            memcpy(c, ".0", 2);
+            c += 2;
+        }
+        else
+        {
+            memcpy(c, digits, point);
+            c[point] = '.';
+            memcpy(c + point + 1, digits + point, num_digits - point);
+            c += num_digits + 1;
+        }
+    }
+    else if(point <= 0 && point > -6)
+    {
+        memcpy(c, "0.", 2);
+        memset(c + 2, '0', -point);
+        c += 2 - point;
+        memcpy(c, digits, num_digits);
+        c += num_digits;
+    }
+    else
+    {
+        *c++ = digits[0];
+        if(num_digits > 1)
+        {
+            *c++ = '.';
+            memcpy(c, digits + 1, num_digits - 1);
+            c += num_digits - 1;
+        }
+        *c++ = 'e';
+        c += format_json_s64(c, point - 1);
+    }
+    return (u32)(c - dst);
+}
+
+void write_json_u64(json_output *out, u64 x)
+{
+    char *dst = reserve_json_output(out, 20);
+    if(dst) out->size += format_json_u64(dst, x);
+}
+
+void write_json_s64(json_output *out, s64 x)
+{
+    char *dst = reserve_json_output(out, 20);
+    if(dst) out->size += format_json_s64(dst, x);
+}
+
+void write_json_f64(json_output *out, f64 v)
+{
+    char *dst = reserve_json_output(out, JSON_MAX_F64_CHARS);
+    if(dst) out->size += format_json_f64(dst, v);
+}
+
+void write_json_bool(json_output *out, u8 boolean)
+{
+    if(boolean) write_json_chars(out, "true", 4);
+    else        write_json_chars(out, "false", 5);
+}
+
+void write_json_null(json_output *out)
+{
+    write_json_chars(out, "null", 4);
+}
+
+// What each byte's escaped as after a backslash, 0 if it isn't. 'u' is \u00XX.
+const char json_escapes[256] =
+{
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    ['"'] = '"', ['\\'] = '\\',
+};
+
+#if defined(JSON_SIMD_AVX2)
+
+// Bit per byte which has to be escaped: a quote, backslash or control character
+u32 json_string_escape_mask(const char *chars)
+{
+    __m256i v         = _mm256_loadu_si256((const __m256i*)chars);
+    __m256i quote     = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'));
+    __m256i backslash = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'));
+    __m256i control   = _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(0x1F)), _mm256_set1_epi8(0x1F));
+    return (u32)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(quote, backslash), control));
+}
+
+#elif defined(JSON_SIMD_SSE)
+
+// Bit per byte which has to be escaped: a quote, backslash or control character
+u32 json_string_escape_mask(const char *chars)
+{
+    __m128i v         = _mm_loadu_si128((const __m128i*)chars);
+    __m128i quote     = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+    __m128i backslash = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+    __m128i control   = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1F)), _mm_set1_epi8(0x1F));
+    return (u32)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(quote, backslash), control));
+}
+
+#endif
+
+// Writes a string's contents escaped, without quotes. UTF-8 is written as it is.
+void write_json_string_chars(json_output *out, const char *chars, u64 size)
+{
+    const char *end = chars + size;
+    const char *run = chars; // Start of the chars not written yet
+    const char *c   = chars;
+    for(;;)
+    {
+#if defined(JSON_STRING_VECTOR_SIZE)
+        while(end - c >= JSON_STRING_VECTOR_SIZE)
+        {
+            u32 mask = json_string_escape_mask(c);
+            if(mask)
+            {
+                c += json_ctz64(mask);
+                break;
+            }
+            c += JSON_STRING_VECTOR_SIZE;
+        }
+#endif
+        while(c < end && !json_escapes[(unsigned char)*c]) c += 1;
+        if(c == end) break;
+
+        write_json_chars(out, run, c - run);
+        char *dst = reserve_json_output(out, 6);
+        if(!dst) return;
+        unsigned char escaped = *c;
+        dst[0] = '\\';
+        dst[1] = json_escapes[escaped];
+        if(dst[1] == 'u')
+        {
+            dst[2] = '0';
+            dst[3] = '0';
+            dst[4] = "0123456789abcdef"[escaped >> 4];
+            dst[5] = "0123456789abcdef"[escaped & 0xF];
+            out->size += 6;
+        }
+        else out->size += 2;
+        c  += 1;
+        run = c;
+    }
+    write_json_chars(out, run, c - run);
+}
+
+// Strings which fit in the buffer are copied as they're scanned, so ones with nothing to escape
+// (most ASCII ones) take one pass
+void write_json_string(json_output *out, const char *chars, u64 size)
+{
+    if(out->size + size + 2 <= out->limit)
+    {
+        char *dst = out->buffer + out->size;
+        dst[0] = '"';
+        dst   += 1;
+        u64 i = 0;
+#if defined(JSON_STRING_VECTOR_SIZE)
+        for(; i + JSON_STRING_VECTOR_SIZE <= size; i += JSON_STRING_VECTOR_SIZE)
+        {
+            if(json_string_escape_mask(chars + i)) break;
+            copy_json_string_vector(dst + i, chars + i);
+        }
+#endif
+        for(; i < size && !json_escapes[(unsigned char)chars[i]]; i += 1) dst[i] = chars[i];
+        if(i == size)
+        {
+            dst[size]  = '"';
+            out->size += size + 2;
+            return;
+        }
+        out->size += 1 + i;
+        write_json_string_chars(out, chars + i, size - i);
+        write_json_char(out, '"');
+        return;
+    }
+
+    write_json_char(out, '"');
+    write_json_string_chars(out, chars, size);
+    write_json_char(out, '"');
+}
+
+// ============================== Print parsed JSON ===================================
+
+void write_json_scalar(json_output *out, json_value *value)
+{
+    switch(value->type)
+    {
+        case JSON_NUMBER: write_json_f64(out, value->number);                          break;
+        case JSON_INT64:  write_json_s64(out, value->int64);                           break;
+        case JSON_UINT64: write_json_u64(out, value->uint64);                          break;
+        case JSON_STRING: write_json_string(out, value->string.chars, value->string.size); break;
+        case JSON_BOOL:   write_json_bool(out, value->boolean);                        break;
+        default:          write_json_null(out);                                        break;
+    }
+}
+
+// Writes the object or array at ooa_index. With indent 0 it's minified, otherwise each value in it
+// is on its own line, its values values_column spaces in and its close close_column spaces in.
+// Values of ooas nested in it are indent spaces further in than the line they opened on.
+void write_json_ooa_at_columns(json_output *out, json_size ooa_index, json_parsed *parsed_json, u32 indent, u32 values_column, u32 close_column)
+{
+    // Nesting's as deep as the parse allowed, so it's walked with a stack like parsing is. Only
+    // documents deeper than the local levels allocate.
+    json_open_level  local_levels[64];
+    json_open_level *levels     = local_levels;
+    u32              levels_cap = 64;
+    u32              depth      = 1;
+    json_type        type       = get_json_ooa_addr(parsed_json, ooa_index)->type;
+    levels[0] = (json_open_level){.type = type, .ooa = ooa_index, .num_values = 0};
+    write_json_char(out, (type == JSON_OBJECT) ? '{' : '[');
+
+    while(depth > 0 && !out->failed)
+    {
+        json_open_level *level = &levels[depth-1];
+        json_ooa        *ooa   = get_json_ooa_addr(parsed_json, level->ooa);
+        if(level->num_values == ooa->size)
+        {
+            if(indent > 0 && ooa->size > 0) write_json_newline(out, (depth == 1) ? close_column : values_column + (u64)indent * (depth - 2));
+            write_json_char(out, (level->type == JSON_OBJECT) ? '}' : ']');
+            depth -= 1;
+            continue;
+        }
+
+        if(level->num_values > 0) write_json_char(out, ',');
+        if(indent > 0)            write_json_newline(out, values_column + (u64)indent * (depth - 1));
+        if(level->type == JSON_OBJECT)
+        {
+            json_string *key = get_json_key_addr(parsed_json, ooa->keys_index + level->num_values);
+            write_json_string(out, key->chars, key->size);
+            write_json_char(out, ':');
+        }
+        json_value value = load_parsed_json_value(parsed_json, ooa->vals_index + level->num_values);
+        level->num_values += 1;
+
+        if(value.type != JSON_OBJECT && value.type != JSON_ARRAY)
+        {
+            write_json_scalar(out, &value);
+            continue;
+        }
+        if(depth == levels_cap)
+        {
+            json_open_level *more = (json_open_level*)json_alloc(&out->allocator, 2 * levels_cap * sizeof(json_open_level));
+            if(!more)
+            {
+                fail_json_output(out, "Couldn't allocate the nesting stack");
+                break;
+            }
+            memcpy(more, levels, levels_cap * sizeof(json_open_level));
+            if(levels != local_levels) json_dealloc(&out->allocator, levels);
+            levels      = more;
+            levels_cap *= 2;
+        }
+        levels[depth] = (json_open_level){.type = value.type, .ooa = value.ooa, .num_values = 0};
+        depth += 1;
+        write_json_char(out, (value.type == JSON_OBJECT) ? '{' : '[');
+    }
+    if(levels != local_levels) json_dealloc(&out->allocator, levels);
+}
+
+// Values indented indent spaces more than the line the ooa opened on, column spaces in
+void write_json_ooa_indented(json_output *out, json_size ooa_index, json_parsed *parsed_json, u32 indent, u32 column)
+{
+    write_json_ooa_at_columns(out, ooa_index, parsed_json, indent, column + indent, column);
+}
+
+void write_json_value_indented(json_output *out, json_size value_index, json_parsed *parsed_json, u32 indent, u32 column)
+{
+    json_value value = load_parsed_json_value(parsed_json, value_index);
+    if(value.type == JSON_OBJECT || value.type == JSON_ARRAY) write_json_ooa_indented(out, value.ooa, parsed_json, indent, column);
+    else                                                      write_json_scalar(out, &value);
+}
+
+// Writes the value at value_index: minified with indent 0, or pretty printed indent spaces a level
+void write_json_value(json_output *out, json_size value_index, json_parsed *parsed_json, u32 indent)
+{
+    write_json_value_indented(out, value_index, parsed_json, indent, 0);
+}
+
+// Writes the whole document, see write_json_value
+void write_parsed_json(json_output *out, json_parsed *parsed_json, u32 indent)
+{
+    write_json_ooa_indented(out, 1, parsed_json, indent, 0); // Root object
+}
+
+// Prints are written to a buffer and given to stdio in one go rather than a printf a token. Their
+// indents and columns count pairs of spaces.
+void print_json_output(json_output *out)
+{
+    fwrite(out->buffer, 1, out->size, stdout);
+    dealloc_json_output(out);
+}
+
+void print_json_value_formatted(json_size value_index, json_parsed *parsed_json, u32 indent)
+{
+    json_output out = init_json_output(&parsed_json->allocator);
+    write_json_value_indented(&out, value_index, parsed_json, 4, 2*indent);
+    print_json_output(&out);
+}
+
+void print_json_array_formatted(json_size array_index, json_parsed *parsed_json, u32 start_column, u32 indent)
+{
+    json_output out = init_json_output(&parsed_json->allocator);
+    write_json_ooa_at_columns(&out, array_index, parsed_json, 4, 2*indent, 2*start_column);
+    print_json_output(&out);
+}
+
+void print_json_object_formatted(json_size object_index, json_parsed *parsed_json, u32 start_column, u32 indent)
+{
+    json_output out = init_json_output(&parsed_json->allocator);
+    write_json_ooa_at_columns(&out, object_index, parsed_json, 4, 2*indent, 2*start_column);
+    print_json_output(&out);
+}
+
+void print_json_parsed(json_parsed *parsed_json)
+{
+    printf("PARSED\n");
+    print_json_object_formatted(1, parsed_json, 0, 2);
+    printf("\n");
+}
+
+void print_json_key(json_size key_index, json_parsed *parsed_json)
+{
+    json_string *key = get_json_key_addr(parsed_json, key_index);
+    print_json_string(*key);
+}
+
+void print_json_value(json_size value_index, json_parsed *parsed_json)
+{
+    json_value value = load_parsed_json_value(parsed_json, value_index);
+    printf("("); print_json_value_type_string(&value); printf(")");
+    print_json_value_contents(&value);
+}
+
+// Results in a parser only have a file of their own, their buffers are the parser's
+void dealloc_parsed_json(json_parsed parsed_json)
+{
+    if(!parsed_json.in_parser && !parsed_json.in_snapshot)
+    {
+        json_dealloc(&parsed_json.allocator, parsed_json.free_mem_base);
+        if(parsed_json.ooa_list.ooas)     json_dealloc(&parsed_json.allocator, parsed_json.ooa_list.ooas);
+        if(parsed_json.hash_arena.buffer) json_dealloc(&parsed_json.allocator, parsed_json.hash_arena.buffer);
+    }
+    if(parsed_json.file.base) unmap_json_file(&parsed_json.file, &parsed_json.allocator);
+}
+
+// ============================== Writer ===================================
+
+// Streams JSON out a call at a time, without building a json_parsed first. Values go through the
+// same kernels as write_parsed_json into a json_output, so how much memory it takes is up to the
+// output: a growable buffer, or a fixed one handed to a write function or fd as it fills. The
+// writer's own state is fixed size, a bit per open object or array.
+//
+//     json_writer writer = init_json_writer(&out, 0);
+//     begin_json_object(&writer);
+//     write_json_key(&writer, "ids", 3);
+//     begin_json_array(&writer);
+//     write_json_int_value(&writer, 1);
+//     end_json_array(&writer);
+//     end_json_object(&writer);
+//     finish_json_writer(&writer);
+//
+// Calls out of place (a value where a key should be, ending the wrong one, nesting past
+// JSON_MAX_DEPTH) fail and write nothing from then on. Each root value after the first starts on
+// a new line, so a writer can stream NDJSON.
+
+typedef struct
+{
+    json_output *out;
+    u32          indent;      // Spaces a level, 0 for minified
+    u32          depth;       // Objects and arrays open
+    u8           first;       // Nothing's been written in the innermost one yet
+    u8           after_key;   // The innermost object's had a key but not its value
+    u8           has_root;    // A root value's been started
+    u8           flush_roots; // Flush the output as each root value's finished
+    u8           failed;
+    u64          objects[(JSON_MAX_DEPTH + 63) / 64]; // Bit per depth, set for objects, clear for arrays
+} json_writer;
+
+// Writes into out, which the caller inits, flushes and deallocs
+json_writer init_json_writer(json_output *out, u32 indent)
+{
+    json_writer writer = {0};
+    writer.out    = out;
+    writer.indent = indent;
+    return writer;
+}
+
+// On stderr like output errors, so they aren't spliced into JSON written to stdout
+u8 fail_json_writer(json_writer *writer, const char *reason)
+{
+    if(!writer->failed) fprintf(stderr, "Writer error: %s\n", reason);
+    writer->failed = 1;
+    return 0;
+}
+
+u8 is_json_writer_in_object(json_writer *writer)
+{
+    u32 level = writer->depth - 1;
+    return (writer->objects[level / 64] >> (level % 64)) & 1;
+}
+
+// Comma and indent before a key, or an array's or the root's value. Checks a value can go here.
+u8 begin_json_writer_value(json_writer *writer)
+{
+    if(writer->failed || writer->out->failed) return 0;
+    if(writer->depth == 0)
+    {
+        if(writer->has_root) write_json_char(writer->out, '\n');
+        writer->has_root = 1;
+        return 1;
+    }
+    if(is_json_writer_in_object(writer))
+    {
+        if(!writer->after_key) return fail_json_writer(writer, "Values in objects need a key first");
+        writer->after_key = 0;
+        return 1;
+    }
+    if(!writer->first)      write_json_char(writer->out, ',');
+    if(writer->indent > 0)  write_json_newline(writer->out, (u64)writer->indent * writer->depth);
+    writer->first = 0;
+    return 1;
+}
+
+// After each value. Finishing a root value flushes with flush_roots.
+u8 end_json_writer_value(json_writer *writer)
+{
+    if(writer->depth == 0 && writer->flush_roots) return flush_json_output(writer->out);
+    return !writer->out->failed;
+}
+
+u8 write_json_key(json_writer *writer, const char *chars, u64 size)
+{
+    if(writer->failed || writer->out->failed) return 0;
+    if(writer->depth == 0 || !is_json_writer_in_object(writer)) return fail_json_writer(writer, "Keys only go in objects");
+    if(writer->after_key)                                        return fail_json_writer(writer, "Key written after a key");
+    if(!writer->first)     write_json_char(writer->out, ',');
+    if(writer->indent > 0) write_json_newline(writer->out, (u64)writer->indent * writer->depth);
+    write_json_string(writer->out, chars, size);
+    write_json_char(writer->out, ':');
+    writer->first     = 0;
+    writer->after_key = 1;
+    return !writer->out->failed;
+}
+
+u8 begin_json_ooa(json_writer *writer, json_type type)
+{
+    if(!begin_json_writer_value(writer)) return 0;
+    if(writer->depth == JSON_MAX_DEPTH) return fail_json_writer(writer, "Objects and arrays are nested more than JSON_MAX_DEPTH deep");
+
+    u32 level = writer->depth;
+    u64 bit   = (u64)1 << (level % 64);
+    if(type == JSON_OBJECT) writer->objects[level / 64] |= bit;
+    else                    writer->objects[level / 64] &= ~bit;
+    writer->depth += 1;
+    writer->first  = 1;
+    write_json_char(writer->out, (type == JSON_OBJECT) ? '{' : '[');
+    return !writer->out->failed;
+}
+
+u8 end_json_ooa(json_writer *writer, json_type type)
+{
+    if(writer->failed || writer->out->failed) return 0;
+    if(writer->depth == 0 || is_json_writer_in_object(writer) != (type == JSON_OBJECT))
+    {
+        return fail_json_writer(writer, (type == JSON_OBJECT) ? "No object to end" : "No array to end");
+    }
+    if(writer->after_key) return fail_json_writer(writer, "Object ended after a key without its value");
+
+    writer->depth -= 1;
+    if(writer->indent > 0 && !writer->first) write_json_newline(writer->out, (u64)writer->indent * writer->depth);
+    writer->first = 0;
+    write_json_char(writer->out, (type == JSON_OBJECT) ? '}' : ']');
+    return end_json_writer_value(writer);
+}
+
+u8 begin_json_object(json_writer *writer) { return begin_json_ooa(writer, JSON_OBJECT); }
+u8 end_json_object(json_writer *writer)   { return end_json_ooa(writer, JSON_OBJECT);   }
+u8 begin_json_array(json_writer *writer)  { return begin_json_ooa(writer, JSON_ARRAY);  }
+u8 end_json_array(json_writer *writer)    { return end_json_ooa(writer, JSON_ARRAY);    }
+
+u8 write_json_string_value(json_writer *writer, const char *chars, u64 size)
+{
+    if(!begin_json_writer_value(writer)) return 0;
+    write_json_string(writer->out, chars, size);
+    return end_json_writer_value(writer);
+}
+
+// See format_json_f64, infinities and NaN are written as null
+u8 write_json_number_value(json_writer *writer, f64 number)
+{
+    if(!begin_json_writer_value(writer)) return 0;
+    write_json_f64(writer->out, number);
+    return end_json_writer_value(writer);
+}
+
+u8 write_json_int_value(json_writer *writer, s64 number)
+{
+    if(!begin_json_writer_value(writer)) return 0;
+    write_json_s64(writer->out, number);
+    return end_json_writer_value(writer);
+}
+
+u8 write_json_uint_value(json_writer *writer, u64 number)
+{
+    if(!begin_json_writer_value(writer)) return 0;
+    write_json_u64(writer->out, number);
+    return end_json_writer_value(writer);
+}
+
+u8 write_json_bool_value(json_writer *writer, u8 boolean)
+{
+    if(!begin_json_writer_value(writer)) return 0;
+    write_json_bool(writer->out, boolean);
+    return end_json_writer_value(writer);
+}
+
+u8 write_json_null_value(json_writer *writer)
+{
+    if(!begin_json_writer_value(writer)) return 0;
+    write_json_null(writer->out);
+    return end_json_writer_value(writer);
+}
+
+// JSON the caller's already serialised, written as it is
+u8 write_json_raw_value(json_writer *writer, const char *chars, u64 size)
+{
+    if(!begin_json_writer_value(writer)) return 0;
+    write_json_chars(writer->out, chars, size);
+    return end_json_writer_value(writer);
+}
+
+// A value from a parse, objects and arrays with everything in them
+u8 write_json_parsed_value(json_writer *writer, json_size value_index, json_parsed *parsed_json)
+{
+    if(!begin_json_writer_value(writer)) return 0;
+    write_json_value_indented(writer->out, value_index, parsed_json, writer->indent, writer->indent * writer->depth);
+    return end_json_writer_value(writer);
+}
+
+// Flushes the output. Returns 0 if anything's still open or anything failed.
+u8 finish_json_writer(json_writer *writer)
+{
+    if(!writer->failed && writer->depth > 0) fail_json_writer(writer, "Objects or arrays left open");
+    u8 flushed = flush_json_output(writer->out);
+    return flushed && !writer->failed;
+}
+
+// ============================== Snapshots ===================================
+
+// A json_parsed is indices into its arenas but for its strings' chars pointers, so it's saved as an
+// image of the arenas with those pointers made as if the image were at JSON_SNAPSHOT_BASE. It's
+// mapped there when it can be, and then loading is reading its header, with nothing patched or
+// copied and pages shared with other processes loading it. Mapped anywhere else, the pointers are
+// moved by how far it is from there, one pass over the keys and string values. Strings whose chars
+// aren't in chars_arena (JSON_PARSE_ZERO_COPY ones point into src) have them copied in after
+// chars_arena's. Images are only loaded by builds with the same JSON_64BIT_OFFSETS,
+// JSON_COMPACT_VALUES and pointer size, on machines of the same byte order.
+
+#ifndef JSON_SNAPSHOT_BASE
+#define JSON_SNAPSHOT_BASE ((sizeof(void*) == 8) ? 0x3A0000000000ull : 0x60000000ull)
+#endif
+
+#define JSON_SNAPSHOT_MAGIC   0x4E534A50u // "PJSN" in little endian
+#define JSON_SNAPSHOT_VERSION 1
+#define JSON_SNAPSHOT_ALIGN   64
+
+typedef struct
+{
+    u64 at;     // Offset into the image
+    u64 allocd; // Bytes
+    u64 allocs;
+} json_snapshot_section;
+
+typedef struct
+{
+    u32 magic;
+    u32 version;
+    u32 layout; // get_json_snapshot_layout of the build which saved it
+    u32 unused;
+    u64 base;   // Where the image's chars pointers are right for
+    u64 image_size;
+    json_snapshot_section ooas; // allocs is ooa_list.size
+    json_snapshot_section keys;
+    json_snapshot_section values;
+    json_snapshot_section hashes;
+    json_snapshot_section chars; // Last, since what's copied in goes after chars_arena's
+} json_snapshot_header;
+
+u32 get_json_snapshot_layout()
+{
+    return (u32)sizeof(json_size) | (u32)sizeof(json_stored_value) << 8 | (u32)sizeof(json_ooa) << 16 | (u32)sizeof(void*) << 24;
+}
+
+u64 align_json_snapshot_offset(u64 offset)
+{
+    return (offset + JSON_SNAPSHOT_ALIGN - 1) & ~(u64)(JSON_SNAPSHOT_ALIGN - 1);
+}
+
+// Offset of the string's chars in the image's chars. Ones outside chars_arena are copied in at
+// num_chars, or just counted if chars is NULL.
+u64 get_json_snapshot_chars_offset(json_parsed *parsed_json, json_string *string, char *chars, u64 *num_chars)
+{
+    const char *arena_chars = (const char*)parsed_json->chars_arena.buffer;
+    if(arena_chars && string->chars >= arena_chars && string->chars + string->size <= arena_chars + parsed_json->chars_arena.allocd)
+    {
+        return (u64)(string->chars - arena_chars);
+    }
+    u64 offset = *num_chars;
+    if(chars) memcpy(chars + offset, string->chars, string->size);
+    *num_chars += string->size;
+    return offset;
+}
+
+// Points the chars of the keys and string values copied into image where they'll be with the image
+// at its base, copying in chars from outside chars_arena. Without an image it returns how many chars
+// the image needs, and writes nothing.
+u64 relocate_json_snapshot_strings(json_parsed *parsed_json, u8 *image, json_snapshot_header *header)
+{
+    u64   num_chars   = parsed_json->chars_arena.allocd;
+    char *chars       = image ? (char*)(image + header->chars.at) : NULL;
+    u64   saved_chars = header->base + header->chars.at;
+
+    json_string *keys = (json_string*)parsed_json->keys_arena.buffer;
+    for(u64 i = 0; i < parsed_json->keys_arena.allocd / sizeof(json_string); i += 1)
+    {
+        if(!keys[i].chars) continue;
+        u64 offset = get_json_snapshot_chars_offset(parsed_json, &keys[i], chars, &num_chars);
+        if(image) ((json_string*)(image + header->keys.at))[i].chars = (char*)(uintptr_t)(saved_chars + offset);
+    }
+
+    json_stored_value *values = (json_stored_value*)parsed_json->values_arena.buffer;
+    for(u64 i = 0; i < parsed_json->values_arena.allocd / sizeof(json_stored_value); i += 1)
+    {
+#ifdef JSON_COMPACT_VALUES
+        // Boxed strings are in chars_arena, so they're moved in the image's copy of it
+        if((values[i] & JSON_BOXED) != JSON_BOXED || ((values[i] >> 48) & 7) != JSON_BOX_STRING) continue;
+        u64 at = values[i] & JSON_BOX_PAYLOAD;
+        json_string string;
+        memcpy(&string, (char*)parsed_json->chars_arena.buffer + at, sizeof(json_string));
+        if(!string.chars) continue;
+        u64 offset = get_json_snapshot_chars_offset(parsed_json, &string, chars, &num_chars);
+        if(image)
+        {
+            string.chars = (char*)(uintptr_t)(saved_chars + offset);
+            memcpy(chars + at, &string, sizeof(json_string));
+        }
+#else
+        if(values[i].type != JSON_STRING || !values[i].string.chars) continue;
+        u64 offset = get_json_snapshot_chars_offset(parsed_json, &values[i].string, chars, &num_chars);
+        if(image) ((json_stored_value*)(image + header->values.at))[i].string.chars = (char*)(uintptr_t)(saved_chars + offset);
+#endif
+    }
+    return num_chars;
+}
+
+json_snapshot_header layout_json_snapshot(json_parsed *parsed_json)
+{
+    json_snapshot_header header = {.magic = JSON_SNAPSHOT_MAGIC, .version = JSON_SNAPSHOT_VERSION, .layout = get_json_snapshot_layout(), .base = JSON_SNAPSHOT_BASE};
+    json_snapshot_section *sections[] = {&header.ooas, &header.keys, &header.values, &header.hashes, &header.chars};
+    json_mem_arena        *arenas[]   = {NULL, &parsed_json->keys_arena, &parsed_json->values_arena, &parsed_json->hash_arena, &parsed_json->chars_arena};
+
+    header.ooas.allocs  = parsed_json->ooa_list.size;
+    header.ooas.allocd  = (u64)parsed_json->ooa_list.size * sizeof(json_ooa);
+    header.chars.allocd = relocate_json_snapshot_strings(parsed_json, NULL, &header);
+    u64 at = align_json_snapshot_offset(sizeof(json_snapshot_header));
+    for(u32 i = 0; i < 5; i += 1)
+    {
+        if(arenas[i])
+        {
+            sections[i]->allocs = arenas[i]->allocs;
+            if(arenas[i] != &parsed_json->chars_arena) sections[i]->allocd = arenas[i]->allocd;
+        }
+        sections[i]->at = at;
+        at = align_json_snapshot_offset(at + sections[i]->allocd);
+    }
+    header.image_size = at;
+    return header;
+}
+
+u64 get_parsed_json_snapshot_size(json_parsed *parsed_json)
+{
+    return layout_json_snapshot(parsed_json).image_size;
+}
+
+// Ooas and values are written a field at a time into the zeroed image rather than copied, so their
+// padding and a value's unused union bytes are saved as 0 rather than whatever the arenas held
+void write_json_snapshot_ooas(json_parsed *parsed_json, json_ooa *ooas)
+{
+    for(json_size i = 0; i < parsed_json->ooa_list.size; i += 1)
+    {
+        json_ooa *ooa = &parsed_json->ooa_list.ooas[i];
+        ooas[i].type       = ooa->type;
+        ooas[i].size       = ooa->size;
+        ooas[i].vals_index = ooa->vals_index;
+        ooas[i].keys_index = ooa->keys_index;
+        ooas[i].hash_index = ooa->hash_index;
+        ooas[i].shape      = ooa->shape;
+    }
 }
 
-// Gets last consumed token
-json_token *current_token(json_tokenised *token_src)
+void write_json_snapshot_values(json_parsed *parsed_json, json_stored_value *values)
 {
-    // Assume no one is calling at the start of a token array
-    u32 token_index = token_src->token_index - 1;
-    json_token *token = &token_src->tokens[token_index];
-    return token;
+    json_stored_value *src = (json_stored_value*)parsed_json->values_arena.buffer;
+    for(u64 i = 0; i < parsed_json->values_arena.allocd / sizeof(json_stored_value); i += 1)
+    {
+#ifdef JSON_COMPACT_VALUES
+        values[i] = src[i]; // Boxes have no padding
+#else
+        values[i].type = src[i].type;
+        switch(src[i].type)
+        {
+            case JSON_NUMBER: values[i].number  = src[i].number;  break;
+            case JSON_INT64:  values[i].int64   = src[i].int64;   break;
+            case JSON_UINT64: values[i].uint64  = src[i].uint64;  break;
+            case JSON_BOOL:   values[i].boolean = src[i].boolean; break;
+            case JSON_STRING: values[i].string  = src[i].string;  break;
+            case JSON_OBJECT:
+            case JSON_ARRAY:
+            case JSON_DOESNT_EXIST: values[i].ooa = src[i].ooa; break;
+            default: break;
+        }
+#endif
+    }
 }
 
-json_token *next_token(json_tokenised *token_src)
+// Writes the snapshot into image, which has to be get_parsed_json_snapshot_size bytes. Returns its size.
+u64 write_parsed_json_snapshot(json_parsed *parsed_json, void *image)
 {
-    json_token *token = &token_src->tokens[token_src->token_index];
-    token_src->token_index += 1;
-    return token;
+    json_snapshot_header header = layout_json_snapshot(parsed_json);
+    u8 *dst = (u8*)image;
+    memset(dst, 0, header.image_size); // Alignment padding too, so the same DOM saves the same bytes
+    memcpy(dst, &header, sizeof(header));
+    write_json_snapshot_ooas(parsed_json, (json_ooa*)(dst + header.ooas.at));
+    if(header.keys.allocd)   memcpy(dst + header.keys.at,   parsed_json->keys_arena.buffer,   header.keys.allocd);
+    write_json_snapshot_values(parsed_json, (json_stored_value*)(dst + header.values.at));
+    if(header.hashes.allocd) memcpy(dst + header.hashes.at, parsed_json->hash_arena.buffer,   header.hashes.allocd);
+    if(parsed_json->chars_arena.allocd) memcpy(dst + header.chars.at, parsed_json->chars_arena.buffer, parsed_json->chars_arena.allocd);
+    relocate_json_snapshot_strings(parsed_json, dst, &header);
+    return header.image_size;
 }
 
-// Same as next_token but without considering next token parsed
-json_token *lookahead_token(json_tokenised *token_src)
+u8 save_parsed_json_snapshot(json_parsed *parsed_json, const char *path)
 {
-    json_token *token = &token_src->tokens[token_src->token_index];
-    return token;
+    if(parsed_json->status != JSON_STATUS_PARSED) return 0;
+
+    u64 image_size = get_parsed_json_snapshot_size(parsed_json);
+    u8 *image      = (u8*)json_alloc(&parsed_json->allocator, image_size);
+    if(!image) return 0;
+    write_parsed_json_snapshot(parsed_json, image);
+
+    FILE *stream = fopen(path, "wb");
+    u8 saved     = stream && fwrite(image, 1, image_size, stream) == image_size;
+    if(stream) saved = (fclose(stream) == 0) && saved;
+    if(!saved) printf("Snapshot error: Couldn't write %s\n", path);
+    json_dealloc(&parsed_json->allocator, image);
+    return saved;
 }
 
-// ============================== Validation ===================================
-
-void print_offending_token(json_parse_state *parse_state, json_token *offending_token)
+// Moves a string's chars from where they were saved for to chars, 0 if they're past the image's chars
+u8 move_json_snapshot_string(json_string *string, char *chars, u64 num_chars, u64 saved_chars)
 {
-    // These figures don't include trailing ellipses
-    u32 max_chars_before_offending = 20;
-    u32 max_chars_after_offending  = 10;
+    if(!string->chars) return 1;
 
-    const char *src_end = parse_state->token_src.src + parse_state->token_src.src_size;
+    u64 offset = (u64)(uintptr_t)string->chars - saved_chars; // Wraps to past num_chars if it's before
+    if(offset > num_chars || string->size > num_chars - offset) return 0;
+    string->chars = chars + offset;
+    return 1;
+}
 
-    const char *src_info_start_loc;
-    const char *src_info_end_loc;
+u8 move_json_snapshot_strings(u8 *image, json_snapshot_header *header)
+{
+    char *chars       = (char*)(image + header->chars.at);
+    u64   saved_chars = header->base + header->chars.at;
+    u64   num_chars   = header->chars.allocd;
 
-    if(max_chars_before_offending > offending_token->loc_by_chars)
+    json_string *keys = (json_string*)(image + header->keys.at);
+    for(u64 i = 0; i < header->keys.allocd / sizeof(json_string); i += 1)
     {
-        src_info_start_loc = parse_state->token_src.src;
+        if(!move_json_snapshot_string(&keys[i], chars, num_chars, saved_chars)) return 0;
     }
-    else
+
+    json_stored_value *values = (json_stored_value*)(image + header->values.at);
+    for(u64 i = 0; i < header->values.allocd / sizeof(json_stored_value); i += 1)
     {
-        src_info_start_loc = offending_token->loc - max_chars_before_offending;
+#ifdef JSON_COMPACT_VALUES
+        if((values[i] & JSON_BOXED) != JSON_BOXED || ((values[i] >> 48) & 7) != JSON_BOX_STRING) continue;
+        u64 at = values[i] & JSON_BOX_PAYLOAD;
+        if(at > num_chars || sizeof(json_string) > num_chars - at) return 0;
+
+        json_string string;
+        memcpy(&string, chars + at, sizeof(json_string));
+        if(!move_json_snapshot_string(&string, chars, num_chars, saved_chars)) return 0;
+        memcpy(chars + at, &string, sizeof(json_string));
+#else
+        if(values[i].type != JSON_STRING) continue;
+        if(!move_json_snapshot_string(&values[i].string, chars, num_chars, saved_chars)) return 0;
+#endif
     }
-    if(max_chars_after_offending > (offending_token->loc_from_end_by_chars - offending_token->length))
+    return 1;
+}
+
+// The result is in image, which it's loaded from in place (so it's loaded once) and has to outlive
+// it. image has to be 8 byte aligned. Its sections are checked to be inside it, and its strings' chars
+// too if they're moved, but not the indices in its ooas and values.
+json_parsed open_parsed_json_snapshot(void *image, u64 image_size)
+{
+    json_parsed parsed_json = {.status = JSON_STATUS_UNREADABLE, .in_snapshot = 1};
+    json_snapshot_header header;
+    if(image_size < sizeof(header) || ((uintptr_t)image & 7) != 0)
     {
-        src_info_end_loc = src_end;
+        printf("Snapshot error: Not a snapshot\n");
+        return parsed_json;
     }
-    else
+    memcpy(&header, image, sizeof(header));
+    if(header.magic != JSON_SNAPSHOT_MAGIC || header.version != JSON_SNAPSHOT_VERSION || header.layout != get_json_snapshot_layout())
     {
-        src_info_end_loc = offending_token->loc + offending_token->length + max_chars_after_offending;
+        printf("Snapshot error: Not a snapshot this build loads\n");
+        return parsed_json;
     }
 
-    u32 src_info_str_token_loc = offending_token->loc - src_info_start_loc;
-
-    char src_info_str[64] = {0};
-    u32  src_info_str_len = 0;
-    
-    if(src_info_start_loc != parse_state->token_src.src)
+    u8 fits = header.image_size <= image_size;
+    json_snapshot_section *sections[] = {&header.ooas, &header.keys, &header.values, &header.hashes, &header.chars};
+    for(u32 i = 0; i < 5; i += 1)
     {
-        for(u32 i = 0; i < 3; i += 1)
-        {
-            src_info_str[i]   = '.';
-            src_info_str_len += 1;
-            src_info_str_token_loc += 1;
-        }
+        fits = fits && sections[i]->at <= header.image_size && sections[i]->allocd <= header.image_size - sections[i]->at;
+        fits = fits && sections[i]->allocd <= JSON_SIZE_MAX && sections[i]->allocs <= JSON_SIZE_MAX;
     }
-
-    for(const char *c = src_info_start_loc; c != src_info_end_loc; c += 1)
+    fits = fits && header.ooas.allocd == header.ooas.allocs * sizeof(json_ooa);
+    if(!fits)
     {
-        if(*c == '\n') src_info_str[src_info_str_len] = ' ';
-        else           src_info_str[src_info_str_len] = *c;
-
-        src_info_str_len += 1;
+        printf("Snapshot error: Truncated or corrupt\n");
+        return parsed_json;
     }
 
-    if(src_info_end_loc != src_end)
+    u8 *base = (u8*)image;
+    if((u64)(uintptr_t)base != header.base && !move_json_snapshot_strings(base, &header))
     {
-        for(u32 i = 0; i < 3; i += 1)
-        {
-            src_info_str[src_info_str_len] = '.';
-            src_info_str_len += 1;
-        }
+        printf("Snapshot error: String outside the snapshot's chars\n");
+        return parsed_json;
     }
 
-    printf("Parse error at:\n");
-
-    // Print offending token and surrounding characters, including ellipses where appropriate
-    printf("%.*s\n", src_info_str_len, src_info_str);
-
-    // Print arrow underneath, pointing to offending token
-    for(u32 i = 0; i < src_info_str_token_loc; i += 1) printf(" ");
-    printf("^");
-    for(u32 i = 0; i < offending_token->length; i += 1) printf("~");
-    printf("\n");
+    parsed_json.status       = JSON_STATUS_PARSED;
+    parsed_json.ooa_list     = (json_ooa_list){.size = (json_size)header.ooas.allocs, .cap = (json_size)header.ooas.allocs, .ooas = (json_ooa*)(base + header.ooas.at)};
+    parsed_json.keys_arena   = (json_mem_arena){.cap = (json_size)header.keys.allocd,   .allocd = (json_size)header.keys.allocd,   .allocs = (json_size)header.keys.allocs,   .buffer = base + header.keys.at};
+    parsed_json.values_arena = (json_mem_arena){.cap = (json_size)header.values.allocd, .allocd = (json_size)header.values.allocd, .allocs = (json_size)header.values.allocs, .buffer = base + header.values.at};
+    parsed_json.hash_arena   = (json_mem_arena){.cap = (json_size)header.hashes.allocd, .allocd = (json_size)header.hashes.allocd, .allocs = (json_size)header.hashes.allocs, .buffer = base + header.hashes.at};
+    parsed_json.chars_arena  = (json_mem_arena){.cap = (json_size)header.chars.allocd,  .allocd = (json_size)header.chars.allocd,  .allocs = (json_size)header.chars.allocs,  .buffer = base + header.chars.at};
+    if(header.hashes.allocd == 0) parsed_json.hash_arena.buffer = NULL;
+    return parsed_json;
 }
 
-void _json_validation_error(json_parse_state *parse_state, json_token *offending_token, json_token_type *expected_types, u32 num_expected_types)
+// Maps the snapshot at its base if that's free. It's copy on write, so if its strings have to be
+// moved only the pages of keys and values are copied. It's unmapped by dealloc_parsed_json.
+json_parsed load_parsed_json_snapshot(const char *path, json_allocator *allocator)
 {
-    print_offending_token(parse_state, offending_token);
+    json_snapshot_header header = {0};
+    FILE *stream = fopen(path, "rb");
+    if(stream)
+    {
+        if(fread(&header, 1, sizeof(header), stream) != sizeof(header)) header.base = 0;
+        fclose(stream);
+    }
 
-    // Print cause of error
-    json_token_type got_type = offending_token->type;
-    printf("Got: "); print_token_type(got_type);
-    printf(". Expected: [");
-    for(u32 i = 0; i < num_expected_types; i += 1)
+    json_file file = map_json_file_at(path, (void*)(uintptr_t)header.base, JSON_FILE_COPY_ON_WRITE, allocator);
+    if(!file.src)
     {
-        print_token_type(expected_types[i]); printf(" ");
+        printf("Snapshot error: Couldn't read %s\n", path);
+        return (json_parsed){.status = JSON_STATUS_UNREADABLE};
     }
-    printf("]\n");
+
+    json_parsed parsed_json = open_parsed_json_snapshot(file.base, file.size);
+    parsed_json.allocator   = *get_json_allocator(allocator);
+    if(parsed_json.status != JSON_STATUS_PARSED) unmap_json_file(&file, allocator);
+    else                                         parsed_json.file = file;
+    return parsed_json;
 }
 
-void json_empty_key_error(json_parse_state *parse_state, json_token *offending_token)
+// ============================== Batch parse ===================================
+
+// Parses NDJSON (one JSON object per line) on a pool of threads. Lines are split up front, then each
+// thread takes a run of records at a time and parses them single pass with a parser of its own,
+// kept between records. The parser's allocator has to be safe to call from several threads at once.
+
+#ifndef JSON_BATCH_RUN_SIZE
+#define JSON_BATCH_RUN_SIZE 16 // Records a thread takes at a time
+#endif
+
+typedef struct
 {
-    print_offending_token(parse_state, offending_token);
-    printf("You cannot have empty key strings in JSON object fields!\n");
-}
+    json_size   src_offset; // Where the line starts in src, error offsets are from here
+    json_size   src_size;
+    json_parsed parsed;
+} json_record;
 
-#define json_validation_error(parse_state, got_token, ...) \
-    json_token_type expected[] = {__VA_ARGS__}; \
-    u32 num_expected = sizeof(expected)/sizeof(json_token_type); \
-    _json_validation_error(parse_state, got_token, expected, num_expected)
+typedef struct
+{
+    u32          num_records;
+    u32          num_invalid;
+    json_record *records; // In line order, blank lines are skipped
+    json_allocator allocator;
+} json_batch;
 
-u8 validate_json_object(json_parse_state*);
-u8 validate_json_array(json_parse_state*);
+// Called on the parsing threads, several at once and in no particular order. parsed is only good
+// until it returns, and returning 0 stops the batch.
+typedef u8 (*json_record_func)(void *user_data, u32 record_index, json_record *record);
 
-u8 validate_json_value(json_parse_state *parse_state)
+typedef struct
 {
-    json_token *lh = lookahead_token(&parse_state->token_src);
-    if(lh->type == TOKEN_OBRACE)
-    {
-        u8 is_value_valid = validate_json_object(parse_state);
-        if(!is_value_valid) return 0;
-    }
-    else if(lh->type == TOKEN_OBRACK)
+    const char      *src;
+    u32              flags;
+    u32              max_depth; // The caller's parser's, for every thread's parser
+    json_allocator  *allocator;
+    u32              num_records;
+    json_record     *records;
+    json_record_func func;
+    void            *user_data;
+    volatile u32     next_record;
+    volatile u32     num_invalid;
+    volatile u32     stopped;
+} json_batch_work;
+
+// Returns the number of records, writing them to records if it's not NULL
+u32 split_ndjson_records(const char *src, json_size src_size, json_record *records)
+{
+    u32 num_records = 0;
+    const char *c   = src;
+    const char *end = src + src_size;
+    while(c < end)
     {
-        u8 is_value_valid = validate_json_array(parse_state);
-        if(!is_value_valid) return 0;
+        const char *line_end = (const char*)memchr(c, '\n', end - c);
+        if(!line_end) line_end = end;
+
+        // Trim so blank lines (and the \r of \r\n) can be skipped
+        const char *first = c;
+        const char *last  = line_end;
+        for(; first < last && is_whitespace(*first); first += 1);
+        for(; last > first && is_whitespace(last[-1]); last -= 1);
+        if(first < last)
+        {
+            if(records) records[num_records] = (json_record){.src_offset = first - src, .src_size = last - first};
+            num_records += 1;
+        }
+        c = line_end + 1;
     }
-    else
+    return num_records;
+}
+
+void parse_json_batch_records(void *work_arg)
+{
+    json_batch_work *work = (json_batch_work*)work_arg;
+    json_parser parser    = init_json_parser(work->allocator, work->flags);
+    parser.max_depth      = work->max_depth;
+    while(!json_atomic_load(&work->stopped))
     {
-        json_token *token = next_token(&parse_state->token_src);
-        switch(token->type)
+        u32 first = json_atomic_add(&work->next_record, JSON_BATCH_RUN_SIZE);
+        if(first >= work->num_records) break;
+
+        u32 last = first + JSON_BATCH_RUN_SIZE;
+        if(last > work->num_records) last = work->num_records;
+        for(u32 i = first; i < last; i += 1)
         {
-            case TOKEN_STRING:
-            case TOKEN_NUMBER:
-            case TOKEN_BOOL:
-            case TOKEN_NULL:
-            break;
-            default:
+            json_record *record = &work->records[i];
+            record->parsed = parse_json_with_parser(&parser, work->src + record->src_offset, record->src_size);
+            if(record->parsed.status != JSON_STATUS_PARSED) json_atomic_add(&work->num_invalid, 1);
+
+            if(!work->func)
             {
-                json_validation_error(parse_state, token, TOKEN_STRING, TOKEN_NUMBER, TOKEN_BOOL, TOKEN_NULL, TOKEN_OBRACE, TOKEN_OBRACK);
-                return 0;
+                record->parsed = detach_parsed_json(&parser, record->parsed);
+            }
+            else
+            {
+                // Parsed in the thread's parser, which the next record reuses
+                u8 carry_on    = work->func(work->user_data, i, record);
+                record->parsed = (json_parsed){0};
+                if(!carry_on)
+                {
+                    json_atomic_add(&work->stopped, 1);
+                    break;
+                }
             }
         }
     }
+    dealloc_json_parser(&parser);
+}
 
-    return 1;
+// num_threads of 0 uses one per core, the calling thread's one of them
+void run_json_batch_work(json_batch_work *work, u32 num_threads)
+{
+    if(num_threads == 0) num_threads = get_json_num_cores();
+    u32 num_runs = (work->num_records + JSON_BATCH_RUN_SIZE - 1) / JSON_BATCH_RUN_SIZE;
+    if(num_threads > num_runs) num_threads = (num_runs > 0) ? num_runs : 1;
+    run_json_threads(parse_json_batch_records, work, 0, num_threads, work->allocator);
 }
 
-u8 validate_json_pair(json_parse_state *parse_state)
+// Records are parsed with the parser's flags, max_depth and allocator, always single pass and each
+// on one thread. num_threads of 0 uses one per core.
+json_batch parse_ndjson(json_parser *parser, const char *src, json_size src_size, u32 num_threads)
 {
-    // Key string
-    json_token *token = next_token(&parse_state->token_src);
-    if(token->type != TOKEN_STRING)
-    {
-        json_validation_error(parse_state, token, TOKEN_STRING);
-        return 0;
-    }
-    if(token->length == 2)
-    {
-        json_empty_key_error(parse_state, token);
-        return 0;
-    }
+    json_batch batch  = {0};
+    batch.allocator   = parser->allocator;
+    batch.num_records = split_ndjson_records(src, src_size, NULL);
+    batch.records     = (json_record*)json_alloc(&batch.allocator, ((u64)batch.num_records + 1) * sizeof(json_record));
+    split_ndjson_records(src, src_size, batch.records);
+
+    json_batch_work work = {0};
+    work.src         = src;
+    work.flags       = (parser->flags | JSON_PARSE_SINGLE_PASS) & ~JSON_PARSE_PARALLEL;
+    work.max_depth   = parser->max_depth;
+    work.allocator   = &parser->allocator;
+    work.num_records = batch.num_records;
+    work.records     = batch.records;
+    run_json_batch_work(&work, num_threads);
+
+    batch.num_invalid = work.num_invalid;
+    return batch;
+}
 
-    // Colon
-    token = next_token(&parse_state->token_src);
-    if(token->type != TOKEN_COLON)
+// Returns JSON_STATUS_PARSED once every record's been passed to func (whether it parsed or not, see
+// the record's status), or JSON_STATUS_ABORTED if func stopped it
+json_parse_status parse_ndjson_each(json_parser *parser, const char *src, json_size src_size, u32 num_threads, json_record_func func, void *user_data)
+{
+    u32 num_records      = split_ndjson_records(src, src_size, NULL);
+    json_record *records = (json_record*)json_alloc(&parser->allocator, ((u64)num_records + 1) * sizeof(json_record));
+    split_ndjson_records(src, src_size, records);
+
+    json_batch_work work = {0};
+    work.src         = src;
+    work.flags       = (parser->flags | JSON_PARSE_SINGLE_PASS) & ~JSON_PARSE_PARALLEL;
+    work.max_depth   = parser->max_depth;
+    work.allocator   = &parser->allocator;
+    work.num_records = num_records;
+    work.records     = records;
+    work.func        = func;
+    work.user_data   = user_data;
+    run_json_batch_work(&work, num_threads);
+
+    json_dealloc(&parser->allocator, records);
+    return work.stopped ? JSON_STATUS_ABORTED : JSON_STATUS_PARSED;
+}
+
+void dealloc_json_batch(json_batch *batch)
+{
+    for(u32 i = 0; i < batch->num_records; i += 1)
     {
-        json_validation_error(parse_state, token, TOKEN_COLON);
-        return 0;
+        if(batch->records[i].parsed.status == JSON_STATUS_PARSED) dealloc_parsed_json(batch->records[i].parsed);
     }
+    json_dealloc(&batch->allocator, batch->records);
+    *batch = (json_batch){0};
+}
 
-    u8 is_value_valid = validate_json_value(parse_state);
-    return is_value_valid;
+// ============================== Retrieval ===================================
 
-    return 1;
-}
+json_size find_json_object_value_by_key(json_size object_index, json_string key, json_parsed *parsed_json)
+{    
+    json_ooa    *object = get_json_ooa_addr(parsed_json, object_index);
+    json_string *keys   = get_json_key_addr(parsed_json, object->keys_index);
 
-u8 validate_json_array(json_parse_state *parse_state)
-{
-    json_token *token = next_token(&parse_state->token_src);
-    if(token->type != TOKEN_OBRACK)
+    if(object->hash_index)
     {
-        json_validation_error(parse_state, token, TOKEN_OBRACK);
+        json_mem_arena *arena = &parsed_json->hash_arena;
+        u32 *table   = get_arena_nth_alloc(arena, object->hash_index, u32);
+        u32 *buckets = table + 1;
+        u32 *next    = buckets + (1u << table[0]);
+        for(u32 k = buckets[get_json_hash_bucket(key.hash, table[0])]; k != 0; k = next[k-1])
+        {
+            if(json_string_eq(key, keys[k-1]))
+            {
+                return object->vals_index + k-1;
+            }
+        }
         return 0;
     }
 
-    json_token *lh = lookahead_token(&parse_state->token_src);
-    while(lh->type != TOKEN_CBRACK)
+    for(json_size i = 0; i < object->size; i += 1)
     {
-        u8 value_valid = validate_json_value(parse_state);
-        if(!value_valid) return 0;
-
-        token = current_token(&parse_state->token_src);
-        lh    = lookahead_token(&parse_state->token_src);
-        if(lh->type == TOKEN_COMMA)
-        {
-            token = next_token(&parse_state->token_src);
-            lh    = lookahead_token(&parse_state->token_src);
-        }
-        else if(lh->type != TOKEN_CBRACK)
+        if(json_string_eq(key, keys[i]))
         {
-            json_validation_error(parse_state, lh, TOKEN_COMMA, TOKEN_CBRACK);
-            return 0;
+            return object->vals_index + i;
         }
     }
-    if(token->type == TOKEN_COMMA)
-    {
-        // Array ends with comma followed by cbrack
-        json_validation_error(parse_state, lh, TOKEN_NUMBER, TOKEN_STRING, TOKEN_BOOL, TOKEN_NULL);
-        return 0;
-    }
-    token = next_token(&parse_state->token_src); // Consume CBRACK token
-    return 1;
+    return 0; // TODO: Non-exist macro/constant? (e.g. define NON_EXIST 0)
 }
 
-// Object is obrace, 0 or more key-value pairs followed by commas then cbrace
-u8 validate_json_object(json_parse_state *parse_state)
+json_size get_json_value(json_size ooa_index, json_size value_offset, json_parsed *parsed_json)
 {
-    json_token *token = next_token(&parse_state->token_src);
-    if(token->type != TOKEN_OBRACE)
-    {
-        json_validation_error(parse_state, token, TOKEN_OBRACE);
-        return 0;
-    }
+    // TODO: Bounds check
+    json_ooa *ooa = get_json_ooa_addr(parsed_json, ooa_index);
+    return ooa->vals_index + value_offset;
+}
 
-    json_token *lh = lookahead_token(&parse_state->token_src);
-    while(lh->type != TOKEN_CBRACE)
-    {
-        u8 pair_valid = validate_json_pair(parse_state);
-        if(!pair_valid) return 0;
+// Paths are either dotted, like Arr[7].Them[2], Obj.*.name or Obj["key.with.dots"], or RFC 6901
+// JSON Pointers, like /Arr/7/Them/2 (with ~1 for / and ~0 for ~ in keys). They're compiled once,
+// with keys unescaped and hashed, and compiled paths are run without allocating.
 
-        token = current_token(&parse_state->token_src);
-        lh    = lookahead_token(&parse_state->token_src);
-        if(lh->type == TOKEN_COMMA)
-        {
-            token = next_token(&parse_state->token_src);
-            lh    = lookahead_token(&parse_state->token_src);
-        }
-        else if(lh->type != TOKEN_CBRACE)
-        {
-            json_validation_error(parse_state, lh, TOKEN_COMMA, TOKEN_CBRACE);
-            return 0;
-        }
-    }
-    if(token->type == TOKEN_COMMA)
-    {
-        // Object ends with comma followed by cbrace
-        json_validation_error(parse_state, lh, TOKEN_NUMBER, TOKEN_STRING, TOKEN_BOOL, TOKEN_NULL);
-        return 0;
-    }
-    token = next_token(&parse_state->token_src); // Consume CBRACE token
-    return 1;
+typedef enum
+{
+    JSON_PATH_KEY,          // Object member
+    JSON_PATH_INDEX,        // Array element
+    JSON_PATH_KEY_OR_INDEX, // JSON Pointer tokens which are numbers can be either
+    JSON_PATH_WILDCARD,     // Every member or element
+} json_path_step_type;
+
+typedef struct
+{
+    json_path_step_type type;
+    u32                 index;
+    json_string         key;
+} json_path_step;
+
+typedef struct
+{
+    u8              is_valid;
+    u32             num_steps;
+    json_path_step *steps; // Steps and their keys' chars share one allocation
+    json_allocator  allocator;
+} json_path;
+
+void json_path_error(const char *path_string, u32 path_size, const char *c, const char *message)
+{
+    printf("Path error at char %u of \"%.*s\": %s\n", (u32)(c - path_string), path_size, path_string, message);
 }
 
-void validate_json(json_parse_state *parse_state)
+// Reads an array index made of digits without leading zeros. Returns the number of chars read, 0 if
+// there isn't one.
+u32 read_json_path_index(const char *c, const char *end, u32 *index)
 {
-    if(parse_state->status != JSON_STATUS_TOKENISED)
+    u64 value  = 0;
+    u32 length = 0;
+    for(; c + length < end && is_digit(c[length]); length += 1)
     {
-        printf("Error: Cannot validate JSON. It hasn't been tokenised yet!\n");
-        return;
+        value = value * 10 + (c[length] - '0');
+        if(value > 0xFFFFFFFF) return 0;
     }
+    if(length == 0 || (length > 1 && c[0] == '0')) return 0;
 
-    reset_tokenised_json(&parse_state->token_src);
-    u8 json_validated = validate_json_object(parse_state);
-    if(json_validated) parse_state->status = JSON_STATUS_VALID;
-    else               parse_state->status = JSON_STATUS_INVALID;
+    *index = (u32)value;
+    return length;
 }
 
-// ============================== Count JSON ===================================
-
-void count_json_object(json_parse_state*);
-void count_json_array(json_parse_state*);
-
-void count_json_array(json_parse_state *parse_state)
+u8 compile_json_pointer(json_path *path, const char *path_string, u32 path_size, char *chars)
 {
-    u32 num_values  = 0;
-    u32 num_chars   = 0;
-
-    json_ooa   *dst   = push_ooa_to_list(&parse_state->ooa_list, JSON_ARRAY);
-    json_token *token = next_token(&parse_state->token_src);
-    json_token *lh    = lookahead_token(&parse_state->token_src);
-    while(lh->type != TOKEN_CBRACK)
+    const char *c   = path_string;
+    const char *end = path_string + path_size;
+    while(c < end)
     {
-        num_values += 1;
-        lh = lookahead_token(&parse_state->token_src);
-        if(lh->type == TOKEN_OBRACE) count_json_object(parse_state);
-        else
-        if(lh->type == TOKEN_OBRACK) count_json_array(parse_state);
-        else
+        // Every token follows a slash
+        c += 1;
+        json_path_step *step = &path->steps[path->num_steps];
+        path->num_steps     += 1;
+        step->key.chars      = chars;
+        step->key.size       = 0;
+        for(; c < end && *c != '/'; c += 1)
         {
-            token = next_token(&parse_state->token_src);
-            if(token->type == TOKEN_STRING)
+            char k = *c;
+            if(k == '~')
             {
-                num_chars   += token->length - 2; // Exclude quote marks
+                if(c + 1 < end && c[1] == '0')      k = '~';
+                else if(c + 1 < end && c[1] == '1') k = '/';
+                else
+                {
+                    json_path_error(path_string, path_size, c, "~ has to be followed by 0 or 1");
+                    return 0;
+                }
+                c += 1;
             }
+            step->key.chars[step->key.size] = k;
+            step->key.size += 1;
         }
-        lh = lookahead_token(&parse_state->token_src);
-        if(lh->type == TOKEN_COMMA)
-        {
-            token = next_token(&parse_state->token_src);
-            lh    = lookahead_token(&parse_state->token_src);
-        }
-    }
-    token = next_token(&parse_state->token_src); // Consume cbrack
+        compute_json_string_hash(&step->key);
+        chars += step->key.size;
 
-    dst->size = num_values;
-    parse_state->num_chars_counted += num_chars;
+        u32 index_length = read_json_path_index(step->key.chars, step->key.chars + step->key.size, &step->index);
+        if(index_length > 0 && index_length == step->key.size) step->type = JSON_PATH_KEY_OR_INDEX;
+        else                                                   step->type = JSON_PATH_KEY;
+    }
+    return 1;
 }
 
-void count_json_object(json_parse_state *parse_state)
+u8 compile_json_dotted_path(json_path *path, const char *path_string, u32 path_size, char *chars)
 {
-    u32 num_values  = 0;
-    u32 num_chars   = 0;
-
-    json_ooa   *dst   = push_ooa_to_list(&parse_state->ooa_list, JSON_OBJECT);
-    json_token *token = next_token(&parse_state->token_src); // Obrace
-    json_token *lh    = lookahead_token(&parse_state->token_src);
-    while(lh->type != TOKEN_CBRACE)
+    const char *c   = path_string;
+    const char *end = path_string + path_size;
+    while(c < end)
     {
-        token        = next_token(&parse_state->token_src); // Key string
-        num_values  += 1;
-        num_chars   += token->length - 2; // Exclude quote marks around strings
-        
-        token = next_token(&parse_state->token_src); // Colon
-        lh    = lookahead_token(&parse_state->token_src);
-        if(lh->type == TOKEN_OBRACE) count_json_object(parse_state);
-        else
-        if(lh->type == TOKEN_OBRACK) count_json_array(parse_state);
-        else
+        json_path_step *step = &path->steps[path->num_steps];
+        path->num_steps     += 1;
+        step->key.chars      = chars;
+        step->key.size       = 0;
+
+        if(*c == '[')
         {
-            token = next_token(&parse_state->token_src);
-            if(token->type == TOKEN_STRING)
+            c += 1;
+            if(c < end && *c == '*')
+            {
+                step->type = JSON_PATH_WILDCARD;
+                c += 1;
+            }
+            else if(c < end && *c == '"')
+            {
+                // Quoted key, backslashes escape the next char
+                step->type = JSON_PATH_KEY;
+                for(c += 1; c < end && *c != '"'; c += 1)
+                {
+                    if(*c == '\\' && c + 1 < end) c += 1;
+                    step->key.chars[step->key.size] = *c;
+                    step->key.size += 1;
+                }
+                if(c == end)
+                {
+                    json_path_error(path_string, path_size, c, "Unterminated quoted key");
+                    return 0;
+                }
+                c += 1;
+            }
+            else
+            {
+                step->type = JSON_PATH_INDEX;
+                u32 index_length = read_json_path_index(c, end, &step->index);
+                if(index_length == 0)
+                {
+                    json_path_error(path_string, path_size, c, "Expected an index, * or a quoted key");
+                    return 0;
+                }
+                c += index_length;
+            }
+            if(c == end || *c != ']')
             {
-                num_chars   += token->length - 2; // Exclude quote marks
+                json_path_error(path_string, path_size, c, "Expected ]");
+                return 0;
             }
+            c += 1;
         }
-        lh = lookahead_token(&parse_state->token_src);
-        if(lh->type == TOKEN_COMMA)
+        else
         {
-            token = next_token(&parse_state->token_src);
-            lh    = lookahead_token(&parse_state->token_src);
-        }
-    }
-    token = next_token(&parse_state->token_src); // Consume cbrace
-
-    dst->size = num_values;
-    parse_state->num_chars_counted += num_chars;
-}
+            // Dots only come between steps
+            if(path->num_steps > 1)
+            {
+                if(*c != '.')
+                {
+                    json_path_error(path_string, path_size, c, "Expected . or [");
+                    return 0;
+                }
+                c += 1;
+            }
 
-void count_json_ooas_values_and_strings(json_parse_state *parse_state)
-{   
-    if(parse_state->status != JSON_STATUS_VALID)
-    {
-        printf("Error: Cannot count JSON. It hasn't been validated yet!\n");
-        return;
+            // Bare key, backslashes escape the next char
+            step->type = JSON_PATH_KEY;
+            const char *key_start = c;
+            for(; c < end && *c != '.' && *c != '['; c += 1)
+            {
+                if(*c == '\\' && c + 1 < end) c += 1;
+                step->key.chars[step->key.size] = *c;
+                step->key.size += 1;
+            }
+            if(step->key.size == 0)
+            {
+                json_path_error(path_string, path_size, c, "Expected a key");
+                return 0;
+            }
+            if(c - key_start == 1 && *key_start == '*') step->type = JSON_PATH_WILDCARD;
+        }
+
+        compute_json_string_hash(&step->key);
+        chars += step->key.size;
     }
+    return path->num_steps > 0;
+}
 
-    u32 cap                        = 128;
-    parse_state->ooa_list.cap      = cap;
-    parse_state->ooa_list.size     = 1;
-    parse_state->ooa_list.ooas     = (json_ooa*)alloc(cap * sizeof(json_ooa));
-    reset_tokenised_json(&parse_state->token_src);
-    count_json_object(parse_state);
+// A NULL allocator uses the functions given to set_allocation_functions
+json_path compile_json_path(const char *path_string, u32 path_size, json_allocator *allocator)
+{
+    // Every step takes at least one char, and unescaped keys are never longer than the path
+    json_path path = {0};
+    u64 steps_size = ((u64)path_size + 1) * sizeof(json_path_step);
+    path.allocator = *get_json_allocator(allocator);
+    path.steps     = (json_path_step*)json_alloc(&path.allocator, steps_size + path_size + 1);
+    char *chars    = (char*)path.steps + steps_size;
+
+    if(path_size > 0 && path_string[0] == '/') path.is_valid = compile_json_pointer(&path, path_string, path_size, chars);
+    else                                       path.is_valid = compile_json_dotted_path(&path, path_string, path_size, chars);
+    return path;
+}
 
-    parse_state->status = JSON_STATUS_COUNTED;
+void dealloc_json_path(json_path *path)
+{
+    json_dealloc(&path->allocator, path->steps);
+    path->steps     = NULL;
+    path->num_steps = 0;
+    path->is_valid  = 0;
 }
 
-// ============================== Populate parsed JSON ===================================
+u32 match_json_path(json_path *path, u32 step_index, json_size ooa_index, json_parsed *parsed_json, json_size *results, u32 max_results, u32 num_found);
 
-u32 get_next_ooa(json_parse_state *parse_state)
+u32 match_json_path_value(json_path *path, u32 step_index, json_size value_index, json_parsed *parsed_json, json_size *results, u32 max_results, u32 num_found)
 {
-    u32 ooa = parse_state->num_ooas_parsed;
-    parse_state->num_ooas_parsed += 1;
-    return ooa;
-}
+    if(step_index == path->num_steps)
+    {
+        results[num_found] = value_index;
+        return num_found + 1;
+    }
 
-json_ooa_ptr populate_json_object(json_parse_state*);
-json_ooa_ptr populate_json_array(json_parse_state*);
+    json_value value = load_parsed_json_value(parsed_json, value_index);
+    if(value.type != JSON_OBJECT && value.type != JSON_ARRAY) return num_found;
+    return match_json_path(path, step_index, value.ooa, parsed_json, results, max_results, num_found);
+}
 
-void populate_json_value(json_value *dst, json_parse_state *parse_state)
+// Recurses once per step, so the stack used is bounded by the path
+u32 match_json_path(json_path *path, u32 step_index, json_size ooa_index, json_parsed *parsed_json, json_size *results, u32 max_results, u32 num_found)
 {
-    json_token *token = lookahead_token(&parse_state->token_src);
-    switch(token->type)
+    json_path_step *step = &path->steps[step_index];
+    json_ooa       *ooa  = get_json_ooa_addr(parsed_json, ooa_index);
+
+    u8 use_key   = ooa->type == JSON_OBJECT && (step->type == JSON_PATH_KEY   || step->type == JSON_PATH_KEY_OR_INDEX);
+    u8 use_index = ooa->type == JSON_ARRAY  && (step->type == JSON_PATH_INDEX || step->type == JSON_PATH_KEY_OR_INDEX);
+    if(use_key)
     {
-        case TOKEN_NUMBER:
-        {
-            dst->type   = JSON_NUMBER;
-            dst->number = token->numeric_value;
-            token       = next_token(&parse_state->token_src);
-            break;
-        }
-        case TOKEN_BOOL:
-        {
-            dst->type    = JSON_BOOL;
-            dst->boolean = token->boolean_value;
-            token        = next_token(&parse_state->token_src);
-            break;
-        }
-        case TOKEN_STRING:
-        {
-            dst->type   = JSON_STRING;
-            char *cstr  = alloc_json_chars((&parse_state->chars_arena), token->length-2);
-            dst->string = copy_to_json_string_no_quotes(token, cstr);
-            token       = next_token(&parse_state->token_src);
-            break;
-        }
-        case TOKEN_NULL:
-        {
-            dst->type = JSON_NULL;
-            token     = next_token(&parse_state->token_src);
-            break;
-        }
-        case TOKEN_OBRACE:
-        {
-            dst->type = JSON_OBJECT;
-            dst->ooa  = populate_json_object(parse_state);
-            break;
-        }
-        case TOKEN_OBRACK:
+        json_size value_index = find_json_object_value_by_key(ooa_index, step->key, parsed_json);
+        if(value_index == 0) return num_found;
+        return match_json_path_value(path, step_index + 1, value_index, parsed_json, results, max_results, num_found);
+    }
+    if(use_index)
+    {
+        if(step->index >= ooa->size) return num_found;
+        return match_json_path_value(path, step_index + 1, ooa->vals_index + step->index, parsed_json, results, max_results, num_found);
+    }
+    if(step->type == JSON_PATH_WILDCARD)
+    {
+        for(json_size i = 0; i < ooa->size && num_found < max_results; i += 1)
         {
-            dst->type = JSON_ARRAY;
-            dst->ooa  = populate_json_array(parse_state);
-            break;
+            num_found = match_json_path_value(path, step_index + 1, ooa->vals_index + i, parsed_json, results, max_results, num_found);
         }
     }
+    return num_found;
 }
 
-json_ooa_ptr populate_json_array(json_parse_state *parse_state)
+// Writes up to max_results indices of values matched by the path from ooa_index into results, in
+// document order. Returns how many were written.
+u32 run_json_path(json_path *path, json_size ooa_index, json_parsed *parsed_json, json_size *results, u32 max_results)
 {
-    u32       array_ooa_index = get_next_ooa(parse_state);
-    json_ooa *array_ooa       = &parse_state->ooa_list.ooas[array_ooa_index];
+    if(!path->is_valid || max_results == 0) return 0;
+    return match_json_path(path, 0, ooa_index, parsed_json, results, max_results, 0);
+}
 
-    json_val_ptr start_value_index = alloc_json_values(&parse_state->values_arena, array_ooa->size);
-    json_value  *value_ptr         = get_arena_nth_alloc((&parse_state->values_arena), start_value_index, json_value);
+// First value matched by the path, 0 if there isn't one
+json_size find_json_path_value(json_path *path, json_size ooa_index, json_parsed *parsed_json)
+{
+    json_size value_index = 0;
+    run_json_path(path, ooa_index, parsed_json, &value_index, 1);
+    return value_index;
+}
 
-    json_token *token = next_token(&parse_state->token_src);
-    if(array_ooa->size == 0) token = next_token(&parse_state->token_src); // Consume empty array cbrack
-    for(u32 i = 0; i < array_ooa->size; i += 1)
+// Finds the value with the key, or failing that the value at the path (see Paths). Paths used more
+// than once should be compiled with compile_json_path, since this compiles them every time.
+json_size find_json_value(json_size object_index, json_string value_string, json_parsed *parsed_json)
+{
+    json_size value_index = find_json_object_value_by_key(object_index, value_string, parsed_json);
+    if(value_index != 0) return value_index;
+
+    u8 is_path = value_string.size > 0 && value_string.chars[0] == '/';
+    for(u32 i = 0; i < value_string.size && !is_path; i += 1)
     {
-        populate_json_value(value_ptr, parse_state);
-        value_ptr += 1;
-        token = next_token(&parse_state->token_src); // Comma or cbrack
+        is_path = value_string.chars[i] == '.' || value_string.chars[i] == '[';
     }
+    if(!is_path) return 0;
 
-    array_ooa->vals_index = start_value_index;
-    return array_ooa_index;
+    json_path path = compile_json_path(value_string.chars, value_string.size, &parsed_json->allocator);
+    value_index    = find_json_path_value(&path, object_index, parsed_json);
+    dealloc_json_path(&path);
+    return value_index;
 }
 
-json_ooa_ptr populate_json_object(json_parse_state *parse_state)
+json_size find_root_json_object(json_parsed *parsed_json)
 {
-    u32       object_ooa_index = get_next_ooa(parse_state);
-    json_ooa *object_ooa       = &parse_state->ooa_list.ooas[object_ooa_index];
-
-    json_val_ptr start_value_index  = alloc_json_values(&parse_state->values_arena, object_ooa->size);
-    json_str_ptr start_string_index = alloc_json_strings(&parse_state->keys_arena, object_ooa->size);
-    json_string *string_ptr         = get_arena_nth_alloc((&parse_state->keys_arena), start_string_index, json_string);
-    json_value  *value_ptr          = get_arena_nth_alloc((&parse_state->values_arena), start_value_index, json_value);
-
-    json_token *token = next_token(&parse_state->token_src);
-    if(object_ooa->size == 0) token = next_token(&parse_state->token_src); // Consume empty object cbrace
-    for(u32 i = 0; i < object_ooa->size; i += 1)
-    {
-        token           = next_token(&parse_state->token_src); // Key string
-        char *key_chars = alloc_json_chars((&parse_state->chars_arena), token->length-2);
-        *string_ptr     = copy_to_json_string_no_quotes(token, key_chars);
-        string_ptr     += 1;
-        token           = next_token(&parse_state->token_src); // Colon
+    return 1;
+}
 
-        populate_json_value(value_ptr, parse_state);
-        value_ptr += 1;
-        token = next_token(&parse_state->token_src); // Comma or cbrace
-    }
+u8 json_value_exists(json_size value_index)
+{
+    return value_index != 0;
+}
 
-    object_ooa->keys_index = start_string_index;
-    object_ooa->vals_index = start_value_index;
-    return object_ooa_index;
+json_size get_num_json_values(json_size ooa_index, json_parsed *parsed_json)
+{
+    json_ooa *ooa = get_json_ooa_addr(parsed_json, ooa_index);
+    return ooa->size;
 }
 
-typedef struct
+json_size get_json_object_key(json_size object_index, json_size key_offset, json_parsed *parsed_json)
 {
-    void *free_mem_base;
-    json_ooa_list  ooa_list;
-    json_mem_arena keys_arena;
-    json_mem_arena values_arena;
-    json_mem_arena chars_arena;
-} json_parsed;
+    json_ooa *object = get_json_ooa_addr(parsed_json, object_index);
+    return object->keys_index + key_offset;
+}
 
-json_ooa *get_json_ooa_addr(json_parsed *json, u32 index)
+json_type get_json_value_type(json_size value_index, json_parsed *parsed_json)
 {
-    json_ooa *ooas = json->ooa_list.ooas;
-    return &ooas[index];
+    json_value value = load_parsed_json_value(parsed_json, value_index);
+    return value.type;
 }
 
-json_string *get_json_key_addr(json_parsed *json, u32 index)
+// Numbers can be read as any of f64, s64 or u64 whichever way they were stored.
+// get_json_value_type says which one is exact. Read as an integer type they don't fit, they
+// saturate at its limits (and NaN reads as 0) rather than wrapping.
+s64 saturate_json_f64_to_s64(f64 number)
 {
-    json_string *keys = (json_string*)json->keys_arena.buffer;
-    return &keys[index];
+    if(number != number)                 return 0;
+    if(number <= -9223372036854775808.0) return INT64_MIN;
+    if(number >= 9223372036854775808.0)  return INT64_MAX;
+    return (s64)number;
 }
 
-json_value *get_json_value_addr(json_parsed *json, u32 index)
+u64 saturate_json_f64_to_u64(f64 number)
 {
-    json_value *values = (json_value*)json->values_arena.buffer;
-    return &values[index];
+    if(!(number > 0.0))                  return 0; // NaN too
+    if(number >= 18446744073709551616.0) return UINT64_MAX;
+    return (u64)number;
 }
 
-json_parsed populate_parsed_json(json_parse_state *parse_state)
+f64 get_json_value_f64(json_size value_index, json_parsed *parsed_json)
 {
-    json_parsed parsed_json = {0};
-    if(parse_state->status != JSON_STATUS_COUNTED)
+    json_value value = load_parsed_json_value(parsed_json, value_index);
+    switch(value.type)
     {
-        printf("Error: Cannot fill parsed json. It hasn't been counted yet!\n");
+        case JSON_INT64:  return (f64)value.int64;
+        case JSON_UINT64: return (f64)value.uint64;
+        default:          return value.number;
     }
-    else
-    {
-        u32 num_keys   = 1; 
-        u32 num_values = 1;
-        for(u32 i = 0; i < parse_state->ooa_list.size; i += 1)
-        {
-            json_ooa *ooa = &parse_state->ooa_list.ooas[i];
-            num_values += ooa->size;
-            if(ooa->type == JSON_OBJECT) num_keys += ooa->size;
-        }
-        u32 num_chars = parse_state->num_chars_counted;
+}
 
-        u32 keys_buffer_size   = num_keys   * sizeof(json_string);
-        u32 values_buffer_size = num_values * sizeof(json_value);
-        u32 chars_buffer_size  = num_chars  * sizeof(char);
-        u32 total_buffer_size = keys_buffer_size + values_buffer_size + chars_buffer_size;
+s64 get_json_value_int64(json_size value_index, json_parsed *parsed_json)
+{
+    json_value value = load_parsed_json_value(parsed_json, value_index);
+    switch(value.type)
+    {
+        case JSON_INT64:  return value.int64;
+        case JSON_UINT64: return (value.uint64 > (u64)INT64_MAX) ? INT64_MAX : (s64)value.uint64;
+        default:          return saturate_json_f64_to_s64(value.number);
+    }
+}
 
-        void *parsed_buffer = alloc(total_buffer_size);
-        void *keys_buffer   = parsed_buffer;
-        void *values_buffer = parsed_buffer + keys_buffer_size;
-        void *chars_buffer  = values_buffer + values_buffer_size;
+u64 get_json_value_uint64(json_size value_index, json_parsed *parsed_json)
+{
+    json_value value = load_parsed_json_value(parsed_json, value_index);
+    switch(value.type)
+    {
+        case JSON_INT64:  return (value.int64 < 0) ? 0 : (u64)value.int64;
+        case JSON_UINT64: return value.uint64;
+        default:          return saturate_json_f64_to_u64(value.number);
+    }
+}
 
-        json_mem_arena keys_arena   = {.cap = keys_buffer_size,   .allocd = 0, .allocs = 0, .buffer = keys_buffer};
-        json_mem_arena values_arena = {.cap = values_buffer_size, .allocd = 0, .allocs = 0, .buffer = values_buffer};
-        json_mem_arena chars_arena  = {.cap = chars_buffer_size,  .allocd = 0, .allocs = 0, .buffer = chars_buffer};
+#define get_json_value_number(val, parsed) get_json_value_f64(val, parsed)
 
-        json_val_ptr none_value_index = alloc_json_values(&values_arena, 1);
-        json_value *val = get_arena_nth_alloc((&values_arena), none_value_index, json_value);
-        val->type = JSON_DOESNT_EXIST;
-        val->ooa  = 1; // Root object index - Useful for returning root when deref'ing non-existant value
+#ifdef JSON_COMPACT_VALUES
+// Stored values don't hold what they're read as, so they're loaded whole
+#define get_json_value_bool(val, parsed)   load_parsed_json_value(parsed, val).boolean
+#define get_json_value_string(val, parsed) load_parsed_json_value(parsed, val).string
+#define get_json_value_object(val, parsed) load_parsed_json_value(parsed, val).ooa
+#define get_json_value_array(val, parsed)  load_parsed_json_value(parsed, val).ooa
+#else
+void *get_json_value_base(json_size value_index, json_parsed *parsed_json)
+{
+    json_value *value = get_json_value_addr(parsed_json, value_index);
+    return (void*)&value->base;
+}
 
-        json_str_ptr none_string_index = alloc_json_values(&keys_arena, 1);
+#define get_json_value_typed(val, parsed, type) *(type*)get_json_value_base(val, parsed)
 
-        parse_state->num_ooas_parsed   = 1; // Skip NULL ooa
-        parse_state->keys_arena        = keys_arena;
-        parse_state->values_arena      = values_arena;
-        parse_state->chars_arena       = chars_arena;
-        // Needs to fill values, strings and chars memory
-        reset_tokenised_json(&parse_state->token_src);
-        populate_json_object(parse_state);
+#define get_json_value_bool(val, parsed)   get_json_value_typed(val, parsed, u8)
+#define get_json_value_string(val, parsed) get_json_value_typed(val, parsed, json_string)
+#define get_json_value_object(val, parsed) get_json_value_typed(val, parsed, json_ooa_ptr)
+#define get_json_value_array(val, parsed)  get_json_value_typed(val, parsed, json_ooa_ptr)
+#endif
 
-        parsed_json.free_mem_base = parsed_buffer;
-        parsed_json.ooa_list      = parse_state->ooa_list;
-        parsed_json.keys_arena    = parse_state->keys_arena;
-        parsed_json.values_arena  = parse_state->values_arena;
-        parsed_json.chars_arena   = parse_state->chars_arena;
-    }
-    return parsed_json;
+u8 is_json_value_type(json_size value_index, json_type type, json_parsed *parsed_json)
+{
+    json_value value = load_parsed_json_value(parsed_json, value_index);
+    return value.type == type;
 }
 
-json_parsed parse_json(const char *src, u32 src_size)
+u8 is_json_value_number(json_size value_index, json_parsed *parsed_json)
 {
-    json_parse_state parse_state = {0};
-    tokenise_json_in_parse_state(&parse_state, src, src_size);
+    json_type type = get_json_value_type(value_index, parsed_json);
+    return type == JSON_NUMBER || type == JSON_INT64 || type == JSON_UINT64;
+}
 
-    // Validate json to make populating object values easier
-    validate_json(&parse_state);
+#define is_json_value_f64(val, parsed)    is_json_value_type(val, JSON_NUMBER, parsed)
+#define is_json_value_int64(val, parsed)  is_json_value_type(val, JSON_INT64,  parsed)
+#define is_json_value_uint64(val, parsed) is_json_value_type(val, JSON_UINT64, parsed)
+#define is_json_value_bool(val, parsed)   is_json_value_type(val, JSON_BOOL,   parsed)
+#define is_json_value_null(val, parsed)   is_json_value_type(val, JSON_NULL,   parsed)
+#define is_json_value_string(val, parsed) is_json_value_type(val, JSON_STRING, parsed)
+#define is_json_value_object(val, parsed) is_json_value_type(val, JSON_OBJECT, parsed)
+#define is_json_value_array(val, parsed)  is_json_value_type(val, JSON_ARRAY,  parsed)
 
-    // Get json structure
-    // Parse objects and arrays in order
-    count_json_ooas_values_and_strings(&parse_state);
+// ============================== On-demand ===================================
 
-    // Parse and divvy json_values memory
-    json_parsed parsed_json = populate_parsed_json(&parse_state);
-    return parsed_json;
-}
+// Documents which are only indexed, with values read through cursors when they're asked for.
+// Opening a document builds the structural index and matches brackets. Objects and arrays
+// which aren't asked into are skipped straight to their closing bracket. Only the brackets and
+// separators are checked up front, the rest of a value is checked when it's read.
 
-// ============================== Print parsed JSON ===================================
+typedef struct
+{
+    u8           is_valid;  // Brackets matched and there's one value at the root
+    const char  *src;
+    json_size    src_size;
+    json_structural_index index;
+    json_size   *matches;   // Position of the closing bracket for each opening bracket's position
+    json_allocator allocator;
+} json_document;
 
-void print_indent(u32 indent)
+typedef struct
 {
-    for(u32 i = 0; i < indent; i += 1) printf("  ");
-}
+    json_document *document; // NULL if the cursor points at nothing
+    json_size      position; // Index into document->index.positions of the value's first char
+} json_cursor;
 
-void print_json_array_formatted(u32,json_parsed*,u32,u32);
-void print_json_object_formatted(u32,json_parsed*,u32,u32);
+#define JSON_NO_CURSOR (json_cursor){0}
 
-void print_json_value_formatted(u32 value_index, json_parsed *parsed_json, u32 indent)
+char get_json_document_char(json_document *document, json_size position)
 {
-    json_value *value = get_json_value_addr(parsed_json, value_index);
-    switch(value->type)
+    if(position >= document->index.num_positions) return 0;
+    return document->src[document->index.positions[position]];
+}
+
+// What can come next in a document, going by what came before
+typedef enum
+{
+    JSON_EXPECT_VALUE,
+    JSON_EXPECT_VALUE_OR_CLOSE, // After [
+    JSON_EXPECT_KEY,
+    JSON_EXPECT_KEY_OR_CLOSE,   // After {
+    JSON_EXPECT_COLON,
+    JSON_EXPECT_COMMA_OR_CLOSE, // After a value
+} json_expect;
+
+// Matching brackets are found with a stack threaded through matches itself. An opening bracket's
+// entry holds the opening bracket under it until it's closed, then its closing bracket. Colons
+// and commas are checked to be between keys and values on the way, so cursors can step over them
+// without finding fields or elements missing. It stops at the end of the root value, whatever's
+// after it is left to be found by skipping it.
+u8 match_json_document_brackets(json_document *document)
+{
+    const char *src       = document->src;
+    json_size  *positions = document->index.positions;
+    json_size  *matches   = document->matches;
+    json_size   top       = JSON_SIZE_MAX;
+    json_expect expect    = JSON_EXPECT_VALUE;
+    for(json_size p = 0; p < document->index.num_positions; p += 1)
     {
-        case JSON_NUMBER: printf("%f", value->number);       break;
-        case JSON_STRING: print_json_string(value->string);  break;
-        case JSON_NULL:   printf("null");                    break;
-        case JSON_BOOL:
+        char c = src[positions[p]];
+        u8 expects_value = expect == JSON_EXPECT_VALUE || expect == JSON_EXPECT_VALUE_OR_CLOSE;
+        if(c == '{' || c == '[')
         {
-            if(value->boolean) printf("true");
-            else               printf("false");
-            break;
+            if(!expects_value) return 0;
+            matches[p] = top;
+            top        = p;
+            expect     = (c == '{') ? JSON_EXPECT_KEY_OR_CLOSE : JSON_EXPECT_VALUE_OR_CLOSE;
+            continue;
         }
-        case JSON_OBJECT: print_json_object_formatted(value->ooa, parsed_json, indent, indent+2); break;
-        case JSON_ARRAY:  print_json_array_formatted(value->ooa, parsed_json, indent, indent+2);  break;
+        else if(c == '}' || c == ']')
+        {
+            if(top == JSON_SIZE_MAX) return 0;
+            char open = (c == '}') ? '{' : '[';
+            if(src[positions[top]] != open) return 0;
+            json_expect after_open = (c == '}') ? JSON_EXPECT_KEY_OR_CLOSE : JSON_EXPECT_VALUE_OR_CLOSE;
+            if(expect != JSON_EXPECT_COMMA_OR_CLOSE && expect != after_open) return 0;
+            json_size below = matches[top];
+            matches[top] = p;
+            top          = below;
+        }
+        else if(c == ':')
+        {
+            if(expect != JSON_EXPECT_COLON) return 0;
+            expect = JSON_EXPECT_VALUE;
+            continue;
+        }
+        else if(c == ',')
+        {
+            if(expect != JSON_EXPECT_COMMA_OR_CLOSE || top == JSON_SIZE_MAX) return 0;
+            expect = (src[positions[top]] == '{') ? JSON_EXPECT_KEY : JSON_EXPECT_VALUE;
+            continue;
+        }
+        else if(c == '"')
+        {
+            p += 1; // Closing quote
+            if(p >= document->index.num_positions || src[positions[p]] != '"') return 0;
+            if(expect == JSON_EXPECT_KEY || expect == JSON_EXPECT_KEY_OR_CLOSE)
+            {
+                expect = JSON_EXPECT_COLON;
+                continue;
+            }
+            if(!expects_value) return 0;
+        }
+        else if(!expects_value) return 0; // Scalar
+        expect = JSON_EXPECT_COMMA_OR_CLOSE;
+        if(top == JSON_SIZE_MAX) return 1; // Root value's ended
     }
+    return 0;
 }
 
-void print_json_array_formatted(u32 array_index, json_parsed *parsed_json, u32 start_column, u32 indent)
+// Position just past the value at position
+json_size skip_json_document_value(json_document *document, json_size position)
 {
-    json_ooa *array = get_json_ooa_addr(parsed_json, array_index);
-    
-    printf("[");
-    if(array->size > 0)
+    switch(get_json_document_char(document, position))
     {
-        printf("\n");
-        for(u32 i = 0; i < array->size; i += 1)
-        {
-            print_indent(indent);
-            print_json_value_formatted(array->vals_index+i, parsed_json, indent);
-            if(i < array->size - 1) printf(",");
-            printf("\n");
-        }
-        print_indent(start_column);
+        case '{':
+        case '[': return document->matches[position] + 1;
+        case '"': return position + 2; // Opening and closing quotes
+        default:  return position + 1;
     }
-    printf("]");
 }
 
-void print_json_object_formatted(u32 object_index, json_parsed *parsed_json, u32 start_column, u32 indent)
+// Only the parser's allocator and JSON_PARSE_CHECK_UTF8 flag are used
+json_document open_json_document(json_parser *parser, const char *src, json_size src_size)
 {
-    json_ooa *object  = get_json_ooa_addr(parsed_json, object_index);
-    json_string *keys = get_json_key_addr(parsed_json, object->keys_index);
-
-    printf("{");
-    if(object->size > 0)
+    json_document document = {0};
+    document.src       = src;
+    document.src_size  = src_size;
+    document.allocator = parser->allocator;
+    document.index     = build_json_structural_index(src, src_size, (parser->flags & JSON_PARSE_CHECK_UTF8) != 0, &document.allocator);
+    document.matches   = (json_size*)json_alloc(&document.allocator, ((u64)document.index.num_positions + 1) * sizeof(json_size));
+
+    if(document.index.utf8_error_offset != src_size)
     {
-        printf("\n");
-        for(u32 i = 0; i < object->size; i += 1)
-        {
-            print_indent(indent);
-            print_json_string(keys[i]);
-            printf(":");
-            print_json_value_formatted(object->vals_index+i, parsed_json, indent);
-            if(i < object->size - 1) printf(",");
-            printf("\n");
-        }
-        print_indent(start_column);
+        printf("Parse error: Invalid UTF-8 at byte %llu\n", (unsigned long long)document.index.utf8_error_offset);
+    }
+    else if(document.index.num_positions == 0 || !match_json_document_brackets(&document))
+    {
+        printf("Parse error: Unmatched brackets or misplaced separators\n");
+    }
+    else
+    {
+        document.is_valid = skip_json_document_value(&document, 0) == document.index.num_positions;
+        if(!document.is_valid) printf("Parse error: More than one value at the root\n");
     }
-    printf("}");
+    return document;
 }
 
-void print_json_parsed(json_parsed *parsed_json)
+void dealloc_json_document(json_document *document)
 {
-    printf("PARSED\n");
-    print_json_object_formatted(1, parsed_json, 0, 2);
-    printf("\n");
+    dealloc_json_structural_index(&document->index, &document->allocator);
+    json_dealloc(&document->allocator, document->matches);
+    document->matches  = NULL;
+    document->is_valid = 0;
 }
 
-void print_json_key(u32 key_index, json_parsed *parsed_json)
+json_cursor get_json_document_root(json_document *document)
 {
-    json_string *key = get_json_key_addr(parsed_json, key_index);
-    print_json_string(*key);
+    if(!document->is_valid) return JSON_NO_CURSOR;
+    return (json_cursor){.document = document, .position = 0};
 }
 
-void print_json_value(u32 value_index, json_parsed *parsed_json)
+u8 json_cursor_exists(json_cursor cursor)
 {
-    json_value *value = get_json_value_addr(parsed_json, value_index);
-    printf("("); print_json_value_type_string(value); printf(")");
-    print_json_value_contents(value);
+    return cursor.document != NULL;
 }
 
-void dealloc_parsed_json(json_parsed parsed_json)
+// Type and length of a scalar value, TOKEN_NONE if it isn't one or has junk stuck to it
+json_token_type read_json_cursor_token(json_cursor cursor, u32 *length)
 {
-    dealloc(parsed_json.free_mem_base);
+    json_document *document = cursor.document;
+    const char *src     = document->src + document->index.positions[cursor.position];
+    const char *src_end = document->src + document->src_size;
+    json_token_type type = read_json_token_type(src, src_end, length);
+    if(type == TOKEN_STRING)
+    {
+        // The closing quote is the next position
+        if(cursor.position + 1 >= document->index.num_positions) return TOKEN_NONE;
+        *length = document->index.positions[cursor.position + 1] - document->index.positions[cursor.position] + 1;
+        return TOKEN_STRING;
+    }
+
+    const char *after = src + *length;
+    if(after < src_end && !is_whitespace(*after) && !is_symbol_with_meaning(*after)) return TOKEN_NONE;
+    if(type != TOKEN_NUMBER && type != TOKEN_BOOL && type != TOKEN_NULL)             return TOKEN_NONE;
+    return type;
 }
 
-// ============================== Retrieval ===================================
+json_number get_json_cursor_number(json_cursor cursor)
+{
+    json_number number = {.type = JSON_NONE};
+    u32 length;
+    if(!json_cursor_exists(cursor) || read_json_cursor_token(cursor, &length) != TOKEN_NUMBER) return number;
 
-u32 find_json_object_value_by_key(u32 object_index, json_string key, json_parsed *parsed_json)
-{    
-    json_ooa    *object = get_json_ooa_addr(parsed_json, object_index);
-    json_string *keys   = get_json_key_addr(parsed_json, object->keys_index);
-    json_value  *values = get_json_value_addr(parsed_json, object->vals_index);
+    json_document *document = cursor.document;
+    parse_json_number(document->src + document->index.positions[cursor.position], document->src + document->src_size, &number);
+    return number;
+}
+
+json_type get_json_cursor_type(json_cursor cursor)
+{
+    if(!json_cursor_exists(cursor)) return JSON_DOESNT_EXIST;
+    switch(get_json_document_char(cursor.document, cursor.position))
+    {
+        case '{': return JSON_OBJECT;
+        case '[': return JSON_ARRAY;
+    }
 
-    for(u32 i = 0; i < object->size; i += 1)
+    u32 length;
+    switch(read_json_cursor_token(cursor, &length))
     {
-        if(json_string_eq(key, keys[i]))
-        {
-            return object->vals_index + i;
-        }
+        case TOKEN_STRING: return JSON_STRING;
+        case TOKEN_BOOL:   return JSON_BOOL;
+        case TOKEN_NULL:   return JSON_NULL;
+        case TOKEN_NUMBER: return get_json_cursor_number(cursor).type;
+        default:           return JSON_NONE;
     }
-    return 0; // TODO: Non-exist macro/constant? (e.g. define NON_EXIST 0)
 }
 
-u32 get_json_value(u32 ooa_index, u32 value_offset, json_parsed *parsed_json)
+f64 get_json_cursor_f64(json_cursor cursor)
 {
-    // TODO: Bounds check
-    json_ooa *ooa = get_json_ooa_addr(parsed_json, ooa_index);
-    return ooa->vals_index + value_offset;
+    json_number number = get_json_cursor_number(cursor);
+    switch(number.type)
+    {
+        case JSON_INT64:  return (f64)number.int64;
+        case JSON_UINT64: return (f64)number.uint64;
+        case JSON_NUMBER: return number.number;
+        default:          return 0.0;
+    }
 }
 
-u32 find_json_value(u32 object_index, json_string value_string, json_parsed *parsed_json)
+s64 get_json_cursor_int64(json_cursor cursor)
 {
-    return find_json_object_value_by_key(object_index, value_string, parsed_json);
+    json_number number = get_json_cursor_number(cursor);
+    switch(number.type)
+    {
+        case JSON_INT64:  return number.int64;
+        case JSON_UINT64: return (number.uint64 > (u64)INT64_MAX) ? INT64_MAX : (s64)number.uint64;
+        case JSON_NUMBER: return saturate_json_f64_to_s64(number.number);
+        default:          return 0;
+    }
 }
 
-u32 find_root_json_object(json_parsed *parsed_json)
+u8 get_json_cursor_bool(json_cursor cursor)
 {
-    return 1;
+    u32 length;
+    if(!json_cursor_exists(cursor) || read_json_cursor_token(cursor, &length) != TOKEN_BOOL) return 0;
+    return get_json_document_char(cursor.document, cursor.position) == 't';
 }
 
-u8 json_value_exists(u32 value_index)
+// Strings without escapes point into src and don't use buffer. Strings with escapes are unescaped
+// into buffer, which needs as many chars as the string has in src. Returns an empty string with
+// NULL chars if the value isn't a valid string or doesn't fit.
+json_string get_json_cursor_string(json_cursor cursor, char *buffer, u32 buffer_size)
 {
-    return value_index != 0;
+    json_string string = {0};
+    u32 length;
+    if(!json_cursor_exists(cursor) || read_json_cursor_token(cursor, &length) != TOKEN_STRING) return string;
+
+    const char *chars = cursor.document->src + cursor.document->index.positions[cursor.position] + 1;
+    u8 has_escapes;
+    if(!check_json_string(chars, length - 2, &has_escapes)) return string;
+    if(!has_escapes) return token_to_json_string_no_copy(chars, length - 2);
+    if(length - 2 > buffer_size) return string;
+
+    string.chars = buffer;
+    string.size  = unescape_json_string(chars, length - 2, buffer);
+    compute_json_string_hash(&string);
+    return string;
 }
 
-u32 get_num_json_values(u32 ooa_index, json_parsed *parsed_json)
+// Compares a string's chars in src, escapes and all, with key
+u8 json_raw_string_eq(const char *chars, u32 length, json_string key)
 {
-    json_ooa *ooa = get_json_ooa_addr(parsed_json, ooa_index);
-    return ooa->size;
+    if(memchr(chars, '\\', length) == NULL)
+    {
+        return length == key.size && memcmp(chars, key.chars, length) == 0;
+    }
+
+    u32 k = 0;
+    for(u32 i = 0; i < length;)
+    {
+        char decoded[4];
+        u32  decoded_length = 1;
+        decoded[0] = chars[i];
+        if(chars[i] == '\\')
+        {
+            u32 code_point;
+            u32 escape_length = read_json_escape(chars + i, chars + length, &code_point);
+            if(escape_length == 0) return 0;
+            decoded_length = encode_json_utf8(code_point, decoded);
+            i += escape_length;
+        }
+        else i += 1;
+
+        if(k + decoded_length > key.size || memcmp(key.chars + k, decoded, decoded_length) != 0) return 0;
+        k += decoded_length;
+    }
+    return k == key.size;
 }
 
-u32 get_json_object_key(u32 object_index, u32 key_offset, json_parsed *parsed_json)
+// First field value or array element, JSON_NO_CURSOR if there isn't one
+json_cursor get_json_cursor_child(json_cursor cursor)
 {
-    json_ooa *object = get_json_ooa_addr(parsed_json, object_index);
-    return object->keys_index + key_offset;
+    if(!json_cursor_exists(cursor)) return JSON_NO_CURSOR;
+    json_document *document = cursor.document;
+    char open = get_json_document_char(document, cursor.position);
+    if(open != '{' && open != '[') return JSON_NO_CURSOR;
+
+    json_size child = cursor.position + 1;
+    char c    = get_json_document_char(document, child);
+    if(c == '}' || c == ']') return JSON_NO_CURSOR;
+    if(open == '{')
+    {
+        // Key, closing quote and colon come before the value
+        if(c != '"' || get_json_document_char(document, child + 2) != ':') return JSON_NO_CURSOR;
+        child += 3;
+    }
+    return (json_cursor){.document = document, .position = child};
 }
 
-void *get_json_value_base(u32 value_index, json_parsed *parsed_json)
+// Field value or array element after this one, JSON_NO_CURSOR at the end
+json_cursor get_json_cursor_next(json_cursor cursor)
 {
-    json_value *value = get_json_value_addr(parsed_json, value_index);
-    return (void*)&value->base;
+    if(!json_cursor_exists(cursor) || cursor.position == 0) return JSON_NO_CURSOR;
+    json_document *document = cursor.document;
+    json_size next = skip_json_document_value(document, cursor.position);
+    if(get_json_document_char(document, next) != ',') return JSON_NO_CURSOR;
+    next += 1;
+
+    // Field values come after a colon, array elements after a comma or bracket
+    u8 in_object = get_json_document_char(document, cursor.position - 1) == ':';
+    if(in_object)
+    {
+        if(get_json_document_char(document, next) != '"' || get_json_document_char(document, next + 2) != ':') return JSON_NO_CURSOR;
+        next += 3;
+    }
+    return (json_cursor){.document = document, .position = next};
 }
 
-#define get_json_value_typed(val, parsed, type) *(type*)get_json_value_base(val, parsed)
+// Key of a field value's cursor, as it is in src (escapes aren't unescaped)
+json_string get_json_cursor_key(json_cursor cursor)
+{
+    json_string key = {0};
+    if(!json_cursor_exists(cursor) || cursor.position < 3) return key;
+    json_document *document = cursor.document;
+    if(get_json_document_char(document, cursor.position - 1) != ':') return key;
+
+    json_size open_quote  = document->index.positions[cursor.position - 3];
+    json_size close_quote = document->index.positions[cursor.position - 2];
+    return token_to_json_string_no_copy(document->src + open_quote + 1, close_quote - open_quote - 1);
+}
 
-#define get_json_value_number(val, parsed) get_json_value_typed(val, parsed, f64)
-#define get_json_value_bool(val, parsed)   get_json_value_typed(val, parsed, u8)
-#define get_json_value_string(val, parsed) get_json_value_typed(val, parsed, json_string)
-#define get_json_value_object(val, parsed) get_json_value_typed(val, parsed, json_ooa_ptr)
-#define get_json_value_array(val, parsed)  get_json_value_typed(val, parsed, json_ooa_ptr)
+json_cursor find_json_cursor_field(json_cursor cursor, json_string key)
+{
+    if(get_json_cursor_type(cursor) != JSON_OBJECT) return JSON_NO_CURSOR;
+    json_document *document = cursor.document;
+    for(json_cursor field = get_json_cursor_child(cursor); json_cursor_exists(field); field = get_json_cursor_next(field))
+    {
+        json_size open_quote  = document->index.positions[field.position - 3];
+        json_size close_quote = document->index.positions[field.position - 2];
+        if(json_raw_string_eq(document->src + open_quote + 1, close_quote - open_quote - 1, key)) return field;
+    }
+    return JSON_NO_CURSOR;
+}
 
-u8 is_json_value_type(u32 value_index, json_type type, json_parsed *parsed_json)
+json_cursor get_json_cursor_element(json_cursor cursor, json_size index)
 {
-    json_value *value = get_json_value_addr(parsed_json, value_index);
-    return value->type == type;
+    if(get_json_cursor_type(cursor) != JSON_ARRAY) return JSON_NO_CURSOR;
+    json_cursor element = get_json_cursor_child(cursor);
+    for(json_size i = 0; i < index && json_cursor_exists(element); i += 1) element = get_json_cursor_next(element);
+    return element;
 }
 
-#define is_json_value_number(val, parsed) is_json_value_type(val, JSON_NUMBER, parsed)
-#define is_json_value_bool(val, parsed)   is_json_value_type(val, JSON_BOOL,   parsed)
-#define is_json_value_null(val, parsed)   is_json_value_type(val, JSON_NULL,   parsed)
-#define is_json_value_string(val, parsed) is_json_value_type(val, JSON_STRING, parsed)
-#define is_json_value_object(val, parsed) is_json_value_type(val, JSON_OBJECT, parsed)
-#define is_json_value_array(val, parsed)  is_json_value_type(val, JSON_ARRAY,  parsed)
+json_size get_num_json_cursor_children(json_cursor cursor)
+{
+    json_size count = 0;
+    for(json_cursor child = get_json_cursor_child(cursor); json_cursor_exists(child); child = get_json_cursor_next(child)) count += 1;
+    return count;
+}
 
 #endif